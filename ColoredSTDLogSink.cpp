@@ -46,7 +46,7 @@ using namespace std;
 ColoredSTDLogSink::ColoredSTDLogSink(Severity min_severity)
 	: STDLogSink(min_severity)
 {
-
+	m_builtinType = DISPATCH_COLORED_STD;
 }
 
 ColoredSTDLogSink::~ColoredSTDLogSink()
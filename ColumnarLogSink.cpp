@@ -0,0 +1,141 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of ColumnarLogSink
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include "LogColumnStore.h"
+#include <climits>
+
+using namespace std;
+
+/**
+	@brief Creates a columnar sink
+
+	@param path			Path of the file to write
+	@param min_severity	Minimum severity of messages to write
+ */
+ColumnarLogSink::ColumnarLogSink(const string& path, Severity min_severity)
+	: LogSink(min_severity)
+	, m_writer(new LogColumnWriter(path))
+	, m_pendingSeverity(Severity::DEBUG)
+{
+	//Records are whole lines, don't wrap
+	m_termWidth = UINT_MAX;
+}
+
+ColumnarLogSink::~ColumnarLogSink()
+{
+	if(!m_pending.empty())
+		Append(m_pendingSeverity, m_pendingFunction, "\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Logging
+
+void ColumnarLogSink::Log(Severity severity, const string &msg)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, "", msg);
+}
+
+void ColumnarLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Log(severity, vstrprintf(format, va));
+}
+
+void ColumnarLogSink::LogTraceMessage(const string& function, const string& msg)
+{
+	if(Severity::DEBUG > m_min_severity)
+		return;
+
+	//The function goes in its own column rather than in the text
+	Append(Severity::DEBUG, function, GetIndentString() + msg);
+}
+
+/**
+	@brief Adds text to the line buffer and writes each complete line as a record
+ */
+void ColumnarLogSink::Append(Severity severity, const string& function, const string& text)
+{
+	string wrapped = WrapString(text);
+	if(wrapped.empty())
+		return;
+	m_lastMessageWasNewline = (wrapped[wrapped.length() - 1] == '\n');
+
+	if(m_pending.empty())
+	{
+		m_pendingSeverity = severity;
+		m_pendingFunction = function;
+	}
+	else if(severity < m_pendingSeverity)
+		m_pendingSeverity = severity;
+	m_pending += wrapped;
+
+	size_t start = 0;
+	size_t end;
+	while( (end = m_pending.find('\n', start)) != string::npos)
+	{
+		uint64_t now = chrono::duration_cast<chrono::nanoseconds>(
+			chrono::system_clock::now().time_since_epoch()).count();
+		m_writer->Append(now, m_pendingSeverity, m_pendingFunction,
+			string_view(m_pending.data() + start, end - start));
+
+		start = end + 1;
+		m_pendingSeverity = severity;
+		m_pendingFunction = function;
+	}
+	m_pending.erase(0, start);
+}
+
+/**
+	@brief True if the file was opened successfully
+ */
+bool ColumnarLogSink::IsOpen()
+{
+	return m_writer->IsOpen();
+}
+
+/**
+	@brief Writes the records so far (except a partial line) as a segment, so readers can see them
+ */
+void ColumnarLogSink::Flush()
+{
+	lock_guard<mutex> lock(g_log_mutex);
+	m_writer->Flush();
+}
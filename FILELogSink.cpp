@@ -47,6 +47,8 @@ FILELogSink::FILELogSink(FILE *f, bool line_buffered, Severity min_severity)
 	: LogSink(min_severity)
 	, m_file(f)
 {
+	m_builtinType = DISPATCH_FILE;
+
 	if(line_buffered)
 		setvbuf(f, NULL, _IOLBF, 0);
 }
@@ -64,15 +66,20 @@ void FILELogSink::Log(Severity severity, const std::string &msg)
 	if(severity > m_min_severity)
 		return;
 
-	//Wrap/print it
-	string wrapped = WrapString(msg);
-	fputs(wrapped.c_str(), m_file);
+	//Wrap/print it. Very long messages are streamed out rather than wrapped into a second copy
+	if(msg.length() > g_logStreamThreshold)
+		WriteStreamed(m_file, msg);
+	else
+	{
+		string wrapped = WrapString(msg);
+		fputs(wrapped.c_str(), m_file);
 
-	//See if we printed a \n
-	if(wrapped.length() && (wrapped[wrapped.length() - 1] == '\n'))
-		m_lastMessageWasNewline = true;
-	else if(wrapped != "")
-		m_lastMessageWasNewline = false;
+		//See if we printed a \n
+		if(wrapped.length() && (wrapped[wrapped.length() - 1] == '\n'))
+			m_lastMessageWasNewline = true;
+		else if(wrapped != "")
+			m_lastMessageWasNewline = false;
+	}
 
 	//Immediately flush log on fatal/error/warning so we can postmortem better in case of crash
 	if(severity <= Severity::WARNING)
@@ -84,17 +91,5 @@ void FILELogSink::Log(Severity severity, const char *format, va_list va)
 	if(severity > m_min_severity)
 		return;
 
-	//Wrap/print it
-	string wrapped = WrapString(vstrprintf(format, va));
-	fputs(wrapped.c_str(), m_file);
-
-	//See if we printed a \n
-	if(wrapped.length() && (wrapped[wrapped.length() - 1] == '\n'))
-		m_lastMessageWasNewline = true;
-	else if(wrapped != "")
-		m_lastMessageWasNewline = false;
-
-	//Immediately flush log on fatal/error/warning so we can postmortem better in case of crash
-	if(severity <= Severity::WARNING)
-		fflush(m_file);
+	Log(severity, vstrprintf(format, va));
 }
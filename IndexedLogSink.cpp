@@ -0,0 +1,396 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of IndexedLogSink
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include "LogSearch.h"
+#include <algorithm>
+#include <climits>
+#include <ctime>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+IndexedLogSink::IndexedLogSink(Severity min_severity)
+	: LogSink(min_severity)
+	, m_pendingSeverity(Severity::DEBUG)
+	, m_charged(0)
+	, m_postingBytes(0)
+{
+	//Viewers do their own wrapping
+	m_termWidth = UINT_MAX;
+
+	m_offsets.push_back(0);
+
+	//Class 0 (the empty interned string) is "no class"
+	m_classPostings.emplace_back();
+}
+
+IndexedLogSink::~IndexedLogSink()
+{
+	LogMemoryCharge(LOG_MEMORY_INDEXES, -static_cast<ptrdiff_t>(m_charged));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Logging
+
+void IndexedLogSink::Log(Severity severity, const string &msg)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, msg, "");
+}
+
+void IndexedLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, vstrprintf(format, va), "");
+}
+
+void IndexedLogSink::LogTraceMessage(const string& function, const string& msg)
+{
+	if(Severity::DEBUG > m_min_severity)
+		return;
+
+	Append(Severity::DEBUG, msg, function);
+}
+
+/**
+	@brief Adds text to the line buffer and stores each complete line as a record
+ */
+void IndexedLogSink::Append(Severity severity, const string& text, const string& function)
+{
+	string wrapped = WrapString(text);
+	if(wrapped.empty())
+		return;
+	m_lastMessageWasNewline = (wrapped[wrapped.length() - 1] == '\n');
+
+	if(m_pending.empty() || (severity < m_pendingSeverity) )
+		m_pendingSeverity = severity;
+	m_pending += wrapped;
+
+	size_t start = 0;
+	size_t end;
+	while( (end = m_pending.find('\n', start)) != string::npos)
+	{
+		AddRecord(m_pendingSeverity, m_pending.c_str() + start, end - start, function);
+		start = end + 1;
+		m_pendingSeverity = severity;
+	}
+	m_pending.erase(0, start);
+}
+
+/**
+	@brief Appends a record to the columns, the arena and the posting lists
+ */
+void IndexedLogSink::AddRecord(Severity severity, const char* line, size_t len, const string& function)
+{
+	if(LogMemoryShed(severity))
+		return;
+
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	lock_guard<shared_mutex> lock(m_storeMutex);
+
+	uint32_t record = m_timestamps.size();
+	uint32_t cls = GetClassID(function);
+	uint32_t thread = GetThreadID();
+
+	size_t postings = m_classPostings[cls].capacity() + m_threadPostings[thread].capacity();
+
+	m_arena.append(line, len);
+	m_arena += '\n';
+	m_offsets.push_back(m_arena.length());
+	m_timestamps.push_back(now.tv_sec * 1000000000ULL + now.tv_nsec);
+	m_severities.push_back(static_cast<uint8_t>(severity));
+	m_threads.push_back(thread);
+	m_classes.push_back(cls);
+	m_classPostings[cls].push_back(record);
+	m_threadPostings[thread].push_back(record);
+
+	//Charge by capacity, which only changes when something reallocates
+	postings = m_classPostings[cls].capacity() + m_threadPostings[thread].capacity() - postings;
+	m_postingBytes += postings * sizeof(uint32_t);
+	size_t bytes =
+		m_arena.capacity() +
+		m_offsets.capacity() * sizeof(uint64_t) +
+		m_timestamps.capacity() * sizeof(uint64_t) +
+		m_severities.capacity() * sizeof(uint8_t) +
+		m_threads.capacity() * sizeof(uint32_t) +
+		m_classes.capacity() * sizeof(uint32_t) +
+		m_postingBytes;
+	if(bytes != m_charged)
+	{
+		LogMemoryCharge(LOG_MEMORY_INDEXES, bytes - m_charged);
+		m_charged = bytes;
+	}
+}
+
+/**
+	@brief Gets the ID (the interned string ID) for the class of a trace function name
+
+	Caller must hold m_storeMutex exclusively.
+ */
+uint32_t IndexedLogSink::GetClassID(const string& function)
+{
+	//Class is everything before the last ::, or the whole name for global functions
+	string_view name(function);
+	size_t icolon = name.rfind("::");
+	uint32_t id = LogInternString( (icolon == string_view::npos) ? name : name.substr(0, icolon));
+
+	if(id >= m_classPostings.size())
+		m_classPostings.resize(id + 1);
+	return id;
+}
+
+/**
+	@brief Gets (allocating if needed) the ID for the calling thread
+
+	Caller must hold m_storeMutex exclusively.
+ */
+uint32_t IndexedLogSink::GetThreadID()
+{
+	auto tid = this_thread::get_id();
+	auto it = m_threadIDs.find(tid);
+	if(it != m_threadIDs.end())
+		return it->second;
+
+	uint32_t id = m_threadPostings.size();
+	m_threadIDs[tid] = id;
+	m_threadPostings.emplace_back();
+	return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Filtering
+
+/**
+	@brief Brings a view up to date with the records added since it was last updated
+
+	The cheapest available index drives the scan: the posting lists for class or thread filters (unless they cover
+	so much of the range that searching the whole arena for the filter's text is faster), otherwise the arena for
+	substring filters, otherwise the severity column.
+ */
+void IndexedLogSink::Update(View& view)
+{
+	shared_lock<shared_mutex> lock(m_storeMutex);
+
+	uint32_t start = view.m_scanned;
+	uint32_t end = m_timestamps.size();
+	if(start >= end)
+		return;
+
+	auto& filter = view.m_filter;
+	size_t firstNew = view.m_matches.size();
+
+	//Find the posting lists for a class or thread filter, using whichever set is likely smaller
+	vector<const vector<uint32_t>*> lists;
+	size_t candidates = 0;
+	bool indexed = !filter.classes.empty() || !filter.threads.empty();
+	if(indexed)
+	{
+		bool byClass = !filter.classes.empty() &&
+			(filter.threads.empty() || (filter.classes.size() <= filter.threads.size()) );
+		auto& ids = byClass ? filter.classes : filter.threads;
+		auto& postings = byClass ? m_classPostings : m_threadPostings;
+		for(auto id : ids)
+		{
+			if(id >= postings.size())
+				continue;
+			auto& list = postings[id];
+			lists.push_back(&list);
+			candidates += list.end() - lower_bound(list.begin(), list.end(), start);
+		}
+	}
+
+	//Posting lists win unless we also have text to find and they cover much of the range
+	if(indexed && (filter.text.empty() || (candidates * 8 < end - start) ) )
+	{
+		for(auto list : lists)
+			ScanPostings(view, *list, start, end);
+
+		//Several lists give several sorted runs
+		if(lists.size() > 1)
+			sort(view.m_matches.begin() + firstNew, view.m_matches.end());
+	}
+
+	else if(!filter.text.empty())
+		ScanText(view, start, end);
+
+	else
+	{
+		uint8_t maxSeverity = static_cast<uint8_t>(filter.maxSeverity);
+		for(uint32_t i = start; i < end; i++)
+		{
+			if(m_severities[i] <= maxSeverity)
+				view.m_matches.push_back(i);
+		}
+	}
+
+	view.m_scanned = end;
+}
+
+/**
+	@brief Checks a record against every criterion of a filter except the text
+
+	Caller must hold m_storeMutex.
+ */
+bool IndexedLogSink::Matches(const Filter& filter, uint32_t record)
+{
+	if(m_severities[record] > static_cast<uint8_t>(filter.maxSeverity))
+		return false;
+	if(!filter.classes.empty() && (filter.classes.find(m_classes[record]) == filter.classes.end()) )
+		return false;
+	if(!filter.threads.empty() && (filter.threads.find(m_threads[record]) == filter.threads.end()) )
+		return false;
+	return true;
+}
+
+/**
+	@brief Adds the records in [start, end) from a posting list that match the filter
+
+	Caller must hold m_storeMutex.
+ */
+void IndexedLogSink::ScanPostings(View& view, const vector<uint32_t>& postings, uint32_t start, uint32_t end)
+{
+	auto& needle = view.m_filter.text;
+	const char* base = m_arena.data();
+	for(auto it = lower_bound(postings.begin(), postings.end(), start);
+		(it != postings.end()) && (*it < end);
+		++it)
+	{
+		if(!Matches(view.m_filter, *it))
+			continue;
+		if(!needle.empty() && !LogFindSubstring(base + m_offsets[*it], base + m_offsets[*it + 1] - 1, needle))
+			continue;
+		view.m_matches.push_back(*it);
+	}
+}
+
+/**
+	@brief Adds the records in [start, end) whose text contains the filter's substring and that match the rest of it
+
+	Caller must hold m_storeMutex.
+ */
+void IndexedLogSink::ScanText(View& view, uint32_t start, uint32_t end)
+{
+	auto& needle = view.m_filter.text;
+
+	//Records can't contain newlines, so neither can a match
+	if(needle.find('\n') != string::npos)
+		return;
+
+	const char* base = m_arena.data();
+	const char* p = base + m_offsets[start];
+	const char* stop = base + m_offsets[end];
+	auto first = m_offsets.begin() + start;
+	auto last = m_offsets.begin() + end + 1;
+	while( (p = LogFindSubstring(p, stop, needle)) != nullptr)
+	{
+		//Find the record containing the match, and resume the search at the next one
+		first = upper_bound(first, last, static_cast<uint64_t>(p - base)) - 1;
+		uint32_t record = first - m_offsets.begin();
+		if(Matches(view.m_filter, record))
+			view.m_matches.push_back(record);
+		p = base + m_offsets[record + 1];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Accessors
+
+size_t IndexedLogSink::GetRecordCount()
+{
+	shared_lock<shared_mutex> lock(m_storeMutex);
+	return m_timestamps.size();
+}
+
+///@brief Gets the text of a record (without the newline)
+string IndexedLogSink::GetText(uint32_t record)
+{
+	shared_lock<shared_mutex> lock(m_storeMutex);
+	return m_arena.substr(m_offsets[record], m_offsets[record+1] - m_offsets[record] - 1);
+}
+
+Severity IndexedLogSink::GetSeverity(uint32_t record)
+{
+	shared_lock<shared_mutex> lock(m_storeMutex);
+	return static_cast<Severity>(m_severities[record]);
+}
+
+///@brief Gets the time a record was completed, in ns since the Unix epoch
+uint64_t IndexedLogSink::GetTimestamp(uint32_t record)
+{
+	shared_lock<shared_mutex> lock(m_storeMutex);
+	return m_timestamps[record];
+}
+
+///@brief Gets the ID of the thread that logged a record
+uint32_t IndexedLogSink::GetThread(uint32_t record)
+{
+	shared_lock<shared_mutex> lock(m_storeMutex);
+	return m_threads[record];
+}
+
+///@brief Gets the class ID of a record (0 if it wasn't from LogTrace())
+uint32_t IndexedLogSink::GetClass(uint32_t record)
+{
+	shared_lock<shared_mutex> lock(m_storeMutex);
+	return m_classes[record];
+}
+
+string IndexedLogSink::GetClassName(uint32_t id)
+{
+	return string(LogGetInternedString(id));
+}
+
+///@brief Looks up the ID of a class by name, returning false if no record from it has been stored
+bool IndexedLogSink::FindClass(const string& name, uint32_t& id)
+{
+	uint32_t interned = LogLookupInternedString(name);
+	if(!interned && !name.empty())
+		return false;
+
+	shared_lock<shared_mutex> lock(m_storeMutex);
+	if( (interned >= m_classPostings.size()) || (interned && m_classPostings[interned].empty()) )
+		return false;
+	id = interned;
+	return true;
+}
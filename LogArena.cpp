@@ -0,0 +1,423 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of the log record allocator
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include "LogArena.h"
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+///@brief Size of a slab. Slabs are aligned to their size, so a block's slab is found by masking its address.
+static const size_t g_logArenaSlabSize = 64 * 1024;
+
+///@brief Space at the start of each slab for its LogArenaSlab header
+static const size_t g_logArenaSlabHeaderSize = 64;
+
+///@brief Slabs are carved out of chunks of this size, which is one huge page when those are enabled
+static const size_t g_logArenaChunkSize = 2 * 1024 * 1024;
+
+///@brief Blocks a thread collects for one owning heap before handing them back
+static const uint32_t g_logArenaBatchSize = 64;
+
+///@brief Block sizes, about 1.5x apart
+static const size_t g_logArenaClassSizes[] =
+	{ 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096 };
+static const size_t g_logArenaClassCount = sizeof(g_logArenaClassSizes) / sizeof(g_logArenaClassSizes[0]);
+static const size_t g_logArenaMaxSize = 4096;
+
+/**
+	@brief Size class for each 16-byte step of request size
+ */
+struct LogArenaClassTable
+{
+	uint8_t index[g_logArenaMaxSize / 16 + 1];
+
+	constexpr LogArenaClassTable()
+		: index()
+	{
+		size_t c = 0;
+		for(size_t i=0; i <= g_logArenaMaxSize / 16; i++)
+		{
+			while(g_logArenaClassSizes[c] < i * 16)
+				c ++;
+			index[i] = c;
+		}
+	}
+};
+
+static constexpr LogArenaClassTable g_logArenaClassTable;
+
+struct LogArenaHeap;
+
+/**
+	@brief Header at the start of every slab
+ */
+struct LogArenaSlab
+{
+	LogArenaHeap*	owner;
+	uint32_t		sizeClass;
+};
+
+/**
+	@brief A free block, linked through its own storage
+ */
+struct LogArenaBlock
+{
+	LogArenaBlock*	next;
+};
+
+/**
+	@brief A heap's blocks of one size class
+ */
+struct LogArenaClass
+{
+	///@brief Blocks freed on the owning thread, or returned from other threads
+	LogArenaBlock*	freeList = nullptr;
+
+	///@brief Never used space left in the newest slab of this class
+	char*			bump = nullptr;
+	char*			bumpEnd = nullptr;
+};
+
+/**
+	@brief One thread's heap. Heaps are never destroyed; when a thread exits, its heap waits to be adopted.
+ */
+struct LogArenaHeap
+{
+	LogArenaClass classes[g_logArenaClassCount];
+
+	///@brief Next heap in g_logArenaAbandoned
+	LogArenaHeap* nextAbandoned = nullptr;
+
+	///@brief Blocks freed by other threads, pushed a batch at a time. On its own cache line, since they write it.
+	alignas(64) atomic<LogArenaBlock*> remote{nullptr};
+};
+
+/**
+	@brief Blocks this thread has freed on behalf of another heap, not handed back yet
+ */
+struct LogArenaPending
+{
+	LogArenaHeap*	owner;
+	LogArenaBlock*	head;
+	LogArenaBlock*	tail;
+	uint32_t		count;
+};
+
+///@brief Protects everything below
+static mutex g_logArenaMutex;
+
+///@brief Unused part of the current chunk
+static char* g_logArenaChunkNext = nullptr;
+static char* g_logArenaChunkEnd = nullptr;
+
+///@brief Heaps of threads that have exited
+static LogArenaHeap* g_logArenaAbandoned = nullptr;
+
+///@brief Set by LogArenaSetHugePages()
+static atomic<bool> g_logArenaHugePages(false);
+
+///@brief This thread's heap, or null before its first allocation
+static thread_local LogArenaHeap* g_logArenaHeap = nullptr;
+
+///@brief Frees being collected for other heaps, direct-mapped by owner
+static const size_t g_logArenaPendingCount = 4;
+static thread_local LogArenaPending g_logArenaPending[g_logArenaPendingCount];
+
+///@brief Set once this thread's exit handler has run
+static thread_local bool g_logArenaExited = false;
+
+static void LogArenaFlushPending(LogArenaPending& pending);
+
+/**
+	@brief Hands this thread's pending frees and its heap over when the thread exits
+ */
+struct LogArenaThread
+{
+	bool registered = false;
+
+	~LogArenaThread()
+	{
+		for(auto& p : g_logArenaPending)
+			LogArenaFlushPending(p);
+
+		if(g_logArenaHeap)
+		{
+			lock_guard<mutex> lock(g_logArenaMutex);
+			g_logArenaHeap->nextAbandoned = g_logArenaAbandoned;
+			g_logArenaAbandoned = g_logArenaHeap;
+		}
+		g_logArenaHeap = nullptr;
+		g_logArenaExited = true;
+	}
+};
+
+static thread_local LogArenaThread g_logArenaThread;
+
+/**
+	@brief Uses huge pages for slabs allocated from now on
+
+	Tries an explicit huge page mapping first (which needs pages reserved by the administrator) and falls back to
+	asking for transparent huge pages. Has no effect on Windows.
+ */
+void LogArenaSetHugePages(bool enable)
+{
+	g_logArenaHugePages = enable;
+}
+
+/**
+	@brief Gets a new chunk of memory to carve slabs out of. Caller must hold g_logArenaMutex.
+ */
+static char* LogArenaAllocateChunk()
+{
+#ifdef _WIN32
+	return static_cast<char*>(_aligned_malloc(g_logArenaChunkSize, g_logArenaChunkSize));
+#else
+	bool huge = g_logArenaHugePages;
+
+#ifdef MAP_HUGETLB
+	if(huge)
+	{
+		void* p = mmap(nullptr, g_logArenaChunkSize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED)
+			return static_cast<char*>(p);
+	}
+#endif
+
+	void* p = nullptr;
+	if(posix_memalign(&p, g_logArenaChunkSize, g_logArenaChunkSize) != 0)
+		return nullptr;
+
+#ifdef MADV_HUGEPAGE
+	if(huge)
+		madvise(p, g_logArenaChunkSize, MADV_HUGEPAGE);
+#else
+	(void)huge;
+#endif
+
+	return static_cast<char*>(p);
+#endif
+}
+
+/**
+	@brief Gets the heap for this thread, adopting an abandoned one if there is one
+ */
+static LogArenaHeap* LogArenaAcquireHeap()
+{
+	//A thread logging from its own exit handlers after ours ran gets a heap that is never handed back
+	if(!g_logArenaExited)
+		g_logArenaThread.registered = true;
+
+	lock_guard<mutex> lock(g_logArenaMutex);
+	auto heap = g_logArenaAbandoned;
+	if(heap)
+		g_logArenaAbandoned = heap->nextAbandoned;
+	else
+		heap = new LogArenaHeap;
+
+	g_logArenaHeap = heap;
+	return heap;
+}
+
+static inline LogArenaSlab* LogArenaSlabOf(void* p)
+{
+	return reinterpret_cast<LogArenaSlab*>(reinterpret_cast<uintptr_t>(p) & ~(g_logArenaSlabSize - 1));
+}
+
+/**
+	@brief Allocates a block when the free list of its class is empty
+
+	Takes back blocks other threads have freed, then uses the rest of the newest slab, then starts a new slab.
+ */
+static void* LogArenaRefill(LogArenaHeap* heap, size_t sizeClass)
+{
+	auto& cls = heap->classes[sizeClass];
+
+	if(heap->remote.load(memory_order_relaxed))
+	{
+		auto b = heap->remote.exchange(nullptr, memory_order_acquire);
+		while(b)
+		{
+			auto next = b->next;
+			auto& owner = heap->classes[LogArenaSlabOf(b)->sizeClass];
+			b->next = owner.freeList;
+			owner.freeList = b;
+			b = next;
+		}
+
+		if(cls.freeList)
+		{
+			auto block = cls.freeList;
+			cls.freeList = block->next;
+			return block;
+		}
+	}
+
+	size_t size = g_logArenaClassSizes[sizeClass];
+	if(cls.bump + size > cls.bumpEnd)
+	{
+		char* slab;
+		{
+			lock_guard<mutex> lock(g_logArenaMutex);
+			if(g_logArenaChunkNext == g_logArenaChunkEnd)
+			{
+				g_logArenaChunkNext = LogArenaAllocateChunk();
+				if(!g_logArenaChunkNext)
+				{
+					g_logArenaChunkEnd = nullptr;
+					return nullptr;
+				}
+				g_logArenaChunkEnd = g_logArenaChunkNext + g_logArenaChunkSize;
+			}
+			slab = g_logArenaChunkNext;
+			g_logArenaChunkNext += g_logArenaSlabSize;
+		}
+
+		auto header = reinterpret_cast<LogArenaSlab*>(slab);
+		header->owner = heap;
+		header->sizeClass = sizeClass;
+		cls.bump = slab + g_logArenaSlabHeaderSize;
+		cls.bumpEnd = slab + g_logArenaSlabSize;
+	}
+
+	void* ret = cls.bump;
+	cls.bump += size;
+	return ret;
+}
+
+/**
+	@brief Allocates a block of at least size bytes, or returns null if out of memory
+ */
+void* LogArenaAllocate(size_t size)
+{
+	if(size > g_logArenaMaxSize)
+		return malloc(size);
+
+	auto heap = g_logArenaHeap;
+	if(!heap)
+		heap = LogArenaAcquireHeap();
+
+	size_t sizeClass = g_logArenaClassTable.index[(size + 15) / 16];
+	auto& cls = heap->classes[sizeClass];
+	auto block = cls.freeList;
+	if(!block)
+		return LogArenaRefill(heap, sizeClass);
+	cls.freeList = block->next;
+	return block;
+}
+
+/**
+	@brief Pushes a batch of frees onto the owning heap's remote list, with a single CAS
+ */
+static void LogArenaFlushPending(LogArenaPending& pending)
+{
+	if(!pending.head)
+		return;
+
+	auto& remote = pending.owner->remote;
+	pending.tail->next = remote.load(memory_order_relaxed);
+	while(!remote.compare_exchange_weak(pending.tail->next, pending.head, memory_order_release, memory_order_relaxed))
+	{}
+
+	pending.head = nullptr;
+	pending.tail = nullptr;
+	pending.count = 0;
+}
+
+/**
+	@brief Frees a block from LogArenaAllocate()
+
+	@param p	The block, or null
+	@param size	Size passed to LogArenaAllocate()
+ */
+void LogArenaFree(void* p, size_t size)
+{
+	if(!p)
+		return;
+	if(size > g_logArenaMaxSize)
+	{
+		free(p);
+		return;
+	}
+
+	auto block = static_cast<LogArenaBlock*>(p);
+	auto slab = LogArenaSlabOf(p);
+	auto owner = slab->owner;
+
+	//Our own block goes straight back on our free list
+	if(owner == g_logArenaHeap)
+	{
+		auto& cls = owner->classes[slab->sizeClass];
+		block->next = cls.freeList;
+		cls.freeList = block;
+		return;
+	}
+
+	//Someone else's waits until we have a batch for them (unless this thread is exiting)
+	uintptr_t key = reinterpret_cast<uintptr_t>(owner);
+	auto& pending = g_logArenaPending[(key >> 6) % g_logArenaPendingCount];
+	if(pending.owner != owner)
+	{
+		LogArenaFlushPending(pending);
+		pending.owner = owner;
+	}
+
+	block->next = pending.head;
+	if(!pending.head)
+		pending.tail = block;
+	pending.head = block;
+	pending.count ++;
+
+	if( (pending.count >= g_logArenaBatchSize) || g_logArenaExited)
+		LogArenaFlushPending(pending);
+}
+
+/**
+	@brief Hands back every block this thread has freed for other threads so far
+
+	Happens automatically every 64 blocks per owner and when the thread exits. A thread that frees other threads'
+	records and then goes idle for a long time can call this first so the owners can reuse them.
+ */
+void LogArenaFlush()
+{
+	for(auto& p : g_logArenaPending)
+		LogArenaFlushPending(p);
+}
@@ -0,0 +1,60 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+#ifndef LogArena_h
+#define LogArena_h
+
+/**
+	@file
+	@brief		Declaration of the log record allocator
+	@ingroup	liblog
+ */
+
+#include <cstddef>
+
+/**
+	@brief		Allocates storage for a log record from the calling thread's slabs
+	@ingroup	liblog
+
+	Each thread has its own heap of 64 KB slabs, one size class per slab, so allocating and freeing on the same
+	thread never touches shared state. A block freed by another thread is queued on that thread and handed back to
+	the owning heap in batches of 64, with one atomic operation per batch. The owner picks returned blocks up when
+	its own free list for a size class runs dry. When a thread exits, its heap is adopted by the next thread that
+	needs one, so blocks still in use elsewhere can be freed safely.
+
+	Sizes above 4 KB go to malloc(). The caller passes the size back to LogArenaFree(), so blocks carry no header.
+	Slabs are never returned to the system.
+ */
+void* LogArenaAllocate(size_t size);
+void LogArenaFree(void* p, size_t size);
+
+void LogArenaFlush();
+void LogArenaSetHugePages(bool enable);
+
+#endif
@@ -0,0 +1,627 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of LogColumnWriter and LogColumnReader
+	@ingroup	liblog
+ */
+
+#include "LogColumnStore.h"
+#include <cstring>
+
+using namespace std;
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Encoding helpers
+
+///@brief Sizes of the headers on disk, where they're packed field by field
+static const size_t g_fileHeaderSize = 16;
+static const size_t g_segmentHeaderSize = 72;
+
+static void PutLE(char*& p, uint64_t value, size_t bytes)
+{
+	for(size_t i=0; i<bytes; i++)
+		*p++ = static_cast<char>(value >> (8 * i));
+}
+
+static uint64_t GetLE(const char*& p, size_t bytes)
+{
+	uint64_t value = 0;
+	for(size_t i=0; i<bytes; i++)
+		value |= static_cast<uint64_t>(static_cast<uint8_t>(*p++)) << (8 * i);
+	return value;
+}
+
+static void EncodeSegmentHeader(const LogColumnSegmentHeader& header, char* out)
+{
+	PutLE(out, header.magic, 4);
+	PutLE(out, header.count, 4);
+	PutLE(out, header.firstTimestamp, 8);
+	PutLE(out, header.minTimestamp, 8);
+	PutLE(out, header.maxTimestamp, 8);
+	for(auto size : header.columnSize)
+		PutLE(out, size, 8);
+}
+
+static void DecodeSegmentHeader(const char* in, LogColumnSegmentHeader& header)
+{
+	header.magic = GetLE(in, 4);
+	header.count = GetLE(in, 4);
+	header.firstTimestamp = GetLE(in, 8);
+	header.minTimestamp = GetLE(in, 8);
+	header.maxTimestamp = GetLE(in, 8);
+	for(auto& size : header.columnSize)
+		size = GetLE(in, 8);
+}
+
+static void PutVarint(string& out, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		out += static_cast<char>( (value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += static_cast<char>(value);
+}
+
+static bool GetVarint(const char*& p, const char* end, uint64_t& value)
+{
+	value = 0;
+	for(int shift = 0; (p < end) && (shift < 64); shift += 7)
+	{
+		uint8_t b = *p++;
+		value |= static_cast<uint64_t>(b & 0x7f) << shift;
+		if(!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+/**
+	@brief Writes a literal or match length overflowing its 4-bit field as a run of bytes
+ */
+static void PutLength(string& out, size_t len)
+{
+	for(; len >= 255; len -= 255)
+		out += static_cast<char>(255);
+	out += static_cast<char>(len);
+}
+
+static bool GetLength(const char*& p, const char* end, size_t& len)
+{
+	uint8_t b;
+	do
+	{
+		if(p >= end)
+			return false;
+		b = *p++;
+		len += b;
+	} while(b == 255);
+	return true;
+}
+
+/**
+	@brief Compresses a block of text with a simple LZ77 scheme
+
+	The output is a series of sequences, each a token byte (4 bits literal count, 4 bits match length - 4), any
+	overflow of either length, the literal bytes, and a 16-bit offset back to the match. The last sequence is literals
+	only. Matches are found with a single-entry hash table, which is fast and does well on the repetitive text of a
+	log.
+ */
+static void Compress(const char* src, size_t len, string& out)
+{
+	const int hashBits = 14;
+	vector<uint32_t> table(1 << hashBits, 0);
+
+	size_t anchor = 0;
+	size_t i = 0;
+	size_t limit = (len > 5) ? len - 5 : 0;
+	while(i + 4 <= limit)
+	{
+		uint32_t v;
+		memcpy(&v, src + i, 4);
+		uint32_t h = (v * 2654435761u) >> (32 - hashBits);
+		size_t cand = table[h];
+		table[h] = i;
+
+		if( (cand >= i) || (i - cand > 65535) || (memcmp(src + cand, src + i, 4) != 0) )
+		{
+			//Step faster through text that isn't matching
+			i += 1 + ( (i - anchor) >> 6);
+			continue;
+		}
+
+		size_t mlen = 4;
+		while( (i + mlen < limit) && (src[cand + mlen] == src[i + mlen]) )
+			mlen ++;
+
+		size_t lit = i - anchor;
+		out += static_cast<char>( (min(lit, size_t(15)) << 4) | min(mlen - 4, size_t(15)) );
+		if(lit >= 15)
+			PutLength(out, lit - 15);
+		out.append(src + anchor, lit);
+		size_t offset = i - cand;
+		out += static_cast<char>(offset & 0xff);
+		out += static_cast<char>(offset >> 8);
+		if(mlen - 4 >= 15)
+			PutLength(out, mlen - 4 - 15);
+
+		i += mlen;
+		anchor = i;
+	}
+
+	size_t lit = len - anchor;
+	out += static_cast<char>(min(lit, size_t(15)) << 4);
+	if(lit >= 15)
+		PutLength(out, lit - 15);
+	out.append(src + anchor, lit);
+}
+
+/**
+	@brief Reverses Compress(), appending exactly len bytes to out
+
+	@return False if the data is corrupt
+ */
+static bool Decompress(const char* p, const char* end, size_t len, string& out)
+{
+	out.resize(len);
+	char* dst = &out[0];
+	size_t pos = 0;
+	while(p < end)
+	{
+		uint8_t token = *p++;
+		size_t lit = token >> 4;
+		if( (lit == 15) && !GetLength(p, end, lit) )
+			return false;
+		if( (lit > static_cast<size_t>(end - p)) || (lit > len - pos) )
+			return false;
+		memcpy(dst + pos, p, lit);
+		p += lit;
+		pos += lit;
+		if(p == end)
+			break;
+
+		if(end - p < 2)
+			return false;
+		size_t offset = static_cast<uint8_t>(p[0]) | (static_cast<uint8_t>(p[1]) << 8);
+		p += 2;
+		size_t mlen = token & 0xf;
+		if( (mlen == 15) && !GetLength(p, end, mlen) )
+			return false;
+		mlen += 4;
+		if( (offset == 0) || (offset > pos) || (mlen > len - pos) )
+			return false;
+
+		//Matches may overlap the bytes they produce, so copy forwards a byte at a time
+		const char* from = dst + pos - offset;
+		for(size_t i=0; i<mlen; i++)
+			dst[pos + i] = from[i];
+		pos += mlen;
+	}
+	return pos == len;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// LogColumnWriter
+
+/**
+	@brief Creates (or truncates) a columnar log file
+
+	@param path			Path of the file
+	@param segmentSize	Number of records per segment
+ */
+LogColumnWriter::LogColumnWriter(const string& path, size_t segmentSize)
+	: m_file(fopen(path.c_str(), "wb"))
+	, m_segmentSize(max(segmentSize, size_t(1)))
+{
+	if(!m_file)
+		return;
+
+	char header[g_fileHeaderSize] = {0};
+	memcpy(header, LOG_COLUMN_FILE_MAGIC, sizeof(LOG_COLUMN_FILE_MAGIC));
+	char* p = header + 8;
+	PutLE(p, LOG_COLUMN_FILE_VERSION, 4);
+	fwrite(header, sizeof(header), 1, m_file);
+}
+
+LogColumnWriter::~LogColumnWriter()
+{
+	Flush();
+	if(m_file)
+		fclose(m_file);
+}
+
+/**
+	@brief Adds a record, writing out the segment if it's full
+
+	@param timestamp	Time in ns since the Unix epoch
+	@param severity		Severity of the message
+	@param function		"Class::function" for LogTrace() output, otherwise empty
+	@param text			Text of the message
+ */
+void LogColumnWriter::Append(uint64_t timestamp, Severity severity, string_view function, string_view text)
+{
+	m_timestamps.push_back(timestamp);
+	m_severities.push_back(severity);
+	m_functions.Add(function);
+	size_t icolon = function.rfind("::");
+	m_classes.Add( (icolon == string_view::npos) ? function : function.substr(0, icolon));
+	m_textLengths.push_back(text.length());
+	m_text.append(text.data(), text.length());
+
+	if(m_timestamps.size() >= m_segmentSize)
+		Flush();
+}
+
+/**
+	@brief Writes out the records collected so far as a segment
+ */
+void LogColumnWriter::Flush()
+{
+	if(m_timestamps.empty() || !m_file)
+		return;
+
+	LogColumnSegmentHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = LOG_COLUMN_SEGMENT_MAGIC;
+	header.count = m_timestamps.size();
+	header.firstTimestamp = m_timestamps[0];
+	header.minTimestamp = m_timestamps[0];
+	header.maxTimestamp = m_timestamps[0];
+
+	string columns[LOG_COLUMN_COUNT];
+
+	//Timestamps: deltas are usually small and positive, but can go backwards when threads race to log
+	uint64_t prev = header.firstTimestamp;
+	for(auto t : m_timestamps)
+	{
+		int64_t delta = static_cast<int64_t>(t - prev);
+		PutVarint(columns[0], (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+		prev = t;
+		header.minTimestamp = min(header.minTimestamp, t);
+		header.maxTimestamp = max(header.maxTimestamp, t);
+	}
+
+	//Severities: runs
+	for(size_t i=0; i<m_severities.size(); )
+	{
+		size_t run = 1;
+		while( (i + run < m_severities.size()) && (m_severities[i + run] == m_severities[i]) )
+			run ++;
+		columns[1] += static_cast<char>(m_severities[i]);
+		PutVarint(columns[1], run);
+		i += run;
+	}
+
+	m_classes.Encode(columns[2]);
+	m_functions.Encode(columns[3]);
+
+	//Text: lengths, then the compressed text
+	for(auto len : m_textLengths)
+		PutVarint(columns[4], len);
+	PutVarint(columns[4], m_text.length());
+	Compress(m_text.data(), m_text.length(), columns[4]);
+
+	for(int i=0; i<LOG_COLUMN_COUNT; i++)
+		header.columnSize[i] = columns[i].length();
+	char raw[g_segmentHeaderSize];
+	EncodeSegmentHeader(header, raw);
+	fwrite(raw, sizeof(raw), 1, m_file);
+	for(auto& c : columns)
+		fwrite(c.data(), 1, c.length(), m_file);
+	fflush(m_file);
+
+	m_timestamps.clear();
+	m_severities.clear();
+	m_classes.Clear();
+	m_functions.Clear();
+	m_textLengths.clear();
+	m_text.clear();
+}
+
+void LogColumnWriter::Dictionary::Add(string_view name)
+{
+	uint32_t id = LogInternString(name);
+	if(id == 0)
+	{
+		ids.push_back(0);
+		return;
+	}
+
+	if(id >= indexes.size())
+		indexes.resize(id + 1, 0);
+	if(indexes[id] == 0)
+	{
+		names.push_back(id);
+		indexes[id] = names.size();
+	}
+	ids.push_back(indexes[id]);
+}
+
+/**
+	@brief Writes the names, then each record's index
+ */
+void LogColumnWriter::Dictionary::Encode(string& out)
+{
+	PutVarint(out, names.size());
+	for(auto id : names)
+	{
+		auto n = LogGetInternedString(id);
+		PutVarint(out, n.length());
+		out.append(n.data(), n.length());
+	}
+	for(auto id : ids)
+		PutVarint(out, id);
+}
+
+void LogColumnWriter::Dictionary::Clear()
+{
+	for(auto id : names)
+		indexes[id] = 0;
+	names.clear();
+	ids.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// LogColumnReader
+
+/**
+	@brief Opens a columnar log file for reading
+ */
+LogColumnReader::LogColumnReader(const string& path)
+	: m_file(fopen(path.c_str(), "rb"))
+	, m_after(0)
+	, m_before(UINT64_MAX)
+{
+	if(!m_file)
+		return;
+
+	char header[g_fileHeaderSize];
+	const char* p = header + 8;
+	if( (fread(header, sizeof(header), 1, m_file) != 1) ||
+		(memcmp(header, LOG_COLUMN_FILE_MAGIC, sizeof(LOG_COLUMN_FILE_MAGIC)) != 0) ||
+		(GetLE(p, 4) != LOG_COLUMN_FILE_VERSION) )
+	{
+		fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+LogColumnReader::~LogColumnReader()
+{
+	if(m_file)
+		fclose(m_file);
+}
+
+/**
+	@brief Skips segments with no records in [after, before)
+
+	Segments that overlap the range are returned whole, so records still need to be checked individually.
+ */
+void LogColumnReader::SetTimeRange(uint64_t after, uint64_t before)
+{
+	m_after = after;
+	m_before = before;
+}
+
+/**
+	@brief Goes back to the first segment
+ */
+void LogColumnReader::Rewind()
+{
+	if(m_file)
+		fseeko(m_file, g_fileHeaderSize, SEEK_SET);
+}
+
+bool LogColumnReader::Skip(uint64_t bytes)
+{
+	return fseeko(m_file, bytes, SEEK_CUR) == 0;
+}
+
+/**
+	@brief Returns the number of bytes between the current position and the end of the file
+
+	Looked up for every segment rather than once, since the file may still be growing.
+ */
+uint64_t LogColumnReader::Remaining()
+{
+	auto pos = ftello(m_file);
+	if( (pos < 0) || (fseeko(m_file, 0, SEEK_END) != 0) )
+		return 0;
+	auto size = ftello(m_file);
+	if(fseeko(m_file, pos, SEEK_SET) != 0)
+		return 0;
+	return (size > pos) ? size - pos : 0;
+}
+
+/**
+	@brief Reads the next segment in the time range
+
+	@param seg		Segment to decode into
+	@param columns	Bitmask of LogColumn values to decode
+
+	@return False at the end of the file, or if the segment is corrupt or was cut short
+
+	Sizes in the header are checked against what's left of the file before anything is allocated for them, so a
+	corrupt file fails here rather than throwing bad_alloc.
+ */
+bool LogColumnReader::Next(Segment& seg, unsigned int columns)
+{
+	if(!m_file)
+		return false;
+
+	LogColumnSegmentHeader header;
+	while(true)
+	{
+		char raw[g_segmentHeaderSize];
+		if(fread(raw, sizeof(raw), 1, m_file) != 1)
+			return false;
+		DecodeSegmentHeader(raw, header);
+		if(header.magic != LOG_COLUMN_SEGMENT_MAGIC)
+			return false;
+
+		uint64_t remaining = Remaining();
+		uint64_t total = 0;
+		for(auto size : header.columnSize)
+		{
+			if(size > remaining - total)
+				return false;
+			total += size;
+		}
+
+		//Every record has at least one byte in the timestamp and text columns
+		if( (header.count > header.columnSize[0]) || (header.count > header.columnSize[4]) )
+			return false;
+
+		if( (header.maxTimestamp >= m_after) && (header.minTimestamp < m_before) )
+			break;
+		if(!Skip(total))
+			return false;
+	}
+
+	size_t count = header.count;
+	seg.count = count;
+	seg.minTimestamp = header.minTimestamp;
+	seg.maxTimestamp = header.maxTimestamp;
+	seg.timestamps.clear();
+	seg.severities.clear();
+	seg.classIds.clear();
+	seg.classNames.clear();
+	seg.functionIds.clear();
+	seg.functionNames.clear();
+	seg.texts.clear();
+	seg.textData.clear();
+
+	for(int col=0; col<LOG_COLUMN_COUNT; col++)
+	{
+		if(!(columns & (1 << col)))
+		{
+			if(!Skip(header.columnSize[col]))
+				return false;
+			continue;
+		}
+
+		m_buffer.resize(header.columnSize[col]);
+		if(!m_buffer.empty() && (fread(&m_buffer[0], 1, m_buffer.size(), m_file) != m_buffer.size()) )
+			return false;
+		const char* p = m_buffer.data();
+		const char* end = p + m_buffer.size();
+		uint64_t v;
+
+		switch(1 << col)
+		{
+			case LOG_COLUMN_TIMESTAMP:
+				{
+					seg.timestamps.reserve(count);
+					uint64_t t = header.firstTimestamp;
+					for(size_t i=0; i<count; i++)
+					{
+						if(!GetVarint(p, end, v))
+							return false;
+						t += (v >> 1) ^ (~(v & 1) + 1);
+						seg.timestamps.push_back(t);
+					}
+				}
+				break;
+
+			case LOG_COLUMN_SEVERITY:
+				seg.severities.reserve(count);
+				while(seg.severities.size() < count)
+				{
+					if(p >= end)
+						return false;
+					auto sev = static_cast<Severity>(*p++);
+					if(!GetVarint(p, end, v) || (v > count - seg.severities.size()) )
+						return false;
+					seg.severities.insert(seg.severities.end(), v, sev);
+				}
+				break;
+
+			case LOG_COLUMN_CLASS:
+			case LOG_COLUMN_FUNCTION:
+				{
+					auto& names = (col == 2) ? seg.classNames : seg.functionNames;
+					auto& ids = (col == 2) ? seg.classIds : seg.functionIds;
+					uint64_t nnames;
+					if(!GetVarint(p, end, nnames))
+						return false;
+					for(uint64_t i=0; i<nnames; i++)
+					{
+						if(!GetVarint(p, end, v) || (v > static_cast<uint64_t>(end - p)) )
+							return false;
+						names.emplace_back(p, v);
+						p += v;
+					}
+					ids.reserve(count);
+					for(size_t i=0; i<count; i++)
+					{
+						if(!GetVarint(p, end, v) || (v > nnames) )
+							return false;
+						ids.push_back(v);
+					}
+				}
+				break;
+
+			case LOG_COLUMN_TEXT:
+				{
+					vector<uint64_t> lengths(count);
+					uint64_t sum = 0;
+					for(size_t i=0; i<count; i++)
+					{
+						if(!GetVarint(p, end, lengths[i]))
+							return false;
+						sum += lengths[i];
+					}
+					//Compressed text expands by at most 255 times, so a bigger size is corrupt and mustn't be allocated
+					if(!GetVarint(p, end, v) || (v != sum) || (v / 255 > static_cast<uint64_t>(end - p)) ||
+						!Decompress(p, end, v, seg.textData))
+					{
+						return false;
+					}
+
+					seg.texts.reserve(count);
+					const char* text = seg.textData.data();
+					for(auto len : lengths)
+					{
+						seg.texts.emplace_back(text, len);
+						text += len;
+					}
+				}
+				break;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,243 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+#ifndef LogColumnStore_h
+#define LogColumnStore_h
+
+/**
+	@file
+	@brief		Layout of columnar log files, and a writer and scanner for them
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include <cstdint>
+#include <string_view>
+
+/**
+	@brief Columns stored in a columnar log file, in the order they're stored in each segment
+
+	The values double as bit masks to pass to LogColumnReader::Next().
+ */
+enum LogColumn
+{
+	///@brief Timestamp in ns since the Unix epoch, as zigzag varint deltas from the previous record
+	LOG_COLUMN_TIMESTAMP	= 0x01,
+
+	///@brief Severity, as runs of (value, varint run length)
+	LOG_COLUMN_SEVERITY		= 0x02,
+
+	///@brief Class of the LogTrace() call site, as a dictionary of names then a varint index per record
+	LOG_COLUMN_CLASS		= 0x04,
+
+	///@brief "Class::function" of the LogTrace() call site, encoded the same way as the class
+	LOG_COLUMN_FUNCTION		= 0x08,
+
+	///@brief Message text, as a varint length per record then the LZ compressed text of all records
+	LOG_COLUMN_TEXT			= 0x10,
+
+	LOG_COLUMN_ALL			= 0x1f
+};
+
+#define LOG_COLUMN_COUNT 5
+
+#define LOG_COLUMN_FILE_MAGIC "LOGCOLS"
+#define LOG_COLUMN_FILE_VERSION 1
+#define LOG_COLUMN_SEGMENT_MAGIC 0x4d474553
+
+/**
+	@brief		Header at the start of a columnar log file
+	@ingroup	liblog
+ */
+struct LogColumnFileHeader
+{
+	///@brief LOG_COLUMN_FILE_MAGIC, NUL padded
+	char		magic[8];
+
+	///@brief LOG_COLUMN_FILE_VERSION
+	uint32_t	version;
+
+	uint32_t	reserved;
+};
+
+/**
+	@brief		Header at the start of each segment of a columnar log file
+	@ingroup	liblog
+
+	The columns follow the header back to back, in the order of the LogColumn values. Every segment carries its own
+	dictionaries, so segments can be decoded independently and a file that was cut short is readable up to the last
+	complete segment.
+
+	On disk, this and LogColumnFileHeader are written field by field in the order declared, little endian with no
+	padding, whatever the host's byte order.
+ */
+struct LogColumnSegmentHeader
+{
+	///@brief LOG_COLUMN_SEGMENT_MAGIC
+	uint32_t	magic;
+
+	///@brief Number of records in the segment
+	uint32_t	count;
+
+	///@brief Timestamp of the first record, which the deltas start from
+	uint64_t	firstTimestamp;
+
+	///@brief Earliest and latest timestamps in the segment, for skipping segments outside a time range
+	uint64_t	minTimestamp;
+	uint64_t	maxTimestamp;
+
+	///@brief Size of each column in bytes
+	uint64_t	columnSize[LOG_COLUMN_COUNT];
+};
+
+/**
+	@brief		Writes records to a columnar log file
+	@ingroup	liblog
+
+	Records are collected in memory and written out as one segment once there are enough of them, or on Flush().
+ */
+class LogColumnWriter
+{
+public:
+	LogColumnWriter(const std::string& path, size_t segmentSize = 65536);
+	~LogColumnWriter();
+
+	LogColumnWriter(const LogColumnWriter&) = delete;
+	LogColumnWriter& operator=(const LogColumnWriter&) = delete;
+
+	///@brief True if the file was opened successfully
+	bool IsOpen()
+	{ return m_file != nullptr; }
+
+	void Append(uint64_t timestamp, Severity severity, std::string_view function, std::string_view text);
+	void Flush();
+
+protected:
+	/**
+		@brief Names seen in the current segment, and the index of each record's name
+
+		Names are looked up by their interned string ID, so only the first occurrence of each is hashed as a string.
+	 */
+	struct Dictionary
+	{
+		///@brief 1 + the index into names, by interned string ID, or 0 if not seen yet in this segment
+		std::vector<uint32_t> indexes;
+
+		///@brief Interned string ID of each name, in order of first appearance
+		std::vector<uint32_t> names;
+
+		///@brief 0 for no name, otherwise 1 + the index into names
+		std::vector<uint32_t> ids;
+
+		void Add(std::string_view name);
+		void Encode(std::string& out);
+		void Clear();
+	};
+
+	FILE* m_file;
+	size_t m_segmentSize;
+
+	std::vector<uint64_t> m_timestamps;
+	std::vector<Severity> m_severities;
+	Dictionary m_classes;
+	Dictionary m_functions;
+	std::vector<uint32_t> m_textLengths;
+	std::string m_text;
+};
+
+/**
+	@brief		Reads a columnar log file a segment at a time, decoding only the columns asked for
+	@ingroup	liblog
+
+	Columns that weren't asked for are skipped over without being read, and segments outside the time range set by
+	SetTimeRange() are skipped entirely.
+ */
+class LogColumnReader
+{
+public:
+	LogColumnReader(const std::string& path);
+	~LogColumnReader();
+
+	LogColumnReader(const LogColumnReader&) = delete;
+	LogColumnReader& operator=(const LogColumnReader&) = delete;
+
+	///@brief True if the file was opened and has a valid header
+	bool IsOpen()
+	{ return m_file != nullptr; }
+
+	/**
+		@brief One decoded segment. Only the vectors for the columns asked for are filled in.
+	 */
+	struct Segment
+	{
+		size_t count;
+		uint64_t minTimestamp;
+		uint64_t maxTimestamp;
+
+		std::vector<uint64_t> timestamps;
+		std::vector<Severity> severities;
+
+		///@brief Index of each record's class, 0 for none or 1 + the index into classNames
+		std::vector<uint32_t> classIds;
+		std::vector<std::string> classNames;
+
+		///@brief Index of each record's function, 0 for none or 1 + the index into functionNames
+		std::vector<uint32_t> functionIds;
+		std::vector<std::string> functionNames;
+
+		///@brief Text of each record, pointing into textData
+		std::vector<std::string_view> texts;
+		std::string textData;
+
+		///@brief Class name of a record, or empty if it wasn't from LogTrace()
+		std::string_view GetClass(size_t i) const
+		{ return classIds[i] ? std::string_view(classNames[classIds[i] - 1]) : std::string_view(); }
+
+		///@brief Function name of a record, or empty if it wasn't from LogTrace()
+		std::string_view GetFunction(size_t i) const
+		{ return functionIds[i] ? std::string_view(functionNames[functionIds[i] - 1]) : std::string_view(); }
+	};
+
+	void SetTimeRange(uint64_t after, uint64_t before);
+	bool Next(Segment& seg, unsigned int columns = LOG_COLUMN_ALL);
+	void Rewind();
+
+protected:
+	bool Skip(uint64_t bytes);
+	uint64_t Remaining();
+
+	FILE* m_file;
+	uint64_t m_after;
+	uint64_t m_before;
+
+	///@brief Raw bytes of the column being decoded
+	std::string m_buffer;
+};
+
+#endif
@@ -0,0 +1,143 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of the logging memory budget
+	@ingroup	liblog
+ */
+
+#include "log.h"
+
+using namespace std;
+
+///@brief Budget set by LogSetMemoryBudget(), or 0 for unlimited
+static atomic<size_t> g_logMemoryBudget(0);
+
+///@brief Bytes charged in total and per pool. Signed, since a release can briefly overtake its charge.
+static atomic<ptrdiff_t> g_logMemoryUsed(0);
+static atomic<ptrdiff_t> g_logMemoryPools[LOG_MEMORY_POOL_COUNT];
+
+static atomic<size_t> g_logMemoryPeak(0);
+static atomic<uint64_t> g_logMemoryShed(0);
+static atomic<uint64_t> g_logMemoryTrimmed(0);
+
+/**
+	@brief Sets one budget shared by all logging buffers, in bytes, or 0 (the default) for no limit
+
+	Buffers charge what they hold to the budget and shed load as it fills up:
+
+	* At 75%, DEBUG messages are dropped rather than buffered
+	* At 90%, VERBOSE messages are dropped too, and SubscriberLogSink retention shrinks to its newest segments
+	* At 100%, NOTICE messages are dropped too
+
+	Warnings and errors are always kept, so the budget may be exceeded by them. Buffers that are written straight
+	to a file or shared memory aren't charged, since they don't grow.
+ */
+void LogSetMemoryBudget(size_t bytes)
+{
+	g_logMemoryBudget = bytes;
+}
+
+/**
+	@brief Returns the current budget and usage
+ */
+LogMemoryStats LogGetMemoryStats()
+{
+	LogMemoryStats stats;
+	stats.budget = g_logMemoryBudget;
+	stats.used = max(g_logMemoryUsed.load(), static_cast<ptrdiff_t>(0));
+	for(int i=0; i<LOG_MEMORY_POOL_COUNT; i++)
+		stats.pools[i] = max(g_logMemoryPools[i].load(), static_cast<ptrdiff_t>(0));
+	stats.peak = g_logMemoryPeak;
+	stats.shed = g_logMemoryShed;
+	stats.trimmed = g_logMemoryTrimmed;
+	return stats;
+}
+
+/**
+	@brief Adds (or with a negative size, removes) memory held by a logging buffer
+
+	Callers should charge in big steps (e.g. when a buffer's capacity changes) rather than per message, since every
+	charge updates shared counters.
+ */
+void LogMemoryCharge(LogMemoryPool pool, ptrdiff_t bytes)
+{
+	g_logMemoryPools[pool].fetch_add(bytes, memory_order_relaxed);
+	ptrdiff_t used = g_logMemoryUsed.fetch_add(bytes, memory_order_relaxed) + bytes;
+	if(bytes <= 0)
+		return;
+
+	size_t peak = g_logMemoryPeak.load(memory_order_relaxed);
+	while( (static_cast<size_t>(used) > peak) && !g_logMemoryPeak.compare_exchange_weak(peak, used) )
+	{}
+}
+
+/**
+	@brief Checks if a message should be dropped instead of buffered to stay within the budget, counting it if so
+
+	@param severity	Severity of the message
+ */
+bool LogMemoryShed(Severity severity)
+{
+	size_t budget = g_logMemoryBudget.load(memory_order_relaxed);
+	if( (budget == 0) || (severity <= Severity::WARNING) )
+		return false;
+
+	size_t limit = budget;
+	if(severity == Severity::VERBOSE)
+		limit = budget / 10 * 9;
+	else if(severity == Severity::DEBUG)
+		limit = budget / 4 * 3;
+
+	if(g_logMemoryUsed.load(memory_order_relaxed) < static_cast<ptrdiff_t>(limit))
+		return false;
+
+	g_logMemoryShed.fetch_add(1, memory_order_relaxed);
+	return true;
+}
+
+/**
+	@brief Checks if buffers that keep history, like SubscriberLogSink, should give some of it up
+ */
+bool LogMemoryShouldShrink()
+{
+	size_t budget = g_logMemoryBudget.load(memory_order_relaxed);
+	if(budget == 0)
+		return false;
+	return g_logMemoryUsed.load(memory_order_relaxed) >= static_cast<ptrdiff_t>(budget / 10 * 9);
+}
+
+/**
+	@brief Counts records discarded by a buffer shrinking under LogMemoryShouldShrink()
+ */
+void LogMemoryCountTrimmed(uint64_t records)
+{
+	g_logMemoryTrimmed.fetch_add(records, memory_order_relaxed);
+}
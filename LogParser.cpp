@@ -0,0 +1,329 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of LogTextParser
+	@ingroup	liblog
+ */
+
+#include "LogParser.h"
+#include "LogSearch.h"
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+using namespace std;
+
+static inline bool IsDigit(char c)
+	{ return static_cast<unsigned char>(c - '0') < 10; }
+
+/**
+	@brief Parses a decimal number at p, returning the position after it (or nullptr if there are no digits)
+ */
+static const char* ParseNumber(const char* p, const char* end, uint64_t& value)
+{
+	const char* start = p;
+	value = 0;
+	while( (p < end) && IsDigit(*p) )
+	{
+		value = value*10 + (*p - '0');
+		p ++;
+	}
+	return (p == start) ? nullptr : p;
+}
+
+/**
+	@brief Parses a "[pid] " prefix, returning its length (0 if there isn't one)
+ */
+static size_t ParsePidPrefix(const char* p, const char* end, unsigned int& pid)
+{
+	if( (p >= end) || (*p != '[') )
+		return 0;
+	uint64_t value;
+	const char* q = ParseNumber(p + 1, end, value);
+	if(!q || (q + 1 >= end) || (q[0] != ']') || (q[1] != ' ') )
+		return 0;
+	pid = static_cast<unsigned int>(value);
+	return q + 2 - p;
+}
+
+/**
+	@brief Creates a parser
+
+	@param indentSize	Spaces per indentation level, as used by the sink that wrote the log
+	@param wrapWidth	Width the sink wrapped lines at, or 0 to never join lines. The default matches FILELogSink.
+ */
+LogTextParser::LogTextParser(unsigned int indentSize, unsigned int wrapWidth)
+	: m_indentSize(indentSize ? indentSize : 1)
+	, m_wrapWidth(wrapWidth)
+	, m_pos(0)
+	, m_lineNumber(0)
+	, m_minuteBase(0)
+{
+	memset(m_minuteKey, 0, sizeof(m_minuteKey));
+}
+
+/**
+	@brief Starts parsing a new buffer, which must stay valid while records from it are in use
+ */
+void LogTextParser::SetInput(string_view data)
+{
+	m_input = data;
+	m_pos = 0;
+	m_lineNumber = 0;
+}
+
+/**
+	@brief Parses the next record from the input
+
+	@return False at the end of the input
+ */
+bool LogTextParser::Next(Record& rec)
+{
+	const char* base = m_input.data();
+	const char* end = base + m_input.size();
+	if(m_pos >= m_input.size())
+		return false;
+
+	const char* p = base + m_pos;
+	const char* nl = LogFindNewline(p, end);
+	m_pos = min(m_input.size(), static_cast<size_t>(nl - base) + 1);
+	size_t wrapLen = Parse(string_view(p, nl - p), rec);
+	rec.lineNumber = ++m_lineNumber;
+	rec.lineCount = 1;
+
+	//A line exactly as wide as the wrap width was split by WrapString(), the next one carries on with the message
+	bool joined = false;
+	while( (m_wrapWidth != 0) && (wrapLen == m_wrapWidth) && (m_pos < m_input.size()) )
+	{
+		p = base + m_pos;
+		nl = LogFindNewline(p, end);
+		m_pos = min(m_input.size(), static_cast<size_t>(nl - base) + 1);
+		m_lineNumber ++;
+		rec.lineCount ++;
+
+		//Continuation lines have the same prefixes as the first, then the indentation
+		uint64_t ns;
+		unsigned int pid;
+		if(rec.hasTimestamp && !rec.hasSequence)
+			p += ParseTimePrefix(p, nl, ns);
+		if(rec.pid)
+			p += ParsePidPrefix(p, nl, pid);
+		wrapLen = nl - p;
+		for(size_t i=0; (i < rec.indent * m_indentSize) && (p < nl) && (*p == ' '); i++)
+			p ++;
+
+		if(!joined)
+		{
+			m_joined.assign(rec.text.data(), rec.text.size());
+			joined = true;
+		}
+		m_joined.append(p, nl - p);
+	}
+	if(joined)
+		rec.text = m_joined;
+
+	return true;
+}
+
+/**
+	@brief Parses a single line on its own, without looking for wrapped continuation lines
+ */
+void LogTextParser::ParseLine(string_view line, Record& rec)
+{
+	Parse(line, rec);
+	rec.lineNumber = 0;
+	rec.lineCount = 1;
+}
+
+/**
+	@brief Parses one line into a record
+
+	@return Length of the line as WrapString() saw it, to compare against the wrap width
+ */
+size_t LogTextParser::Parse(string_view line, Record& rec)
+{
+	const char* p = line.data();
+	const char* end = p + line.size();
+
+	rec.severity = Severity::NOTICE;
+	rec.indent = 0;
+	rec.function = string_view();
+	rec.className = string_view();
+	rec.line = line;
+	rec.timestamp = 0;
+	rec.sequence = 0;
+	rec.pid = 0;
+	rec.hasTimestamp = false;
+	rec.hasSequence = false;
+	bool knownSeverity = false;
+
+	//ShardedFileLogSink record: sequence, timestamp, severity, text
+	if( (p < end) && IsDigit(*p) )
+	{
+		uint64_t seq;
+		uint64_t ns;
+		uint64_t sev;
+		const char* q = ParseNumber(p, end, seq);
+		if(q && (q < end) && (*q == '\t') )
+			q = ParseNumber(q + 1, end, ns);
+		else
+			q = nullptr;
+		if(q && (q < end) && (*q == '\t') )
+			q = ParseNumber(q + 1, end, sev);
+		else
+			q = nullptr;
+		if(q && (q < end) && (*q == '\t') )
+		{
+			rec.sequence = seq;
+			rec.timestamp = ns;
+			rec.severity = static_cast<Severity>(sev);
+			rec.hasSequence = true;
+			rec.hasTimestamp = true;
+			knownSeverity = true;
+			p = q + 1;
+		}
+
+		//logtools-collect -t prefix, optionally followed by a -p one
+		else
+		{
+			size_t len = ParseTimePrefix(p, end, rec.timestamp);
+			if(len)
+			{
+				rec.hasTimestamp = true;
+				p += len;
+				p += ParsePidPrefix(p, end, rec.pid);
+			}
+		}
+	}
+
+	//logtools-collect -p prefix on its own
+	else
+		p += ParsePidPrefix(p, end, rec.pid);
+
+	size_t wrapLen = end - p;
+
+	//Trace lines start with [Class::function]
+	if( (p < end) && (*p == '[') )
+	{
+		auto close = static_cast<const char*>(memchr(p, ']', end - p));
+		if(close && (close + 1 < end) && (close[1] == ' ') )
+		{
+			for(const char* q = close - 2; q > p; q--)
+			{
+				if( (q[0] == ':') && (q[1] == ':') )
+				{
+					rec.function = string_view(p + 1, close - p - 1);
+					rec.className = string_view(p + 1, q - p - 1);
+					if(!knownSeverity)
+						rec.severity = Severity::DEBUG;
+					knownSeverity = true;
+					wrapLen -= close + 2 - p;
+					p = close + 2;
+					break;
+				}
+			}
+		}
+	}
+
+	//Indentation, then maybe a severity prefix
+	const char* q = p;
+	while( (q < end) && (*q == ' ') )
+		q ++;
+	size_t spaces = q - p;
+	rec.indent = spaces / m_indentSize;
+	p += rec.indent * m_indentSize;
+
+	size_t left = end - q;
+	if( (left >= 16) && !memcmp(q, "INTERNAL ERROR: ", 16) )
+	{
+		if(!knownSeverity)
+			rec.severity = Severity::FATAL;
+		p = q + 16;
+	}
+	else if( (left >= 7) && !memcmp(q, "ERROR: ", 7) )
+	{
+		if(!knownSeverity)
+			rec.severity = Severity::ERROR;
+		p = q + 7;
+	}
+	else if( (left >= 9) && !memcmp(q, "Warning: ", 9) )
+	{
+		if(!knownSeverity)
+			rec.severity = Severity::WARNING;
+		p = q + 9;
+	}
+
+	rec.text = string_view(p, end - p);
+	return wrapLen;
+}
+
+/**
+	@brief Parses a "YYYY-MM-DD HH:MM:SS.uuuuuu " prefix in local time, returning its length (0 if there isn't one)
+ */
+size_t LogTextParser::ParseTimePrefix(const char* p, const char* end, uint64_t& ns)
+{
+	static const char pattern[] = "dddd-dd-dd dd:dd:dd.dddddd ";
+	size_t len = sizeof(pattern) - 1;
+	if(static_cast<size_t>(end - p) < len)
+		return 0;
+
+	//Usually the same minute as the last line, so only the seconds need checking
+	size_t start = 16;
+	bool sameMinute = (memcmp(m_minuteKey, p, 16) == 0);
+	if(!sameMinute)
+		start = 0;
+	for(size_t i=start; i<len; i++)
+	{
+		if(pattern[i] == 'd' ? !IsDigit(p[i]) : (p[i] != pattern[i]))
+			return 0;
+	}
+
+	if(!sameMinute)
+	{
+		struct tm t;
+		memset(&t, 0, sizeof(t));
+		t.tm_year = atoi(p) - 1900;
+		t.tm_mon = atoi(p + 5) - 1;
+		t.tm_mday = atoi(p + 8);
+		t.tm_hour = atoi(p + 11);
+		t.tm_min = atoi(p + 14);
+		t.tm_isdst = -1;
+		m_minuteBase = static_cast<uint64_t>(mktime(&t)) * 1000000000ULL;
+		memcpy(m_minuteKey, p, 16);
+	}
+
+	uint64_t sec;
+	uint64_t usec;
+	ParseNumber(p + 17, p + 19, sec);
+	ParseNumber(p + 20, p + 26, usec);
+	ns = m_minuteBase + sec * 1000000000ULL + usec * 1000ULL;
+	return len;
+}
@@ -0,0 +1,133 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+#ifndef LogParser_h
+#define LogParser_h
+
+/**
+	@file
+	@brief		Declaration of LogTextParser
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include <cstdint>
+#include <string_view>
+
+/**
+	@brief		Turns logtools text output back into records
+	@ingroup	liblog
+
+	Understands everything log.cpp and WrapString() put in text logs: indentation, the "INTERNAL ERROR: ", "ERROR: "
+	and "Warning: " prefixes, the "[Class::function]" prefix of LogTrace() output and lines split by wrapping. Also
+	accepts the timestamp and PID prefixes written by logtools-collect and the record fields written by
+	ShardedFileLogSink.
+
+	Severity is guessed from the prefix: trace lines are DEBUG and lines with no prefix are NOTICE, since plain text
+	logs don't record anything more precise. Sharded records carry the real severity.
+
+	Parsing is zero-copy. The views in a Record point into the input, except for the text of a record that was
+	wrapped over several lines, which is joined into a buffer owned by the parser and only valid until the next call
+	to Next().
+ */
+class LogTextParser
+{
+public:
+	LogTextParser(unsigned int indentSize = 4, unsigned int wrapWidth = 120);
+
+	/**
+		@brief One message as parsed from the log
+	 */
+	struct Record
+	{
+		///@brief Severity, from the sharded record or guessed from the prefix
+		Severity severity;
+
+		///@brief Indentation level (leading spaces divided by the indent size)
+		unsigned int indent;
+
+		///@brief "Class::function" for LogTrace() output, otherwise empty
+		std::string_view function;
+
+		///@brief Class part of the function name, otherwise empty
+		std::string_view className;
+
+		///@brief Message text with indentation and prefixes removed and wrapped lines joined
+		std::string_view text;
+
+		///@brief First line of the record as it appears in the log, without the newline
+		std::string_view line;
+
+		///@brief Timestamp in nanoseconds since the Unix epoch, if hasTimestamp is set
+		uint64_t timestamp;
+
+		///@brief Sequence number of a sharded record, if hasSequence is set
+		uint64_t sequence;
+
+		///@brief Producer PID from a logtools-collect -p prefix, or 0 if there wasn't one
+		unsigned int pid;
+
+		bool hasTimestamp;
+		bool hasSequence;
+
+		///@brief Line number of the first line of the record, starting from 1
+		size_t lineNumber;
+
+		///@brief Number of lines in the log the record was parsed from
+		size_t lineCount;
+	};
+
+	void SetInput(std::string_view data);
+	bool Next(Record& rec);
+	void ParseLine(std::string_view line, Record& rec);
+
+	///@brief Number of bytes of the input consumed so far
+	size_t GetOffset()
+	{ return m_pos; }
+
+protected:
+	size_t Parse(std::string_view line, Record& rec);
+	size_t ParseTimePrefix(const char* p, const char* end, uint64_t& ns);
+
+	unsigned int m_indentSize;
+	unsigned int m_wrapWidth;
+
+	std::string_view m_input;
+	size_t m_pos;
+	size_t m_lineNumber;
+
+	///@brief Text of the last record that was joined from wrapped lines
+	std::string m_joined;
+
+	///@brief Last "YYYY-MM-DD HH:MM" seen and its time, so mktime() runs once a minute rather than once a line
+	char m_minuteKey[16];
+	uint64_t m_minuteBase;
+};
+
+#endif
@@ -0,0 +1,111 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+#ifndef LogSearch_h
+#define LogSearch_h
+
+/**
+	@file
+	@brief		SIMD helpers for scanning log text, shared by IndexedLogSink and the query tools
+	@ingroup	liblog
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+	@brief Finds the first occurrence of a needle (at least one byte long) in [p, end)
+
+	With SSE2, 16 candidate positions are tested at once by comparing the first and last bytes of the needle, and
+	only positions where both match are checked in full.
+ */
+inline const char* LogFindSubstring(const char* p, const char* end, const std::string& needle)
+{
+	size_t m = needle.length();
+	if(static_cast<size_t>(end - p) < m)
+		return nullptr;
+	const char* last = end - m;
+
+#ifdef __SSE2__
+	if(m > 1)
+	{
+		__m128i first = _mm_set1_epi8(needle[0]);
+		__m128i final = _mm_set1_epi8(needle[m-1]);
+		for(; p + 15 <= last; p += 16)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + m - 1));
+			unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+			while(mask)
+			{
+				int bit = __builtin_ctz(mask);
+				if(memcmp(p + bit + 1, needle.data() + 1, m - 2) == 0)
+					return p + bit;
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+
+	while(p <= last)
+	{
+		p = static_cast<const char*>(memchr(p, needle[0], last - p + 1));
+		if(!p)
+			return nullptr;
+		if(memcmp(p, needle.data(), m) == 0)
+			return p;
+		p ++;
+	}
+	return nullptr;
+}
+
+/**
+	@brief Finds the next newline in [p, end), or returns end if there isn't one
+ */
+inline const char* LogFindNewline(const char* p, const char* end)
+{
+#ifdef __SSE2__
+	__m128i nl = _mm_set1_epi8('\n');
+	for(; p + 16 <= end; p += 16)
+	{
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), nl));
+		if(mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+
+	auto nl2 = static_cast<const char*>(memchr(p, '\n', end - p));
+	return nl2 ? nl2 : end;
+}
+
+#endif
@@ -0,0 +1,134 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Socket helpers shared by the network log sinks
+	@ingroup	liblog
+ */
+
+#include "LogSocket.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+//Where there's no MSG_NOSIGNAL (e.g. macOS), LogConnectTCP() sets SO_NOSIGPIPE on the socket instead
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+	@brief Connects to a TCP server, giving up after a timeout
+
+	The returned socket is blocking, with send and receive timeouts of timeoutMs so a stalled peer can't hang the
+	caller forever.
+
+	@return The connected socket, or -1 on failure
+ */
+int LogConnectTCP(const string& host, uint16_t port, int timeoutMs)
+{
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo* res = nullptr;
+	if(getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &res) != 0)
+		return -1;
+
+	int sock = -1;
+	for(auto ai = res; ai && (sock < 0); ai = ai->ai_next)
+	{
+		//Not SOCK_CLOEXEC, which is Linux only
+		int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(s < 0)
+			continue;
+		fcntl(s, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+		int yes = 1;
+		setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+
+		//Connect without blocking so we can time out
+		int flags = fcntl(s, F_GETFL);
+		fcntl(s, F_SETFL, flags | O_NONBLOCK);
+		int ret = connect(s, ai->ai_addr, ai->ai_addrlen);
+		if( (ret != 0) && (errno == EINPROGRESS) )
+		{
+			pollfd pfd = { s, POLLOUT, 0 };
+			int err = ETIMEDOUT;
+			socklen_t errlen = sizeof(err);
+			if(poll(&pfd, 1, timeoutMs) == 1)
+				getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &errlen);
+			ret = err ? -1 : 0;
+		}
+		if(ret != 0)
+		{
+			close(s);
+			continue;
+		}
+
+		fcntl(s, F_SETFL, flags);
+		timeval tv;
+		tv.tv_sec = timeoutMs / 1000;
+		tv.tv_usec = (timeoutMs % 1000) * 1000;
+		setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		sock = s;
+	}
+
+	freeaddrinfo(res);
+	return sock;
+}
+
+/**
+	@brief Sends a whole buffer, returning false if the connection failed
+ */
+bool LogSendAll(int sock, const char* data, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
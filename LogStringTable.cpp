@@ -0,0 +1,290 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of the interned string table
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include <cstring>
+
+using namespace std;
+
+/**
+	@brief An interned string. The text is never freed or moved.
+ */
+struct LogInternEntry
+{
+	const char*	str;
+	uint32_t	len;
+	uint32_t	hash;
+};
+
+/**
+	@brief Open-addressed hash table of IDs, replaced by a bigger one as it fills
+
+	Old tables are never freed, since a reader may still be probing one. They add up to less than the final table.
+ */
+struct LogInternTable
+{
+	size_t mask;
+	atomic<uint32_t>* slots;
+};
+
+/**
+	@brief Entries are stored in fixed-size chunks, allocated as needed and never moved
+ */
+static const size_t g_internChunkBits = 10;
+static const size_t g_internChunkSize = 1 << g_internChunkBits;
+static const size_t g_internMaxChunks = 4096;
+
+static atomic<LogInternEntry*> g_internChunks[g_internMaxChunks];
+
+/**
+	@brief Number of IDs handed out, including 0 for the empty string
+
+	Stored after the entry is filled in, so a reader that sees an ID below this also sees its entry.
+ */
+static atomic<uint32_t> g_internCount(1);
+
+static atomic<LogInternTable*> g_internTable(nullptr);
+
+/**
+	@brief Serializes adding strings. Lookups don't take it.
+ */
+static mutex g_internMutex;
+
+/**
+	@brief Block the text of new strings is copied into
+ */
+static char* g_internArena = nullptr;
+static size_t g_internArenaLeft = 0;
+
+/**
+	@brief Hashes a string 8 bytes at a time
+ */
+static uint32_t InternHash(string_view str)
+{
+	const char* p = str.data();
+	size_t len = str.length();
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+	for(; len >= 8; p += 8, len -= 8)
+	{
+		uint64_t w;
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	if(len)
+	{
+		uint64_t w = 0;
+		memcpy(&w, p, len);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+	}
+	h ^= h >> 29;
+	return static_cast<uint32_t>(h);
+}
+
+static const LogInternEntry& GetEntry(uint32_t id)
+{
+	return g_internChunks[id >> g_internChunkBits].load(memory_order_acquire)[id & (g_internChunkSize - 1)];
+}
+
+/**
+	@brief Looks a string up in a table
+
+	@param slot		Set to the empty slot the string would go in, if it isn't there
+
+	@return ID of the string, or 0 if it's not in the table
+ */
+static uint32_t Find(const LogInternTable* table, string_view str, uint32_t hash, size_t& slot)
+{
+	for(size_t i = hash & table->mask; ; i = (i + 1) & table->mask)
+	{
+		uint32_t id = table->slots[i].load(memory_order_acquire);
+		if(id == 0)
+		{
+			slot = i;
+			return 0;
+		}
+
+		auto& e = GetEntry(id);
+		if( (e.hash == hash) && (e.len == str.length()) && (memcmp(e.str, str.data(), e.len) == 0) )
+			return id;
+	}
+}
+
+/**
+	@brief Makes a table big enough for count strings at no more than half full, holding IDs 1 to count-1
+
+	Caller must hold g_internMutex.
+ */
+static LogInternTable* BuildTable(uint32_t count)
+{
+	size_t size = 1024;
+	while(size < 2 * static_cast<size_t>(count))
+		size *= 2;
+
+	auto table = new LogInternTable;
+	table->mask = size - 1;
+	table->slots = new atomic<uint32_t>[size];
+	for(size_t i=0; i<size; i++)
+		table->slots[i].store(0, memory_order_relaxed);
+
+	for(uint32_t id=1; id<count; id++)
+	{
+		auto& e = GetEntry(id);
+		size_t i = e.hash & table->mask;
+		while(table->slots[i].load(memory_order_relaxed) != 0)
+			i = (i + 1) & table->mask;
+		table->slots[i].store(id, memory_order_relaxed);
+	}
+	return table;
+}
+
+/**
+	@brief Gets the ID of a string, adding it to the table if it's not there yet
+
+	@return The ID, or 0 for an empty string (or in the unlikely event the table is full)
+ */
+uint32_t LogInternString(string_view str)
+{
+	if(str.empty())
+		return 0;
+
+	//Fast path: already interned
+	uint32_t hash = InternHash(str);
+	size_t slot;
+	auto table = g_internTable.load(memory_order_acquire);
+	if(table)
+	{
+		uint32_t id = Find(table, str, hash, slot);
+		if(id)
+			return id;
+	}
+
+	lock_guard<mutex> lock(g_internMutex);
+
+	//Someone may have added it, or replaced the table, since we looked
+	table = g_internTable.load(memory_order_relaxed);
+	if(table)
+	{
+		uint32_t id = Find(table, str, hash, slot);
+		if(id)
+			return id;
+	}
+
+	uint32_t id = g_internCount.load(memory_order_relaxed);
+	if(id >= g_internMaxChunks * g_internChunkSize)
+		return 0;
+
+	//Copy the text somewhere permanent. Big strings get a block to themselves.
+	char* text;
+	if(str.length() > 4096)
+		text = new char[str.length()];
+	else
+	{
+		if(g_internArenaLeft < str.length())
+		{
+			g_internArena = new char[65536];
+			g_internArenaLeft = 65536;
+		}
+		text = g_internArena;
+		g_internArena += str.length();
+		g_internArenaLeft -= str.length();
+	}
+	memcpy(text, str.data(), str.length());
+
+	auto chunk = g_internChunks[id >> g_internChunkBits].load(memory_order_relaxed);
+	if(!chunk)
+	{
+		chunk = new LogInternEntry[g_internChunkSize];
+		g_internChunks[id >> g_internChunkBits].store(chunk, memory_order_release);
+	}
+	chunk[id & (g_internChunkSize - 1)] = LogInternEntry{text, static_cast<uint32_t>(str.length()), hash};
+
+	//Publish the entry, then make it findable
+	g_internCount.store(id + 1, memory_order_release);
+	if(!table || (2 * static_cast<size_t>(id + 1) > table->mask + 1) )
+		g_internTable.store(BuildTable(id + 1), memory_order_release);
+	else
+		table->slots[slot].store(id, memory_order_release);
+
+	return id;
+}
+
+/**
+	@brief Gets the ID of a string without adding it to the table
+
+	@return The ID, or 0 if the string is empty or hasn't been interned
+ */
+uint32_t LogLookupInternedString(string_view str)
+{
+	if(str.empty())
+		return 0;
+
+	uint32_t hash = InternHash(str);
+	size_t slot;
+	auto table = g_internTable.load(memory_order_acquire);
+	if(table)
+	{
+		uint32_t id = Find(table, str, hash, slot);
+		if(id)
+			return id;
+	}
+
+	//Not found, but it may have been added since we loaded the table
+	lock_guard<mutex> lock(g_internMutex);
+	table = g_internTable.load(memory_order_relaxed);
+	return table ? Find(table, str, hash, slot) : 0;
+}
+
+/**
+	@brief Gets the text of an interned string, which stays valid for the life of the process
+
+	@return The string, or an empty string for ID 0 or an ID that was never handed out
+ */
+string_view LogGetInternedString(uint32_t id)
+{
+	if( (id == 0) || (id >= g_internCount.load(memory_order_acquire)) )
+		return string_view();
+
+	auto& e = GetEntry(id);
+	return string_view(e.str, e.len);
+}
+
+/**
+	@brief Number of IDs handed out so far, including 0 for the empty string
+ */
+size_t LogGetInternedStringCount()
+{
+	return g_internCount.load(memory_order_acquire);
+}
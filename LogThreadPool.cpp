@@ -0,0 +1,180 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of LogThreadPool
+	@ingroup	liblog
+ */
+
+#include "LogThreadPool.h"
+
+using namespace std;
+
+/**
+	@brief Pool the current thread is a worker of, if any
+ */
+static thread_local LogThreadPool* g_logCurrentPool = nullptr;
+
+/**
+	@brief Index of the current thread within g_logCurrentPool
+ */
+static thread_local size_t g_logCurrentWorker = 0;
+
+/**
+	@brief Starts the worker threads
+
+	@param threads	Number of workers, or 0 for one per hardware thread
+ */
+LogThreadPool::LogThreadPool(size_t threads)
+	: m_nextWorker(0)
+	, m_queued(0)
+	, m_pending(0)
+	, m_quit(false)
+{
+	if(threads == 0)
+		threads = max(1u, thread::hardware_concurrency());
+
+	for(size_t i=0; i<threads; i++)
+		m_workers.emplace_back(make_unique<Worker>());
+	for(size_t i=0; i<threads; i++)
+		m_threads.emplace_back(&LogThreadPool::WorkerThreadProc, this, i);
+}
+
+/**
+	@brief Runs every task still queued, then stops the workers
+ */
+LogThreadPool::~LogThreadPool()
+{
+	Wait();
+
+	{
+		lock_guard<mutex> lock(m_idleMutex);
+		m_quit = true;
+	}
+	m_workCond.notify_all();
+
+	for(auto& t : m_threads)
+		t.join();
+}
+
+/**
+	@brief Queues a task, to be run with the caller's current LogContext
+ */
+void LogThreadPool::Submit(function<void()> task)
+{
+	size_t index;
+	if(g_logCurrentPool == this)
+		index = g_logCurrentWorker;
+	else
+		index = m_nextWorker++ % m_workers.size();
+
+	//Count the task before it's visible, so a worker popping it can't take m_queued below zero (it's unsigned, and
+	//would wrap and keep every worker spinning). A worker that sees the count before the push just retries.
+	//Take the idle lock so a worker that just found nothing to do can't miss the wakeup.
+	m_pending ++;
+	{
+		lock_guard<mutex> lock(m_idleMutex);
+		m_queued ++;
+	}
+	{
+		auto& w = *m_workers[index];
+		lock_guard<mutex> lock(w.mutex);
+		w.tasks.push_back(LogContext::Current().Wrap(move(task)));
+	}
+	m_workCond.notify_one();
+}
+
+/**
+	@brief Blocks until every submitted task has finished
+
+	Must not be called from a task running in this pool.
+ */
+void LogThreadPool::Wait()
+{
+	unique_lock<mutex> lock(m_idleMutex);
+	m_doneCond.wait(lock, [this] { return m_pending == 0; });
+}
+
+/**
+	@brief Takes the newest task from our own queue, or failing that the oldest from someone else's
+ */
+bool LogThreadPool::TryPop(size_t index, function<void()>& task)
+{
+	size_t n = m_workers.size();
+	for(size_t i=0; i<n; i++)
+	{
+		auto& w = *m_workers[(index + i) % n];
+		lock_guard<mutex> lock(w.mutex);
+		if(w.tasks.empty())
+			continue;
+
+		if(i == 0)
+		{
+			task = move(w.tasks.back());
+			w.tasks.pop_back();
+		}
+		else
+		{
+			task = move(w.tasks.front());
+			w.tasks.pop_front();
+		}
+		m_queued --;
+		return true;
+	}
+	return false;
+}
+
+void LogThreadPool::WorkerThreadProc(size_t index)
+{
+	g_logCurrentPool = this;
+	g_logCurrentWorker = index;
+
+	function<void()> task;
+	while(true)
+	{
+		if(TryPop(index, task))
+		{
+			task();
+			task = nullptr;
+
+			if(--m_pending == 0)
+			{
+				lock_guard<mutex> lock(m_idleMutex);
+				m_doneCond.notify_all();
+			}
+			continue;
+		}
+
+		unique_lock<mutex> lock(m_idleMutex);
+		m_workCond.wait(lock, [this] { return m_quit || (m_queued > 0); });
+		if(m_quit && (m_queued == 0) )
+			break;
+	}
+}
@@ -0,0 +1,100 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+#ifndef LogThreadPool_h
+#define LogThreadPool_h
+
+/**
+	@file
+	@brief		Declaration of LogThreadPool
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include <deque>
+
+/**
+	@brief		A simple work-stealing thread pool that runs each task with the LogContext it was submitted from
+	@ingroup	liblog
+
+	Each worker has its own task queue. Tasks submitted from a worker go on that worker's queue and are run newest
+	first; tasks submitted from elsewhere are spread round-robin. An idle worker steals the oldest task from another
+	worker's queue.
+ */
+class LogThreadPool
+{
+public:
+	LogThreadPool(size_t threads = 0);
+	~LogThreadPool();
+
+	LogThreadPool(const LogThreadPool&) = delete;
+	LogThreadPool& operator=(const LogThreadPool&) = delete;
+
+	void Submit(std::function<void()> task);
+	void Wait();
+
+	///@brief Number of worker threads
+	size_t GetThreadCount()
+	{ return m_threads.size(); }
+
+protected:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void WorkerThreadProc(size_t index);
+	bool TryPop(size_t index, std::function<void()>& task);
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::vector<std::thread> m_threads;
+
+	///@brief Worker to give the next task submitted from outside the pool
+	std::atomic<size_t> m_nextWorker;
+
+	///@brief Tasks sitting in a queue
+	std::atomic<size_t> m_queued;
+
+	///@brief Tasks submitted but not yet finished
+	std::atomic<size_t> m_pending;
+
+	///@brief Protects the sleeping and waiting below
+	std::mutex m_idleMutex;
+
+	///@brief Signalled when a task is queued
+	std::condition_variable m_workCond;
+
+	///@brief Signalled when the last pending task finishes
+	std::condition_variable m_doneCond;
+
+	bool m_quit;
+};
+
+#endif
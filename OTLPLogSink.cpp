@@ -0,0 +1,538 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of OTLPLogSink
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include "LogSocket.h"
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+/**
+	@brief First retry delay after a failed export
+ */
+static const chrono::milliseconds g_otlpMinBackoff(100);
+
+/**
+	@brief Longest delay between export retries
+ */
+static const chrono::milliseconds g_otlpMaxBackoff(30000);
+
+/**
+	@brief How long to wait for the collector to accept a connection or answer a request
+ */
+static const int g_otlpTimeoutMs = 5000;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// JSON helpers
+
+/**
+	@brief Appends a string to a JSON document as a quoted, escaped string literal
+ */
+static void AppendJSONString(string& out, const char* str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	out += '\"';
+	for(size_t i=0; i<len; i++)
+	{
+		char c = str[i];
+		switch(c)
+		{
+			case '\"':	out += "\\\"";	break;
+			case '\\':	out += "\\\\";	break;
+			case '\n':	out += "\\n";	break;
+			case '\r':	out += "\\r";	break;
+			case '\t':	out += "\\t";	break;
+
+			default:
+				if(static_cast<unsigned char>(c) < 0x20)
+				{
+					out += "\\u00";
+					out += hex[c >> 4];
+					out += hex[c & 0xf];
+				}
+				else
+					out += c;
+				break;
+		}
+	}
+	out += '\"';
+}
+
+static void AppendJSONString(string& out, const string& str)
+{
+	AppendJSONString(out, str.data(), str.length());
+}
+
+/**
+	@brief Appends a string-valued OTLP KeyValue
+ */
+static void AppendStringAttribute(string& out, const char* key, const string& value)
+{
+	out += "{\"key\":";
+	AppendJSONString(out, key, strlen(key));
+	out += ",\"value\":{\"stringValue\":";
+	AppendJSONString(out, value);
+	out += "}}";
+}
+
+/**
+	@brief Maps our severities to OTLP severity numbers and names
+ */
+static void GetOTLPSeverity(Severity severity, int& number, const char*& text)
+{
+	switch(severity)
+	{
+		case Severity::FATAL:	number = 21;	text = "FATAL";	break;
+		case Severity::ERROR:	number = 17;	text = "ERROR";	break;
+		case Severity::WARNING:	number = 13;	text = "WARN";	break;
+		case Severity::NOTICE:	number = 10;	text = "INFO2";	break;
+		case Severity::VERBOSE:	number = 9;		text = "INFO";	break;
+		default:				number = 5;		text = "DEBUG";	break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Creates a sink exporting to an OTLP/HTTP collector
+
+	@param host			Host name or address of the collector
+	@param port			HTTP port of the collector (normally 4318)
+	@param serviceName	Value of the service.name resource attribute
+	@param min_severity	Minimum severity of messages to export
+ */
+OTLPLogSink::OTLPLogSink(const string& host, uint16_t port, const string& serviceName, Severity min_severity)
+	: LogSink(min_severity)
+	, m_host(host)
+	, m_port(port)
+	, m_path("/v1/logs")
+	, m_pendingSeverity(Severity::DEBUG)
+	, m_queueCount(0)
+	, m_maxQueueSize(4 * 1024 * 1024)
+	, m_maxBatchSize(256 * 1024)
+	, m_flushInterval(chrono::milliseconds(1000))
+	, m_dropped(0)
+	, m_exported(0)
+	, m_quit(false)
+{
+	//Records keep lines whole, don't wrap
+	m_termWidth = UINT_MAX;
+
+	AppendStringAttribute(m_resourceAttributes, "service.name", serviceName);
+	m_resourceAttributes += ",{\"key\":\"process.pid\",\"value\":{\"intValue\":\"" + to_string(getpid()) + "\"}}";
+
+	m_senderThread = thread(&OTLPLogSink::SenderThreadProc, this);
+}
+
+OTLPLogSink::~OTLPLogSink()
+{
+	if(!m_pending.empty())
+		EnqueueRecord(m_pendingSeverity, m_pending.c_str(), m_pending.length(), "");
+
+	{
+		lock_guard<mutex> lock(m_queueMutex);
+		m_quit = true;
+	}
+	m_queueCond.notify_one();
+	m_senderThread.join();
+
+	LogMemoryCharge(LOG_MEMORY_QUEUES, -static_cast<ptrdiff_t>(m_queue.length()));
+}
+
+/**
+	@brief Adds a string-valued attribute to the resource describing this process
+
+	Attributes are sent in the order they were added; service.name and process.pid are always present.
+ */
+void OTLPLogSink::SetResourceAttribute(const string& key, const string& value)
+{
+	lock_guard<mutex> lock(m_queueMutex);
+	m_resourceAttributes += ',';
+	AppendStringAttribute(m_resourceAttributes, key.c_str(), value);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Logging
+
+void OTLPLogSink::Log(Severity severity, const string &msg)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, msg, "");
+}
+
+void OTLPLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, vstrprintf(format, va), "");
+}
+
+void OTLPLogSink::LogTraceMessage(const string& function, const string& msg)
+{
+	if(Severity::DEBUG > m_min_severity)
+		return;
+
+	Append(Severity::DEBUG, msg, function);
+}
+
+/**
+	@brief Adds text to the line buffer and queues each complete line as a record
+ */
+void OTLPLogSink::Append(Severity severity, const string& text, const string& function)
+{
+	string wrapped = WrapString(text);
+	if(wrapped.empty())
+		return;
+	m_lastMessageWasNewline = (wrapped[wrapped.length() - 1] == '\n');
+
+	if(m_pending.empty() || (severity < m_pendingSeverity) )
+		m_pendingSeverity = severity;
+	m_pending += wrapped;
+
+	size_t start = 0;
+	size_t end;
+	while( (end = m_pending.find('\n', start)) != string::npos)
+	{
+		EnqueueRecord(m_pendingSeverity, m_pending.c_str() + start, end - start, function);
+		start = end + 1;
+		m_pendingSeverity = severity;
+	}
+	m_pending.erase(0, start);
+}
+
+/**
+	@brief Encodes a JSON log record and adds it to the send queue, or drops it if the queue is full
+ */
+void OTLPLogSink::EnqueueRecord(Severity severity, const char* line, size_t len, const string& function)
+{
+	if(LogMemoryShed(severity))
+	{
+		m_dropped ++;
+		return;
+	}
+
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	string stamp = to_string(now.tv_sec * 1000000000ULL + now.tv_nsec);
+
+	int number;
+	const char* text;
+	GetOTLPSeverity(severity, number, text);
+
+	string record = "{\"timeUnixNano\":\"" + stamp + "\",\"observedTimeUnixNano\":\"" + stamp + "\"";
+	record += ",\"severityNumber\":" + to_string(number) + ",\"severityText\":\"" + text + "\"";
+	record += ",\"body\":{\"stringValue\":";
+	AppendJSONString(record, line, len);
+	record += "},\"attributes\":[";
+#ifdef __linux__
+	record += "{\"key\":\"thread.id\",\"value\":{\"intValue\":\"" + to_string(syscall(SYS_gettid)) + "\"}}";
+#else
+	record += "{\"key\":\"thread.id\",\"value\":{\"intValue\":\"0\"}}";
+#endif
+	if(!function.empty())
+	{
+		record += ',';
+		AppendStringAttribute(record, "code.function", function);
+	}
+	for(auto& tag : LogContext::Current().GetTags())
+	{
+		record += ',';
+		AppendStringAttribute(record, tag.first.c_str(), tag.second);
+	}
+	record += "]}\n";
+
+	{
+		lock_guard<mutex> lock(m_queueMutex);
+		if(m_queue.length() + record.length() > m_maxQueueSize)
+		{
+			m_dropped ++;
+			return;
+		}
+
+		if(m_queue.empty())
+			m_queueStart = chrono::steady_clock::now();
+		m_queue += record;
+		m_queueCount ++;
+		LogMemoryCharge(LOG_MEMORY_QUEUES, record.length());
+
+		//Only wake the sender when there's a full batch, otherwise it wakes itself when the oldest record times out
+		if( (m_queueCount > 1) && (m_queue.length() < m_maxBatchSize) )
+			return;
+	}
+	m_queueCond.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Export
+
+/**
+	@brief Wraps newline-terminated records in an ExportLogsServiceRequest
+ */
+string OTLPLogSink::BuildRequestBody(const string& records)
+{
+	string resource;
+	{
+		lock_guard<mutex> lock(m_queueMutex);
+		resource = m_resourceAttributes;
+	}
+
+	string body = "{\"resourceLogs\":[{\"resource\":{\"attributes\":[" + resource + "]},";
+	body += "\"scopeLogs\":[{\"scope\":{\"name\":\"logtools\"},\"logRecords\":[";
+	size_t start = body.length();
+	body += records;
+	for(size_t i = start; i < body.length(); i++)
+	{
+		if(body[i] == '\n')
+			body[i] = ',';
+	}
+	if(body.back() == ',')
+		body.pop_back();
+	body += "]}]}]}";
+	return body;
+}
+
+/**
+	@brief POSTs a request body to the collector, (re)connecting if needed
+
+	@param sock		Connection to use, -1 if not connected. Closed and set to -1 if the connection is lost or the
+					collector doesn't want it kept alive.
+	@param body		Request body
+
+	@return HTTP status code, or -1 if there was no usable response
+ */
+int OTLPLogSink::PostBatch(int& sock, const string& body)
+{
+	string path;
+	{
+		lock_guard<mutex> lock(m_queueMutex);
+		path = m_path;
+	}
+
+	string request = "POST " + path + " HTTP/1.1\r\n";
+	request += "Host: " + m_host + ":" + to_string(m_port) + "\r\n";
+	request += "Content-Type: application/json\r\n";
+	request += "Content-Length: " + to_string(body.length()) + "\r\n";
+	request += "Connection: keep-alive\r\n\r\n";
+
+	//Keep-alive connections may have been closed by the server since last time, so retry once on a fresh one
+	for(int attempt = 0; attempt < 2; attempt ++)
+	{
+		bool fresh = (sock < 0);
+		if(fresh)
+		{
+			sock = LogConnectTCP(m_host, m_port, g_otlpTimeoutMs);
+			if(sock < 0)
+				return -1;
+		}
+
+		if(LogSendAll(sock, request.data(), request.length()) && LogSendAll(sock, body.data(), body.length()))
+		{
+			//Read the response headers
+			string response;
+			size_t headerEnd = string::npos;
+			char buf[4096];
+			while(headerEnd == string::npos)
+			{
+				ssize_t n = recv(sock, buf, sizeof(buf), 0);
+				if(n <= 0)
+					break;
+				response.append(buf, n);
+				headerEnd = response.find("\r\n\r\n");
+			}
+
+			int status;
+			if( (headerEnd != string::npos) && (sscanf(response.c_str(), "HTTP/%*d.%*d %d", &status) == 1) )
+			{
+				//Lower-case the headers so we can look them up
+				string headers = response.substr(0, headerEnd + 2);
+				for(auto& c : headers)
+					c = tolower(c);
+
+				//Consume the body so the connection can be reused. We only understand Content-Length framing,
+				//anything else (or an explicit close) means the connection is done after this response.
+				bool keep = (headers.find("\r\nconnection: close\r\n") == string::npos);
+				size_t clen = 0;
+				size_t pos = headers.find("\r\ncontent-length:");
+				if(pos != string::npos)
+					clen = strtoul(headers.c_str() + pos + 17, nullptr, 10);
+				else
+					keep = false;
+
+				size_t have = response.length() - headerEnd - 4;
+				while(keep && (have < clen) )
+				{
+					ssize_t n = recv(sock, buf, min(sizeof(buf), clen - have), 0);
+					if(n <= 0)
+						keep = false;
+					else
+						have += n;
+				}
+
+				if(!keep)
+				{
+					close(sock);
+					sock = -1;
+				}
+				return status;
+			}
+		}
+
+		close(sock);
+		sock = -1;
+		if(fresh)
+			break;
+	}
+
+	return -1;
+}
+
+/**
+	@brief Collects records into batches and exports them
+ */
+void OTLPLogSink::SenderThreadProc()
+{
+	int sock = -1;
+	auto backoff = g_otlpMinBackoff;
+	auto nextAttempt = chrono::steady_clock::now();
+	string batch;
+	size_t batchCount = 0;
+
+	while(true)
+	{
+		bool quit;
+		{
+			unique_lock<mutex> lock(m_queueMutex);
+
+			if(batch.empty())
+			{
+				//Wait for a full batch, or for the oldest record to have waited long enough
+				while(!m_quit && (m_queue.length() < m_maxBatchSize) )
+				{
+					if(m_queue.empty())
+						m_queueCond.wait(lock);
+					else
+					{
+						auto deadline = m_queueStart + m_flushInterval.load();
+						if(chrono::steady_clock::now() >= deadline)
+							break;
+						m_queueCond.wait_until(lock, deadline);
+					}
+				}
+
+				//Take up to one batch worth of whole records (at least one, even if it's oversized)
+				size_t cut = m_queue.length();
+				if(cut > m_maxBatchSize)
+				{
+					cut = m_queue.rfind('\n', m_maxBatchSize - 1);
+					if(cut == string::npos)
+						cut = m_queue.find('\n');
+					cut ++;
+				}
+				batch.assign(m_queue, 0, cut);
+				m_queue.erase(0, cut);
+				LogMemoryCharge(LOG_MEMORY_QUEUES, -static_cast<ptrdiff_t>(cut));
+				batchCount = 0;
+				for(auto c : batch)
+				{
+					if(c == '\n')
+						batchCount ++;
+				}
+				m_queueCount -= batchCount;
+				if(!m_queue.empty())
+					m_queueStart = chrono::steady_clock::now();
+			}
+
+			//Waiting to retry a failed batch
+			else
+				m_queueCond.wait_until(lock, nextAttempt, [this] { return m_quit; });
+
+			quit = m_quit;
+			if(batch.empty())
+			{
+				if(quit)
+					break;
+				continue;
+			}
+		}
+
+		int status = PostBatch(sock, BuildRequestBody(batch));
+		if( (status >= 200) && (status < 300) )
+		{
+			m_exported += batchCount;
+			batch.clear();
+			backoff = g_otlpMinBackoff;
+		}
+
+		//Transient failure, try again later. When shutting down there's no later, give up on everything.
+		else if( (status < 0) || (status == 429) || (status >= 500) )
+		{
+			if(quit)
+			{
+				lock_guard<mutex> lock(m_queueMutex);
+				m_dropped += batchCount + m_queueCount;
+				LogMemoryCharge(LOG_MEMORY_QUEUES, -static_cast<ptrdiff_t>(m_queue.length()));
+				m_queue.clear();
+				m_queueCount = 0;
+				break;
+			}
+
+			nextAttempt = chrono::steady_clock::now() + backoff;
+			backoff = min(backoff * 2, g_otlpMaxBackoff);
+		}
+
+		//Collector rejected the batch outright, retrying won't help
+		else
+		{
+			m_dropped += batchCount;
+			batch.clear();
+		}
+	}
+
+	if(sock >= 0)
+		close(sock);
+}
@@ -0,0 +1,258 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of SHMLogReader
+	@ingroup	liblog
+ */
+
+#include "SHMLogRing.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+	@brief How long a reader waits on an unfinished slot before checking whether its producer is still alive
+ */
+static const uint64_t g_shmStallCheckInterval = 100000000;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Opens an existing ring for reading
+
+	Reading starts at the oldest record still in the ring.
+ */
+SHMLogReader::SHMLogReader(const string& name)
+	: m_name(name)
+	, m_ring(nullptr)
+	, m_mapSize(0)
+	, m_nextTicket(0)
+	, m_stallStart(0)
+	, m_lost(0)
+	, m_partialMessage(0)
+	, m_inPartial(false)
+{
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0)
+		return;
+
+	struct stat st;
+	if( (fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(SHMLogRingHeader)) )
+	{
+		close(fd);
+		return;
+	}
+
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return;
+
+	//Sanity check the layout before trusting anything in it
+	auto ring = static_cast<SHMLogRingHeader*>(map);
+	size_t expected = sizeof(SHMLogRingHeader) + static_cast<size_t>(ring->slotCount) * ring->slotSize;
+	if( (ring->magic.load(memory_order_acquire) != SHM_LOG_RING_MAGIC) ||
+		(ring->version != SHM_LOG_RING_VERSION) ||
+		(ring->slotSize <= sizeof(SHMLogSlotHeader)) ||
+		(expected > static_cast<size_t>(st.st_size)) )
+	{
+		munmap(map, st.st_size);
+		return;
+	}
+
+	m_ring = ring;
+	m_mapSize = st.st_size;
+
+	uint64_t head = m_ring->nextTicket.load(memory_order_acquire);
+	if(head > m_ring->slotCount)
+		m_nextTicket = head - m_ring->slotCount;
+}
+
+SHMLogReader::~SHMLogReader()
+{
+	if(m_ring)
+		munmap(m_ring, m_mapSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reading
+
+SHMLogSlotHeader* SHMLogReader::GetSlot(uint64_t ticket)
+{
+	auto base = reinterpret_cast<uint8_t*>(m_ring + 1);
+	return reinterpret_cast<SHMLogSlotHeader*>(base + (ticket % m_ring->slotCount) * m_ring->slotSize);
+}
+
+/**
+	@brief Checks whether any ticket after m_nextTicket, up to head, has been committed
+ */
+bool SHMLogReader::IsLaterTicketCommitted(uint64_t head)
+{
+	uint64_t end = min(head, m_nextTicket + m_ring->slotCount);
+	for(uint64_t t = m_nextTicket + 1; t < end; t++)
+	{
+		if(GetSlot(t)->state.load(memory_order_acquire) >= 2 * (t + 1))
+			return true;
+	}
+	return false;
+}
+
+/**
+	@brief Checks whether the producer that claimed a slot still exists
+
+	A pid we aren't allowed to signal belongs to a live process too. Only ESRCH means it's gone.
+ */
+bool SHMLogReader::IsProducerAlive(uint32_t pid)
+{
+	if(pid == 0)
+		return true;
+	return (kill(static_cast<pid_t>(pid), 0) == 0) || (errno != ESRCH);
+}
+
+/**
+	@brief Reads the next complete message from the ring
+
+	@return True if a message was read, false if there's nothing new yet
+ */
+bool SHMLogReader::Read(SHMLogRecord& rec)
+{
+	if(!m_ring)
+		return false;
+
+	size_t maxlen = m_ring->slotSize - sizeof(SHMLogSlotHeader);
+	string text;
+	while(true)
+	{
+		uint64_t head = m_ring->nextTicket.load(memory_order_acquire);
+		if(m_nextTicket >= head)
+			return false;
+
+		//If we've fallen more than a lap behind, skip ahead to the oldest slot that can still be intact
+		if(head - m_nextTicket > m_ring->slotCount)
+		{
+			m_lost += head - m_ring->slotCount - m_nextTicket;
+			m_nextTicket = head - m_ring->slotCount;
+			m_inPartial = false;
+		}
+
+		auto slot = GetSlot(m_nextTicket);
+		uint64_t committed = 2 * (m_nextTicket + 1);
+		uint64_t state = slot->state.load(memory_order_acquire);
+
+		//Slot already reused by a producer on a later lap
+		if(state > committed + 1)
+		{
+			m_lost ++;
+			m_nextTicket ++;
+			m_inPartial = false;
+			continue;
+		}
+
+		//Not written yet. Normally the producer is just partway through, so wait for it. Only give up on the slot
+		//if later tickets have been committed (so it isn't simply the newest one) and its producer no longer exists.
+		//A producer that is preempted, stopped or in a debugger holds everything behind it up, but loses nothing.
+		if(state != committed)
+		{
+			timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			uint64_t tnow = now.tv_sec * 1000000000ULL + now.tv_nsec;
+			if(m_stallStart == 0)
+				m_stallStart = tnow;
+			if(tnow - m_stallStart < g_shmStallCheckInterval)
+				return false;
+			m_stallStart = tnow;
+
+			if(!IsLaterTicketCommitted(head) || IsProducerAlive(slot->pid))
+				return false;
+
+			m_stallStart = 0;
+			m_lost ++;
+			m_nextTicket ++;
+			m_inPartial = false;
+			continue;
+		}
+		m_stallStart = 0;
+
+		//Copy the slot out, then make sure nobody started overwriting it while we were copying
+		SHMLogSlotHeader hdr;
+		hdr.timestamp = slot->timestamp;
+		hdr.pid = slot->pid;
+		hdr.message = slot->message;
+		hdr.severity = slot->severity;
+		hdr.flags = slot->flags;
+		hdr.length = slot->length;
+		size_t len = min(static_cast<size_t>(hdr.length), maxlen);
+		text.assign(reinterpret_cast<const char*>(slot + 1), len);
+
+		atomic_thread_fence(memory_order_acquire);
+		m_nextTicket ++;
+		if(slot->state.load(memory_order_relaxed) != state)
+		{
+			m_lost ++;
+			m_inPartial = false;
+			continue;
+		}
+
+		//Reassemble messages split over several slots
+		if(hdr.flags & SHM_LOG_FIRST)
+		{
+			m_partial.timestamp = hdr.timestamp;
+			m_partial.pid = hdr.pid;
+			m_partial.severity = hdr.severity;
+			m_partial.text = text;
+			m_partialMessage = hdr.message;
+			m_inPartial = true;
+		}
+		else if(m_inPartial && (hdr.pid == m_partial.pid) && (hdr.message == m_partialMessage) )
+			m_partial.text += text;
+		else
+		{
+			//Continuation of a message whose start we lost
+			m_inPartial = false;
+			continue;
+		}
+
+		if(hdr.flags & SHM_LOG_LAST)
+		{
+			m_inPartial = false;
+			rec = std::move(m_partial);
+			return true;
+		}
+	}
+}
@@ -0,0 +1,187 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+#ifndef SHMLogRing_h
+#define SHMLogRing_h
+
+/**
+	@file
+	@brief		Layout of the shared-memory ring used by SHMLogSink, and a reader for it
+	@ingroup	liblog
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+	@brief		Header at the start of a shared-memory log ring
+	@ingroup	liblog
+
+	The ring is an array of fixed-size slots. A producer reserves slots by atomically incrementing nextTicket, and
+	ticket t always lives in slot (t % slotCount). Producers never wait for readers; a reader that falls more than
+	one lap behind loses records.
+ */
+struct SHMLogRingHeader
+{
+	///@brief SHM_LOG_RING_MAGIC once the creator has finished initializing the ring
+	std::atomic<uint32_t>	magic;
+
+	///@brief Layout version
+	uint32_t				version;
+
+	///@brief Number of slots in the ring (a power of two)
+	uint32_t				slotCount;
+
+	///@brief Size of each slot in bytes, including its SHMLogSlotHeader
+	uint32_t				slotSize;
+
+	///@brief Next ticket to hand out to a producer
+	std::atomic<uint64_t>	nextTicket;
+
+	uint8_t					reserved[40];
+};
+
+/**
+	@brief		Header at the start of each slot in a shared-memory log ring
+	@ingroup	liblog
+
+	state is 0 for a slot that was never written, 2*(ticket+1)+1 while the producer holding that ticket is filling it
+	in, and 2*(ticket+1) once the record is complete. A producer that dies mid-write leaves its slot marked as being
+	written; readers skip it once later tickets have been committed and the pid in the slot no longer exists, and the
+	next producer to come around the ring simply claims it.
+ */
+struct SHMLogSlotHeader
+{
+	std::atomic<uint64_t>	state;
+
+	///@brief CLOCK_REALTIME timestamp of the record, in nanoseconds
+	uint64_t				timestamp;
+
+	///@brief Process ID of the producer, written first after the slot is claimed
+	uint32_t				pid;
+
+	///@brief Per-process message counter, shared by all slots of a message split across several slots
+	uint32_t				message;
+
+	///@brief Severity of the message
+	uint8_t					severity;
+
+	///@brief SHM_LOG_FIRST and/or SHM_LOG_LAST
+	uint8_t					flags;
+
+	///@brief Number of bytes of text in this slot
+	uint16_t				length;
+
+	uint32_t				reserved;
+};
+
+#define SHM_LOG_RING_MAGIC		0x4c54524eu		//"LTRN"
+#define SHM_LOG_RING_VERSION	1
+
+#define SHM_LOG_FIRST	1
+#define SHM_LOG_LAST	2
+
+static_assert(sizeof(SHMLogRingHeader) == 64, "SHMLogRingHeader must be one cache line");
+static_assert(sizeof(SHMLogSlotHeader) == 32, "SHMLogSlotHeader layout changed");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared-memory ring needs lock-free 64-bit atomics");
+
+/**
+	@brief		A complete message read back from a shared-memory ring
+	@ingroup	liblog
+ */
+struct SHMLogRecord
+{
+	uint64_t	timestamp;
+	uint32_t	pid;
+	uint8_t		severity;
+	std::string	text;
+};
+
+/**
+	@brief		Reads records out of a shared-memory log ring
+	@ingroup	liblog
+ */
+class SHMLogReader
+{
+public:
+	SHMLogReader(const std::string& name);
+	~SHMLogReader();
+
+	SHMLogReader(const SHMLogReader&) = delete;
+	SHMLogReader& operator=(const SHMLogReader&) = delete;
+
+	///@brief Returns true if the ring was opened successfully
+	bool IsOpen()
+	{ return m_ring != nullptr; }
+
+	bool Read(SHMLogRecord& rec);
+
+	///@brief Number of slots that were overwritten or abandoned before they could be read
+	uint64_t GetLostCount()
+	{ return m_lost; }
+
+	///@brief Name of the ring
+	const std::string& GetName()
+	{ return m_name; }
+
+protected:
+	SHMLogSlotHeader* GetSlot(uint64_t ticket);
+	bool IsLaterTicketCommitted(uint64_t head);
+	static bool IsProducerAlive(uint32_t pid);
+
+	///@brief Name of the shared memory object
+	std::string m_name;
+
+	///@brief Mapped ring
+	SHMLogRingHeader* m_ring;
+
+	///@brief Size of the mapping
+	size_t m_mapSize;
+
+	///@brief Next ticket we expect to read
+	uint64_t m_nextTicket;
+
+	///@brief When we last started waiting on, or checked on, an unfinished m_nextTicket, in nanoseconds (0 if not)
+	uint64_t m_stallStart;
+
+	///@brief Number of slots lost
+	uint64_t m_lost;
+
+	///@brief Message being reassembled from several slots
+	SHMLogRecord m_partial;
+
+	///@brief Producer message counter of m_partial
+	uint32_t m_partialMessage;
+
+	///@brief True if m_partial holds the start of a message
+	bool m_inPartial;
+};
+
+#endif
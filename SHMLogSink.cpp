@@ -0,0 +1,279 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of SHMLogSink
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include "SHMLogRing.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+	@brief Size of each slot in a newly created ring
+ */
+static const uint32_t g_shmSlotSize = 256;
+
+/**
+	@brief Longest message, in slots, written to the ring. Anything longer is truncated.
+ */
+static const size_t g_shmMaxSlotsPerMessage = 64;
+
+/**
+	@brief Message counter for the slot headers, shared by every SHMLogSink in the process
+
+	Readers reassemble split messages by (pid, message), so two sinks writing to one ring must not reuse numbers.
+ */
+static atomic<uint32_t> g_shmNextMessage(0);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Opens a shared-memory ring, creating it if it doesn't exist
+
+	@param name			Name of the POSIX shared memory object, e.g. "/myapp-log"
+	@param slotCount	Number of slots if the ring has to be created, rounded up to a power of two
+	@param min_severity	Minimum severity of messages to write
+ */
+SHMLogSink::SHMLogSink(const string& name, uint32_t slotCount, Severity min_severity)
+	: LogSink(min_severity)
+	, m_ring(nullptr)
+	, m_mapSize(0)
+	, m_pendingSeverity(Severity::DEBUG)
+{
+	//No wrapping, same as a file
+	m_termWidth = UINT_MAX;
+
+	//The ring is bounded and cheap to write, so it's where messages from demoted sites still go
+	SetKeepsDemoted(true);
+
+	uint32_t count = 1;
+	while(count < slotCount)
+		count <<= 1;
+
+	//Try to create it, fall back to opening an existing one
+	bool creator = true;
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if( (fd < 0) && (errno == EEXIST) )
+	{
+		creator = false;
+		fd = shm_open(name.c_str(), O_RDWR, 0);
+	}
+	if(fd < 0)
+	{
+		LogError("SHMLogSink: couldn't open shared memory \"%s\" (%s)\n", name.c_str(), strerror(errno));
+		return;
+	}
+
+	size_t size = sizeof(SHMLogRingHeader) + static_cast<size_t>(count) * g_shmSlotSize;
+	if(creator)
+	{
+		if(ftruncate(fd, size) != 0)
+		{
+			LogError("SHMLogSink: couldn't size shared memory \"%s\" (%s)\n", name.c_str(), strerror(errno));
+			close(fd);
+			shm_unlink(name.c_str());
+			return;
+		}
+	}
+	else
+	{
+		//Somebody else created it, wait (briefly) for them to finish setting it up
+		size = 0;
+		for(int i=0; i<1000; i++)
+		{
+			struct stat st;
+			if( (fstat(fd, &st) == 0) && (static_cast<size_t>(st.st_size) >= sizeof(SHMLogRingHeader)) )
+			{
+				size = st.st_size;
+				break;
+			}
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+		if(size == 0)
+		{
+			LogError("SHMLogSink: shared memory \"%s\" was never initialized\n", name.c_str());
+			close(fd);
+			return;
+		}
+	}
+
+	void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		LogError("SHMLogSink: couldn't map shared memory \"%s\" (%s)\n", name.c_str(), strerror(errno));
+		return;
+	}
+	auto ring = static_cast<SHMLogRingHeader*>(map);
+
+	if(creator)
+	{
+		ring->version = SHM_LOG_RING_VERSION;
+		ring->slotCount = count;
+		ring->slotSize = g_shmSlotSize;
+		ring->nextTicket = 0;
+		ring->magic.store(SHM_LOG_RING_MAGIC, memory_order_release);
+	}
+	else
+	{
+		for(int i=0; (i<1000) && (ring->magic.load(memory_order_acquire) != SHM_LOG_RING_MAGIC); i++)
+			this_thread::sleep_for(chrono::milliseconds(1));
+
+		size_t expected = sizeof(SHMLogRingHeader) + static_cast<size_t>(ring->slotCount) * ring->slotSize;
+		if( (ring->magic.load(memory_order_acquire) != SHM_LOG_RING_MAGIC) ||
+			(ring->version != SHM_LOG_RING_VERSION) ||
+			(ring->slotSize <= sizeof(SHMLogSlotHeader)) ||
+			(expected > size) )
+		{
+			LogError("SHMLogSink: \"%s\" is not a compatible log ring\n", name.c_str());
+			munmap(map, size);
+			return;
+		}
+	}
+
+	m_ring = ring;
+	m_mapSize = size;
+}
+
+SHMLogSink::~SHMLogSink()
+{
+	if(!m_pending.empty())
+		Commit(m_pendingSeverity, m_pending.c_str(), m_pending.length());
+
+	if(m_ring)
+		munmap(m_ring, m_mapSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Logging
+
+void SHMLogSink::Log(Severity severity, const string &msg)
+{
+	if( (severity > m_min_severity) || !m_ring)
+		return;
+
+	string wrapped = WrapString(msg);
+	if(wrapped.empty())
+		return;
+	m_lastMessageWasNewline = (wrapped[wrapped.length() - 1] == '\n');
+
+	if(m_pending.empty() || (severity < m_pendingSeverity) )
+		m_pendingSeverity = severity;
+	m_pending += wrapped;
+
+	//Write out everything up to the last complete line
+	size_t end = m_pending.rfind('\n');
+	if(end == string::npos)
+		return;
+	Commit(m_pendingSeverity, m_pending.c_str(), end + 1);
+	m_pending.erase(0, end + 1);
+	m_pendingSeverity = severity;
+}
+
+void SHMLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Log(severity, vstrprintf(format, va));
+}
+
+/**
+	@brief Writes one message into the ring, split over as many slots as it needs
+ */
+void SHMLogSink::Commit(Severity severity, const char* text, size_t len)
+{
+	if(!m_ring || (len == 0) )
+		return;
+
+	size_t payload = m_ring->slotSize - sizeof(SHMLogSlotHeader);
+	size_t nslots = min((len + payload - 1) / payload, g_shmMaxSlotsPerMessage);
+	len = min(len, nslots * payload);
+
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	uint32_t pid = getpid();
+	uint32_t message = g_shmNextMessage.fetch_add(1, memory_order_relaxed) + 1;
+
+	uint64_t first = m_ring->nextTicket.fetch_add(nslots, memory_order_acq_rel);
+	auto base = reinterpret_cast<uint8_t*>(m_ring + 1);
+	for(size_t i=0; i<nslots; i++)
+	{
+		uint64_t ticket = first + i;
+		auto slot = reinterpret_cast<SHMLogSlotHeader*>(base + (ticket % m_ring->slotCount) * m_ring->slotSize);
+
+		//Claim the slot. It normally holds a record from the previous lap, or a dead producer's half-written one.
+		//If a producer a full lap ahead of us already got it, this piece of the message is lost.
+		uint64_t committed = 2 * (ticket + 1);
+		uint64_t writing = committed + 1;
+		uint64_t cur = slot->state.load(memory_order_relaxed);
+		bool claimed = false;
+		while(cur < committed)
+		{
+			if(slot->state.compare_exchange_weak(cur, writing, memory_order_acq_rel))
+			{
+				claimed = true;
+				break;
+			}
+		}
+		if(!claimed)
+			continue;
+		atomic_thread_fence(memory_order_release);
+
+		//pid first, so a reader waiting on this slot can tell whether we're still alive
+		slot->pid = pid;
+
+		size_t off = i * payload;
+		size_t chunk = min(payload, len - off);
+		slot->timestamp = timestamp;
+		slot->message = message;
+		slot->severity = static_cast<uint8_t>(severity);
+		slot->flags = ( (i == 0) ? SHM_LOG_FIRST : 0 ) | ( (i + 1 == nslots) ? SHM_LOG_LAST : 0 );
+		slot->length = chunk;
+		memcpy(reinterpret_cast<uint8_t*>(slot + 1), text + off, chunk);
+
+		//Publish, unless we got lapped while writing
+		slot->state.compare_exchange_strong(writing, committed, memory_order_release, memory_order_relaxed);
+	}
+}
@@ -46,6 +46,8 @@ extern bool g_logToStdoutAlways;
 STDLogSink::STDLogSink(Severity min_severity)
 	: LogSink(min_severity)
 {
+	m_builtinType = DISPATCH_STD;
+
 	//Get the current display terminal width
 #ifndef _WIN32
 #ifndef __EMSCRIPTEN__
@@ -112,22 +114,28 @@ void STDLogSink::Log(Severity severity, const string &msg)
 	if(severity <= Severity::WARNING)
 		Flush();
 
-	//Wrap/print it
-	string wrapped = WrapString(msg);
+	FILE* fp = stdout;
 	if( (severity <= Severity::WARNING) && !g_logToStdoutAlways )
-		fputs(wrapped.c_str(), stderr);
+		fp = stderr;
+
+	//Wrap/print it. Very long messages are streamed out rather than wrapped into a second copy
+	if(msg.length() > g_logStreamThreshold)
+		WriteStreamed(fp, msg);
 	else
-		fputs(wrapped.c_str(), stdout);
+	{
+		string wrapped = WrapString(msg);
+		fputs(wrapped.c_str(), fp);
+
+		//See if we printed a \n
+		if(wrapped.length() && (wrapped[wrapped.length() - 1] == '\n'))
+			m_lastMessageWasNewline = true;
+		else if(wrapped != "")
+			m_lastMessageWasNewline = false;
+	}
 
 	//Ensure that this message is displayed immediately even if we print lower severity stuff later
 	if(severity <= Severity::WARNING)
 		Flush();
-
-	//See if we printed a \n
-	if(wrapped.length() && (wrapped[wrapped.length() - 1] == '\n'))
-		m_lastMessageWasNewline = true;
-	else if(wrapped != "")
-		m_lastMessageWasNewline = false;
 }
 
 void STDLogSink::Log(Severity severity, const char *format, va_list va)
@@ -136,24 +144,5 @@ void STDLogSink::Log(Severity severity, const char *format, va_list va)
 	if(severity > m_min_severity)
 		return;
 
-	//Prevent newer messages on stderr from appearing before older messages on stdout
-	if(severity <= Severity::WARNING)
-		Flush();
-
-	//Wrap/print it
-	string wrapped = WrapString(vstrprintf(format, va));
-	if( (severity <= Severity::WARNING) && !g_logToStdoutAlways )
-		fputs(wrapped.c_str(), stderr);
-	else
-		fputs(wrapped.c_str(), stdout);
-
-	//Ensure that this message is displayed immediately even if we print lower severity stuff later
-	if(severity <= Severity::WARNING)
-		Flush();
-
-	//See if we printed a \n
-	if(wrapped.length() && (wrapped[wrapped.length() - 1] == '\n'))
-		m_lastMessageWasNewline = true;
-	else if(wrapped != "")
-		m_lastMessageWasNewline = false;
+	Log(severity, vstrprintf(format, va));
 }
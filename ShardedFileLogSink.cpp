@@ -0,0 +1,299 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of ShardedFileLogSink
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cinttypes>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+	@brief Size at which a shard's buffered output is written to its file
+ */
+static const size_t g_shardWriteSize = 64 * 1024;
+
+/**
+	@brief Source of unique sink IDs, so a stale per-thread shard cache is never mistaken for a current one
+ */
+static atomic<uint64_t> g_shardNextSinkID(1);
+
+/**
+	@brief Creates a sharded sink
+
+	@param prefix		Path prefix of the shard files. Shards are named prefix.NAME.log, where NAME is t0, t1...
+						for thread shards, or the class name (or "main") for class shards.
+	@param mode			How to split output into shards
+	@param min_severity	Minimum severity of messages to write
+ */
+ShardedFileLogSink::ShardedFileLogSink(const string& prefix, ShardMode mode, Severity min_severity)
+	: LogSink(min_severity)
+	, m_id(g_shardNextSinkID++)
+	, m_prefix(prefix)
+	, m_mode(mode)
+	, m_nextSequence(0)
+{
+	//The merge tool keeps lines whole, don't wrap
+	m_termWidth = UINT_MAX;
+
+	SetConcurrent();
+}
+
+ShardedFileLogSink::~ShardedFileLogSink()
+{
+	WaitForConcurrentCalls();
+
+	//No shard.lock needed from here on: WaitForConcurrentCalls() has stopped new calls and waited for those in
+	//progress on other threads, so nothing else can touch a shard. Flush() racing with the destructor would be a
+	//bug in the caller, as with any other member function.
+	for(auto& it : m_shards)
+	{
+		auto& shard = *it.second;
+		if(!shard.pending.empty())
+			Append(shard, shard.pendingSeverity, "\n");
+		WriteShard(shard);
+		if(shard.file)
+			fclose(shard.file);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Logging
+
+void ShardedFileLogSink::Log(Severity severity, const string &msg)
+{
+	if(severity > m_min_severity)
+		return;
+
+	auto shard = GetShard("");
+	if(shard)
+	{
+		lock_guard<mutex> lock(shard->lock);
+		Append(*shard, severity, msg);
+	}
+}
+
+void ShardedFileLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Log(severity, vstrprintf(format, va));
+}
+
+void ShardedFileLogSink::LogTraceMessage(const string& function, const string& msg)
+{
+	if(Severity::DEBUG > m_min_severity)
+		return;
+
+	auto shard = GetShard(function);
+	if(shard)
+	{
+		lock_guard<mutex> lock(shard->lock);
+		Append(*shard, Severity::DEBUG, string("[") + function + "] " + GetIndentString() + msg);
+	}
+}
+
+/**
+	@brief Finds (or opens) the shard a message belongs in
+
+	Shards this thread has used before are found in a per-thread cache without taking any lock.
+
+	@param function	Trace function name, or empty for other messages
+
+	@return The shard, or null if its file couldn't be opened
+ */
+ShardedFileLogSink::Shard* ShardedFileLogSink::GetShard(const string& function)
+{
+	struct ShardCache
+	{
+		///@brief Sink the cache belongs to
+		uint64_t sink = 0;
+
+		///@brief This thread's shard, in SHARD_BY_THREAD mode
+		Shard* thread = nullptr;
+
+		///@brief Shards by class name, in SHARD_BY_CLASS mode
+		unordered_map<string, Shard*> classes;
+	};
+	static thread_local ShardCache cache;
+
+	if(cache.sink != m_id)
+	{
+		cache.sink = m_id;
+		cache.thread = nullptr;
+		cache.classes.clear();
+	}
+
+	string name;
+	if(m_mode == SHARD_BY_THREAD)
+	{
+		if(cache.thread)
+			return cache.thread->file ? cache.thread : nullptr;
+	}
+	else
+	{
+		size_t icolon = function.rfind("::");
+		if(function.empty())
+			name = "main";
+		else
+			name = (icolon == string::npos) ? function : function.substr(0, icolon);
+
+		auto it = cache.classes.find(name);
+		if(it != cache.classes.end())
+			return it->second->file ? it->second : nullptr;
+	}
+
+	lock_guard<mutex> lock(m_shardsMutex);
+
+	string key = name;
+	if(m_mode == SHARD_BY_THREAD)
+	{
+		auto tid = this_thread::get_id();
+		auto it = m_threadNames.find(tid);
+		if(it == m_threadNames.end())
+			it = m_threadNames.emplace(tid, "t" + to_string(m_threadNames.size())).first;
+		key = it->second;
+	}
+	else
+	{
+		//Keep class names (which may include namespaces and template arguments) safe as file names
+		for(auto& c : key)
+		{
+			if(!isalnum(static_cast<unsigned char>(c)) && (c != '_') && (c != '-') )
+				c = '_';
+		}
+	}
+
+	auto& shard = m_shards[key];
+	if(!shard)
+	{
+		shard = make_unique<Shard>();
+		shard->path = m_prefix + "." + key + ".log";
+		shard->file = fopen(shard->path.c_str(), "w");
+		shard->pendingSeverity = Severity::DEBUG;
+		shard->lastWasNewline = true;
+	}
+
+	if(m_mode == SHARD_BY_THREAD)
+		cache.thread = shard.get();
+	else
+		cache.classes[name] = shard.get();
+	return shard->file ? shard.get() : nullptr;
+}
+
+/**
+	@brief Adds text to a shard and formats each complete line as a record
+
+	Caller must hold the shard's lock.
+ */
+void ShardedFileLogSink::Append(Shard& shard, Severity severity, const string& text)
+{
+	//Indentation and the line buffer are per shard
+	string wrapped = WrapString(text, shard.lastWasNewline);
+	if(wrapped.empty())
+		return;
+	shard.lastWasNewline = (wrapped[wrapped.length() - 1] == '\n');
+
+	if(shard.pending.empty() || (severity < shard.pendingSeverity) )
+		shard.pendingSeverity = severity;
+	shard.pending += wrapped;
+
+	bool urgent = false;
+	size_t start = 0;
+	size_t end;
+	while( (end = shard.pending.find('\n', start)) != string::npos)
+	{
+		uint64_t now = chrono::duration_cast<chrono::nanoseconds>(
+			chrono::system_clock::now().time_since_epoch()).count();
+
+		char header[64];
+		snprintf(header, sizeof(header), "%" PRIu64 "\t%" PRIu64 "\t%d\t",
+			m_nextSequence++, now, static_cast<int>(shard.pendingSeverity));
+		shard.out += header;
+		shard.out.append(shard.pending, start, end + 1 - start);
+
+		if(shard.pendingSeverity <= Severity::WARNING)
+			urgent = true;
+		start = end + 1;
+		shard.pendingSeverity = severity;
+	}
+	shard.pending.erase(0, start);
+
+	if(urgent || (shard.out.length() >= g_shardWriteSize) )
+		WriteShard(shard);
+}
+
+/**
+	@brief Writes a shard's buffered output to its file
+
+	Caller must hold the shard's lock (or be the destructor).
+ */
+void ShardedFileLogSink::WriteShard(Shard& shard)
+{
+	if(shard.out.empty() || !shard.file)
+		return;
+
+	fwrite(shard.out.data(), 1, shard.out.length(), shard.file);
+	fflush(shard.file);
+	shard.out.clear();
+}
+
+/**
+	@brief Writes everything buffered in every shard (except partial lines) to the files
+ */
+void ShardedFileLogSink::Flush()
+{
+	lock_guard<mutex> lock(m_shardsMutex);
+	for(auto& it : m_shards)
+	{
+		lock_guard<mutex> shardLock(it.second->lock);
+		WriteShard(*it.second);
+	}
+}
+
+vector<string> ShardedFileLogSink::GetFileNames()
+{
+	lock_guard<mutex> lock(m_shardsMutex);
+	vector<string> ret;
+	for(auto& it : m_shards)
+	{
+		if(it.second->file)
+			ret.push_back(it.second->path);
+	}
+	return ret;
+}
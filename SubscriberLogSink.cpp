@@ -0,0 +1,344 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of SubscriberLogSink
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include "LogArena.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <ctime>
+
+using namespace std;
+
+/**
+	@brief A fixed-size block of records
+
+	Slots below count are immutable and may be read by any thread. next is written once, before hasNext is set.
+ */
+struct SubscriberLogSink::Segment : public enable_shared_from_this<SubscriberLogSink::Segment>
+{
+	Record records[SEGMENT_SIZE];
+
+	///@brief Number of slots published so far
+	atomic<size_t> count{0};
+
+	///@brief Sequence number of records[0]
+	uint64_t firstSequence = 0;
+
+	///@brief The following segment, valid once hasNext is set
+	shared_ptr<Segment> next;
+
+	atomic<bool> hasNext{false};
+
+	///@brief Bytes charged to the logging memory budget: the segment itself, plus the text once the segment is full
+	size_t charged = sizeof(Segment);
+
+	///@brief Length of the text of the records so far (writer only)
+	size_t textBytes = 0;
+
+	Segment()
+	{ LogMemoryCharge(LOG_MEMORY_RECORDERS, charged); }
+
+	~Segment()
+	{
+		//A span held for a long time pins every later segment, and releasing it frees the whole chain at once.
+		//Walk that chain here instead of letting each segment's destructor recurse into the next: holding a copy of
+		//the following link means each segment we let go of finds its next still referenced and stops there.
+		//Segments are never modified, since a cursor may still lock() one we think we hold the only reference to.
+		shared_ptr<Segment> chain = std::move(next);
+		while(chain && (chain.use_count() == 1) )
+		{
+			shared_ptr<Segment> after = chain->next;
+			chain = std::move(after);
+		}
+
+		//Usually runs on a reader or a different logging thread than the one that allocated the text
+		size_t n = count.load(memory_order_relaxed);
+		for(size_t i=0; i<n; i++)
+			LogArenaFree(const_cast<char*>(records[i].text.data()), records[i].text.length());
+
+		LogMemoryCharge(LOG_MEMORY_RECORDERS, -static_cast<ptrdiff_t>(charged));
+	}
+};
+
+size_t SubscriberLogSink::Batch::size() const
+{
+	size_t n = 0;
+	for(auto& s : spans)
+		n += s.end - s.begin;
+	return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Creates a subscriber sink
+
+	@param retention	Number of records to keep for readers
+	@param min_severity	Minimum severity of messages to keep
+ */
+SubscriberLogSink::SubscriberLogSink(size_t retention, Severity min_severity)
+	: LogSink(min_severity)
+	, m_pendingSeverity(Severity::DEBUG)
+	, m_headRef(make_shared<Segment>())
+	, m_head(m_headRef.get())
+	, m_headReaders(0)
+	, m_tail(m_headRef)
+	, m_segmentCount(1)
+	, m_nextSequence(0)
+	, m_retention(retention)
+{
+	//Viewers do their own wrapping
+	m_termWidth = UINT_MAX;
+}
+
+SubscriberLogSink::~SubscriberLogSink()
+{
+	if(!m_pending.empty())
+		Publish(m_pendingSeverity, m_pending.c_str(), m_pending.length(), 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Logging
+
+void SubscriberLogSink::Log(Severity severity, const string &msg)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, msg, "");
+}
+
+void SubscriberLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, vstrprintf(format, va), "");
+}
+
+void SubscriberLogSink::LogTraceMessage(const string& function, const string& msg)
+{
+	if(Severity::DEBUG > m_min_severity)
+		return;
+
+	Append(Severity::DEBUG, msg, function);
+}
+
+/**
+	@brief Adds text to the line buffer and publishes each complete line as a record
+ */
+void SubscriberLogSink::Append(Severity severity, const string& text, const string& function)
+{
+	string wrapped = WrapString(text);
+	if(wrapped.empty())
+		return;
+	m_lastMessageWasNewline = (wrapped[wrapped.length() - 1] == '\n');
+
+	if(m_pending.empty() || (severity < m_pendingSeverity) )
+		m_pendingSeverity = severity;
+	m_pending += wrapped;
+
+	uint32_t id = LogInternString(function);
+	size_t start = 0;
+	size_t end;
+	while( (end = m_pending.find('\n', start)) != string::npos)
+	{
+		Publish(m_pendingSeverity, m_pending.c_str() + start, end - start, id);
+		start = end + 1;
+		m_pendingSeverity = severity;
+	}
+	m_pending.erase(0, start);
+}
+
+/**
+	@brief Writes a record into the next free slot and makes it visible to readers
+
+	Only called with g_log_mutex held (or from the destructor), so there is a single writer.
+ */
+void SubscriberLogSink::Publish(Severity severity, const char* line, size_t len, uint32_t function)
+{
+	//Start a new segment if this one is full, then discard the oldest ones past the retention limit
+	size_t n = m_tail->count.load(memory_order_relaxed);
+	if(n == SEGMENT_SIZE)
+	{
+		LogMemoryCharge(LOG_MEMORY_RECORDERS, m_tail->textBytes);
+		m_tail->charged += m_tail->textBytes;
+
+		auto seg = make_shared<Segment>();
+		seg->firstSequence = m_tail->firstSequence + SEGMENT_SIZE;
+		m_tail->next = seg;
+		m_tail->hasNext.store(true, memory_order_release);
+		m_tail = seg;
+		m_segmentCount ++;
+		n = 0;
+
+		//Keep enough full segments to cover the retention, plus the one being filled.
+		//If logging is short of memory, keep just the newest full segment.
+		size_t maxSegments = (m_retention + SEGMENT_SIZE - 1) / SEGMENT_SIZE + 1;
+		if( (maxSegments > 2) && (m_segmentCount > 2) && LogMemoryShouldShrink())
+		{
+			LogMemoryCountTrimmed( (min(m_segmentCount, maxSegments) - 2) * SEGMENT_SIZE);
+			maxSegments = 2;
+		}
+		while(m_segmentCount > maxSegments)
+		{
+			auto next = m_headRef->next;
+			m_retired.push_back(std::move(m_headRef));
+			m_headRef = std::move(next);
+			m_head.store(m_headRef.get());
+			m_segmentCount --;
+		}
+
+		//A reader that loaded m_head before the stores above may not have its reference yet. If none is counted
+		//now, any reader that comes along later sees the new head, so nothing can reach the retired segments.
+		if(!m_retired.empty() && (m_headReaders.load() == 0) )
+			m_retired.clear();
+	}
+
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	auto& r = m_tail->records[n];
+	r.sequence = m_tail->firstSequence + n;
+	r.timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	r.severity = severity;
+	r.function = function;
+	char* text = nullptr;
+	if(len)
+	{
+		text = static_cast<char*>(LogArenaAllocate(len));
+		if(!text)
+			len = 0;
+		else
+			memcpy(text, line, len);
+	}
+	r.text = string_view(text, len);
+	m_tail->textBytes += len;
+
+	m_tail->count.store(n + 1, memory_order_release);
+	m_nextSequence.store(r.sequence + 1, memory_order_release);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reading
+
+/**
+	@brief Gets a reference to the oldest retained segment, from any thread
+
+	Never blocks: the segment can't be freed while we're counted in m_headReaders, since Publish() keeps retired
+	segments until it sees no readers.
+ */
+shared_ptr<SubscriberLogSink::Segment> SubscriberLogSink::GetHead()
+{
+	m_headReaders.fetch_add(1);
+	auto head = m_head.load()->shared_from_this();
+	m_headReaders.fetch_sub(1);
+	return head;
+}
+
+/**
+	@brief Creates a cursor for a new reader
+
+	@param fromOldest	If true, the first Pull() returns every retained record. Otherwise it only returns records
+						written after this call.
+ */
+SubscriberLogSink::Cursor SubscriberLogSink::Subscribe(bool fromOldest)
+{
+	Cursor cursor;
+	if(fromOldest)
+	{
+		auto head = GetHead();
+		cursor.m_segment = head;
+		cursor.m_sequence = head->firstSequence;
+	}
+	else
+		cursor.m_sequence = m_nextSequence.load(memory_order_acquire);
+	return cursor;
+}
+
+/**
+	@brief Appends every record written since the cursor's last pull to a batch, and advances the cursor
+
+	Never blocks the writer. The batch's spans point into the sink's segments, so it's cheap to keep around for a
+	frame but holding it for long keeps those segments in memory.
+
+	Each cursor must only be used by one thread at a time.
+ */
+void SubscriberLogSink::Pull(Cursor& cursor, Batch& batch)
+{
+	//If our segment is gone (or we never had one), find our place again starting from the oldest one still kept
+	auto seg = cursor.m_segment.lock();
+	size_t index = cursor.m_index;
+	if(!seg)
+	{
+		seg = GetHead();
+		if(cursor.m_sequence < seg->firstSequence)
+		{
+			batch.lost += seg->firstSequence - cursor.m_sequence;
+			index = 0;
+		}
+		else
+		{
+			while( (cursor.m_sequence >= seg->firstSequence + SEGMENT_SIZE) &&
+				seg->hasNext.load(memory_order_acquire) )
+			{
+				seg = seg->next;
+			}
+			index = min(static_cast<size_t>(cursor.m_sequence - seg->firstSequence), SEGMENT_SIZE);
+		}
+	}
+
+	//Collect everything published since then
+	while(true)
+	{
+		size_t count = seg->count.load(memory_order_acquire);
+		if(index < count)
+		{
+			batch.spans.push_back(Span{seg, &seg->records[index], &seg->records[count]});
+			index = count;
+		}
+
+		if( (count < SEGMENT_SIZE) || !seg->hasNext.load(memory_order_acquire) )
+			break;
+		seg = seg->next;
+		index = 0;
+	}
+
+	cursor.m_segment = seg;
+	cursor.m_index = index;
+	cursor.m_sequence = seg->firstSequence + index;
+}
@@ -0,0 +1,419 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of SyslogLogSink
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+	@brief Maximum number of entries sent in one batch
+ */
+static const size_t g_syslogBatchSize = 32;
+
+/**
+	@brief Longest time an entry waits in a partial batch
+ */
+static const chrono::milliseconds g_syslogFlushInterval(100);
+
+/**
+	@brief Enterprise number used for our RFC 5424 structured data element (the RFC 5612 documentation number)
+ */
+#define SYSLOG_SD_ID "logtools@32473"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Creates a sink sending to the system log
+
+	@param protocol		Wire protocol to speak
+	@param ident		Application name reported to the daemon
+	@param min_severity	Minimum severity of messages to send
+	@param path			Path of the daemon's socket. Defaults to /dev/log or /run/systemd/journal/socket.
+ */
+SyslogLogSink::SyslogLogSink(Protocol protocol, const string& ident, Severity min_severity, const string& path)
+	: LogSink(min_severity)
+	, m_protocol(protocol)
+	, m_path(path)
+	, m_ident(ident)
+	, m_facility(1)
+	, m_socket(-1)
+	, m_pendingSeverity(Severity::DEBUG)
+	, m_dropped(0)
+	, m_quit(false)
+{
+	//The daemon keeps lines whole, don't wrap
+	m_termWidth = UINT_MAX;
+
+	if(m_path.empty())
+	{
+		if(protocol == PROTOCOL_JOURNALD)
+			m_path = "/run/systemd/journal/socket";
+		else
+			m_path = "/dev/log";
+	}
+
+	char hostname[256] = "-";
+	if(gethostname(hostname, sizeof(hostname)) == 0)
+		hostname[sizeof(hostname) - 1] = '\0';
+	m_hostname = hostname;
+
+	m_batch.reserve(g_syslogBatchSize);
+	Connect();
+
+	m_flushThread = thread(&SyslogLogSink::FlushThreadProc, this);
+}
+
+SyslogLogSink::~SyslogLogSink()
+{
+	if(!m_pending.empty())
+	{
+		m_pending += '\n';
+		Append(m_pendingSeverity, "", "");
+	}
+
+	{
+		lock_guard<mutex> lock(m_batchMutex);
+		m_quit = true;
+	}
+	m_flushCond.notify_one();
+	m_flushThread.join();
+
+	SendBatch();
+	if(m_socket >= 0)
+		close(m_socket);
+}
+
+/**
+	@brief Opens a non-blocking datagram socket to the daemon
+
+	Caller must hold m_batchMutex (or be the constructor).
+ */
+bool SyslogLogSink::Connect()
+{
+	if(m_socket >= 0)
+		return true;
+
+	sockaddr_un addr;
+	if(m_path.length() >= sizeof(addr.sun_path))
+		return false;
+
+	//SOCK_CLOEXEC would save a call, but isn't available everywhere (e.g. macOS)
+	int s = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if(s < 0)
+		return false;
+	fcntl(s, F_SETFD, FD_CLOEXEC);
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, m_path.c_str(), sizeof(addr.sun_path) - 1);
+	if(connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		close(s);
+		return false;
+	}
+
+	m_socket = s;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Logging
+
+void SyslogLogSink::Log(Severity severity, const string &msg)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, msg, "");
+}
+
+void SyslogLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, vstrprintf(format, va), "");
+}
+
+void SyslogLogSink::LogTraceMessage(const string& function, const string& msg)
+{
+	if(Severity::DEBUG > m_min_severity)
+		return;
+
+	Append(Severity::DEBUG, msg, function);
+}
+
+/**
+	@brief Adds text to the line buffer and queues every line that's now complete
+ */
+void SyslogLogSink::Append(Severity severity, const string& text, const string& function)
+{
+	if(m_pending.empty() || (severity < m_pendingSeverity) )
+		m_pendingSeverity = severity;
+
+	//Indent the start of each new line, same as the console
+	if(m_pending.empty() && m_lastMessageWasNewline)
+		m_pending += GetIndentString();
+	m_pending += text;
+	if(!text.empty())
+		m_lastMessageWasNewline = (text[text.length() - 1] == '\n');
+
+	size_t start = 0;
+	while(true)
+	{
+		size_t end = m_pending.find('\n', start);
+		if(end == string::npos)
+			break;
+
+		if(end > start)
+			Enqueue(m_pendingSeverity, m_pending.c_str() + start, end - start, function);
+		start = end + 1;
+	}
+	if(start)
+	{
+		m_pending.erase(0, start);
+		m_pendingSeverity = severity;
+	}
+
+	//Don't sit on serious problems
+	if(severity <= Severity::WARNING)
+		Flush();
+}
+
+/**
+	@brief Encodes one line in the selected protocol and adds it to the batch
+ */
+void SyslogLogSink::Enqueue(Severity severity, const char* line, size_t len, const string& function)
+{
+	//FATAL = crit, ERROR = err, WARNING = warning, NOTICE = notice, VERBOSE = info, DEBUG = debug
+	static const int priorities[] = { 7, 2, 3, 4, 5, 6, 7 };
+	int priority = priorities[static_cast<int>(severity)];
+
+	//Class is everything before the ::, empty for globals
+	string cls;
+	size_t icolon = function.find("::");
+	if(icolon != string::npos)
+		cls = function.substr(0, icolon);
+
+	string entry;
+	entry.reserve(len + 128);
+	if(m_protocol == PROTOCOL_JOURNALD)
+	{
+		entry += "PRIORITY=";
+		entry += to_string(priority);
+		entry += "\nSYSLOG_IDENTIFIER=";
+		entry += m_ident;
+		if(!function.empty())
+		{
+			entry += "\nCODE_FUNC=";
+			entry += function;
+			if(!cls.empty())
+			{
+				entry += "\nLOGTOOLS_CLASS=";
+				entry += cls;
+			}
+		}
+		entry += "\nMESSAGE=";
+		entry.append(line, len);
+		entry += '\n';
+	}
+	else
+	{
+		//<PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG
+		timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		struct tm t;
+		gmtime_r(&now.tv_sec, &t);
+		char stamp[64];
+		size_t slen = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &t);
+		snprintf(stamp + slen, sizeof(stamp) - slen, ".%06luZ", static_cast<unsigned long>(now.tv_nsec / 1000));
+
+		entry += "<";
+		entry += to_string(m_facility * 8 + priority);
+		entry += ">1 ";
+		entry += stamp;
+		entry += " ";
+		entry += m_hostname;
+		entry += " ";
+		entry += m_ident.empty() ? "-" : m_ident;
+		entry += " ";
+		entry += to_string(getpid());
+		entry += " - ";
+
+		if(function.empty())
+			entry += "-";
+		else
+		{
+			//PARAM-VALUE needs ", \ and ] escaped
+			entry += "[" SYSLOG_SD_ID;
+			const string* names[] = { &cls, &function };
+			const char* keys[] = { " class=\"", " function=\"" };
+			for(int i=0; i<2; i++)
+			{
+				if(names[i]->empty())
+					continue;
+				entry += keys[i];
+				for(char c : *names[i])
+				{
+					if( (c == '"') || (c == '\\') || (c == ']') )
+						entry += '\\';
+					entry += c;
+				}
+				entry += "\"";
+			}
+			entry += "]";
+		}
+
+		entry += " ";
+		entry.append(line, len);
+	}
+
+	bool full;
+	{
+		lock_guard<mutex> lock(m_batchMutex);
+		m_batch.push_back(std::move(entry));
+		full = (m_batch.size() >= g_syslogBatchSize);
+	}
+	if(full)
+		Flush();
+	else
+		m_flushCond.notify_one();
+}
+
+/**
+	@brief Sends everything queued so far
+ */
+void SyslogLogSink::Flush()
+{
+	lock_guard<mutex> lock(m_batchMutex);
+	SendBatch();
+}
+
+/**
+	@brief Sends the current batch. Caller must hold m_batchMutex.
+ */
+void SyslogLogSink::SendBatch()
+{
+	if(m_batch.empty())
+		return;
+
+	if(!Connect())
+	{
+		m_dropped += m_batch.size();
+		m_batch.clear();
+		return;
+	}
+
+	size_t count = m_batch.size();
+	size_t sent = 0;
+
+	//Why the last send stopped short. Nothing sent but no error counts as the daemon being busy
+	int err = EAGAIN;
+
+#ifdef __linux__
+	mmsghdr msgs[g_syslogBatchSize];
+	iovec iovs[g_syslogBatchSize];
+	while(sent < count)
+	{
+		size_t n = min(count - sent, g_syslogBatchSize);
+		for(size_t i=0; i<n; i++)
+		{
+			iovs[i].iov_base = const_cast<char*>(m_batch[sent + i].data());
+			iovs[i].iov_len = m_batch[sent + i].size();
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int ret = sendmmsg(m_socket, msgs, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(ret <= 0)
+		{
+			if(ret < 0)
+				err = errno;
+			break;
+		}
+		sent += ret;
+	}
+#else
+	for(; sent < count; sent++)
+	{
+		if(send(m_socket, m_batch[sent].data(), m_batch[sent].size(), MSG_DONTWAIT) < 0)
+		{
+			err = errno;
+			break;
+		}
+	}
+#endif
+
+	//Whatever didn't go out is dropped. If the daemon went away, reconnect next time
+	if(sent < count)
+	{
+		m_dropped += count - sent;
+		if( (err != EAGAIN) && (err != EWOULDBLOCK) && (err != EINTR) )
+		{
+			close(m_socket);
+			m_socket = -1;
+		}
+	}
+	m_batch.clear();
+}
+
+/**
+	@brief Sends partial batches once they've waited for the flush interval
+ */
+void SyslogLogSink::FlushThreadProc()
+{
+	unique_lock<mutex> lock(m_batchMutex);
+	while(!m_quit)
+	{
+		//Sleep until there's something to send, then give the batch a chance to fill up
+		m_flushCond.wait(lock, [this] { return m_quit || !m_batch.empty(); });
+		if(m_quit)
+			break;
+		m_flushCond.wait_for(lock, g_syslogFlushInterval, [this] { return m_quit; });
+		SendBatch();
+	}
+}
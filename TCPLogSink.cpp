@@ -0,0 +1,376 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Implementation of TCPLogSink
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include "LogSocket.h"
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+	@brief First reconnect delay after losing the connection
+ */
+static const chrono::milliseconds g_tcpMinBackoff(100);
+
+/**
+	@brief Longest delay between reconnect attempts
+ */
+static const chrono::milliseconds g_tcpMaxBackoff(30000);
+
+/**
+	@brief How long to wait for a connection or a send to complete before giving up on the collector
+ */
+static const int g_tcpTimeoutMs = 2000;
+
+/**
+	@brief Size of the fixed part of a frame, including the length word
+ */
+static const size_t g_tcpFrameHeaderSize = 16;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+static void AppendLE(string& out, uint64_t value, int bytes)
+{
+	for(int i=0; i<bytes; i++)
+		out += static_cast<char>( (value >> (8*i)) & 0xff);
+}
+
+static uint32_t ReadLE32(const char* p)
+{
+	auto u = reinterpret_cast<const uint8_t*>(p);
+	return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+/**
+	@brief Counts the complete frames in a buffer
+ */
+static size_t CountFrames(const string& data)
+{
+	size_t count = 0;
+	for(size_t off = 0; off + 4 <= data.length(); off += 4 + ReadLE32(&data[off]))
+		count ++;
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Creates a sink forwarding to a remote collector
+
+	@param host			Host name or address of the collector
+	@param port			TCP port of the collector
+	@param spoolPath	File to spill frames to while disconnected. Empty to keep them in memory only.
+	@param min_severity	Minimum severity of messages to forward
+ */
+TCPLogSink::TCPLogSink(const string& host, uint16_t port, const string& spoolPath, Severity min_severity)
+	: LogSink(min_severity)
+	, m_host(host)
+	, m_port(port)
+	, m_spoolPath(spoolPath)
+	, m_pendingSeverity(Severity::DEBUG)
+	, m_maxQueueSize(4 * 1024 * 1024)
+	, m_maxSpoolSize(64 * 1024 * 1024)
+	, m_dropped(0)
+	, m_connected(false)
+	, m_quit(false)
+{
+	//The collector keeps lines whole, don't wrap
+	m_termWidth = UINT_MAX;
+
+	m_senderThread = thread(&TCPLogSink::SenderThreadProc, this);
+}
+
+TCPLogSink::~TCPLogSink()
+{
+	if(!m_pending.empty())
+		EnqueueFrame(m_pendingSeverity, m_pending.c_str(), m_pending.length(), "");
+
+	{
+		lock_guard<mutex> lock(m_queueMutex);
+		m_quit = true;
+	}
+	m_queueCond.notify_one();
+	m_senderThread.join();
+
+	//The sender thread spills or counts everything it takes from the queue on the way out, so this is only a backstop
+	m_dropped += CountFrames(m_queue);
+	LogMemoryCharge(LOG_MEMORY_QUEUES, -static_cast<ptrdiff_t>(m_queue.length()));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Logging
+
+void TCPLogSink::Log(Severity severity, const string &msg)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, msg, "");
+}
+
+void TCPLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	Append(severity, vstrprintf(format, va), "");
+}
+
+void TCPLogSink::LogTraceMessage(const string& function, const string& msg)
+{
+	if(Severity::DEBUG > m_min_severity)
+		return;
+
+	Append(Severity::DEBUG, msg, function);
+}
+
+/**
+	@brief Adds text to the line buffer and queues everything up to the last complete line as one frame
+ */
+void TCPLogSink::Append(Severity severity, const string& text, const string& function)
+{
+	string wrapped = WrapString(text);
+	if(wrapped.empty())
+		return;
+	m_lastMessageWasNewline = (wrapped[wrapped.length() - 1] == '\n');
+
+	if(m_pending.empty() || (severity < m_pendingSeverity) )
+		m_pendingSeverity = severity;
+	m_pending += wrapped;
+
+	size_t end = m_pending.rfind('\n');
+	if(end == string::npos)
+		return;
+	EnqueueFrame(m_pendingSeverity, m_pending.c_str(), end + 1, function);
+	m_pending.erase(0, end + 1);
+	m_pendingSeverity = severity;
+}
+
+/**
+	@brief Encodes a frame and adds it to the send queue, or drops it if the queue is full
+ */
+void TCPLogSink::EnqueueFrame(Severity severity, const char* line, size_t len, const string& function)
+{
+	if(LogMemoryShed(severity))
+	{
+		m_dropped ++;
+		return;
+	}
+
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	size_t flen = min(function.length(), static_cast<size_t>(UINT16_MAX));
+	size_t total = g_tcpFrameHeaderSize + flen + len;
+
+	{
+		lock_guard<mutex> lock(m_queueMutex);
+		if(m_queue.length() + total > m_maxQueueSize)
+		{
+			m_dropped ++;
+			return;
+		}
+
+		AppendLE(m_queue, total - 4, 4);
+		AppendLE(m_queue, now.tv_sec * 1000000000ULL + now.tv_nsec, 8);
+		AppendLE(m_queue, static_cast<uint8_t>(severity), 1);
+		AppendLE(m_queue, 0, 1);
+		AppendLE(m_queue, flen, 2);
+		m_queue.append(function, 0, flen);
+		m_queue.append(line, len);
+	}
+	LogMemoryCharge(LOG_MEMORY_QUEUES, total);
+	m_queueCond.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Network I/O
+
+/**
+	@brief Appends frames to the spool file, dropping them if it's full (or spooling is disabled)
+ */
+void TCPLogSink::SpillToSpool(const string& data)
+{
+	if(data.empty())
+		return;
+
+	FILE* fp = nullptr;
+	if(!m_spoolPath.empty())
+		fp = fopen(m_spoolPath.c_str(), "ab");
+	if(!fp)
+	{
+		m_dropped += CountFrames(data);
+		return;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size_t size = ftell(fp);
+	if(size + data.length() > m_maxSpoolSize)
+		m_dropped += CountFrames(data);
+	else
+		fwrite(data.data(), 1, data.length(), fp);
+	fclose(fp);
+}
+
+/**
+	@brief Sends the contents of the spool file and empties it
+
+	Only complete frames are sent, in case we crashed partway through writing the spool. If the connection fails
+	partway through, the whole spool is kept and sent again later, so the collector may see some frames twice.
+
+	If the spool can't be emptied after replaying it, spooling is turned off, rather than sending everything in it
+	again on every reconnect. Frames that would have been spooled from then on are dropped and counted.
+ */
+bool TCPLogSink::ReplaySpool(int sock)
+{
+	if(m_spoolPath.empty())
+		return true;
+	FILE* fp = fopen(m_spoolPath.c_str(), "rb");
+	if(!fp)
+		return true;
+
+	string buf;
+	char chunk[65536];
+	bool ok = true;
+	while(ok)
+	{
+		size_t n = fread(chunk, 1, sizeof(chunk), fp);
+		if(n == 0)
+			break;
+		buf.append(chunk, n);
+
+		//Send every complete frame we have
+		size_t off = 0;
+		while( (off + 4 <= buf.length()) && (off + 4 + ReadLE32(&buf[off]) <= buf.length()) )
+			off += 4 + ReadLE32(&buf[off]);
+		ok = LogSendAll(sock, buf.data(), off);
+		buf.erase(0, off);
+	}
+	fclose(fp);
+
+	if(ok && (truncate(m_spoolPath.c_str(), 0) != 0) && (unlink(m_spoolPath.c_str()) != 0) )
+		m_spoolPath.clear();
+	return ok;
+}
+
+/**
+	@brief Sends queued frames to the collector, reconnecting and spooling as needed
+ */
+void TCPLogSink::SenderThreadProc()
+{
+	int sock = -1;
+	auto backoff = g_tcpMinBackoff;
+	auto nextAttempt = chrono::steady_clock::now();
+	bool spooling = !m_spoolPath.empty();
+	string batch;
+
+	while(true)
+	{
+		bool quit;
+		{
+			unique_lock<mutex> lock(m_queueMutex);
+
+			//While connected, wait for something to send. While not, wait until it's time to retry (spilling
+			//anything that arrives meanwhile to the spool, if we have one)
+			if(sock >= 0)
+				m_queueCond.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+			else
+			{
+				m_queueCond.wait_until(lock, nextAttempt,
+					[this, spooling] { return m_quit || (spooling && !m_queue.empty()); });
+			}
+
+			quit = m_quit;
+			if( (sock >= 0) || spooling || quit)
+			{
+				batch.clear();
+				batch.swap(m_queue);
+				LogMemoryCharge(LOG_MEMORY_QUEUES, -static_cast<ptrdiff_t>(batch.length()));
+			}
+		}
+
+		if(sock < 0)
+		{
+			//Without a spool, this only happens when quitting, and counts the frames as dropped
+			SpillToSpool(batch);
+			batch.clear();
+
+			if(quit)
+				break;
+			if(chrono::steady_clock::now() < nextAttempt)
+				continue;
+
+			sock = LogConnectTCP(m_host, m_port, g_tcpTimeoutMs);
+			if( (sock >= 0) && !ReplaySpool(sock) )
+			{
+				close(sock);
+				sock = -1;
+			}
+
+			if(sock < 0)
+			{
+				nextAttempt = chrono::steady_clock::now() + backoff;
+				backoff = min(backoff * 2, g_tcpMaxBackoff);
+				continue;
+			}
+
+			backoff = g_tcpMinBackoff;
+			spooling = !m_spoolPath.empty();
+			m_connected = true;
+			continue;
+		}
+
+		if(!LogSendAll(sock, batch.data(), batch.length()))
+		{
+			close(sock);
+			sock = -1;
+			m_connected = false;
+			nextAttempt = chrono::steady_clock::now() + backoff;
+			SpillToSpool(batch);
+		}
+		batch.clear();
+
+		if(quit)
+			break;
+	}
+
+	if(sock >= 0)
+		close(sock);
+	m_connected = false;
+}
@@ -34,9 +34,29 @@
  */
 
 #include "log.h"
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <cstdarg>
 #include <cstdlib>
+#include <cstring>
+#include <ostream>
 #include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <ctime>
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <dlfcn.h>
+#endif
+#ifdef __GNUC__
+#include <cxxabi.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 using namespace std;
 
@@ -71,88 +91,380 @@ bool g_logToStdoutAlways = false;
 /**
 	@brief		Set of classes or class::function for high verbosity trace messages
 
+	Read without a lock when a call site's filter check is (re)computed. Fill it in before other threads start logging,
+	and call LogTraceFiltersChanged() after changing it once trace messages may already have been checked.
+
 	@ingroup	logtools
  */
 set<string> g_trace_filters;
 
+/**
+	@brief		Bumped by LogTraceFiltersChanged(), so every LogTraceSiteCache checks the filters again
+ */
+static atomic<uint32_t> g_logTraceGeneration(1);
+
+/**
+	@brief		Maximum length of a single formatted message, in bytes. Longer messages are truncated with a marker.
+
+	Zero means no limit.
+
+	@ingroup	logtools
+ */
+size_t g_logMaxMessageSize = 16 * 1024 * 1024;
+
+/**
+	@brief		Messages longer than this are streamed to their sinks in chunks rather than wrapped into a new string
+
+	@ingroup	logtools
+ */
+size_t g_logStreamThreshold = 64 * 1024;
+
+/**
+	@brief		Highest severity printed by any sink, or -1 if it has to be recomputed
+
+	Raised by LogSink's constructor and invalidated by its destructor, so LogIsEnabled() doesn't need g_log_mutex.
+ */
+static atomic<int> g_logSeverityCache(-1);
+
+/**
+	@brief		Highest severity printed by any sink keeping demoted messages (0 if none), or -1 to recompute
+
+	Raised by LogSink::SetKeepsDemoted() and invalidated by the destructor, like g_logSeverityCache.
+ */
+static atomic<int> g_logDemotedSeverityCache(-1);
+
+/**
+	@brief		Changed whenever a sink is created or destroyed, so per-thread views of g_log_sinks are refreshed
+ */
+static atomic<uint64_t> g_logSinkGeneration(1);
+
+/**
+	@brief		Number of LogSink objects in existence
+ */
+static atomic<size_t> g_logSinkCount(0);
+
+/**
+	@brief		Number of concurrent sinks in existence. While there are none, every message is printed under
+				g_log_mutex as it always was.
+ */
+static atomic<size_t> g_logConcurrentSinkCount(0);
+
+/**
+	@brief		Largest piece of a long line passed to PreprocessLine() at once by the streaming path
+ */
+static const size_t g_logStreamChunkSize = 16 * 1024;
+
+/**
+	@brief		Per-thread buffer each message is formatted into once, before being handed to the sinks
+ */
+static thread_local string g_logFormatBuffer;
+
+/**
+	@brief		Innermost LogCapture on this thread, if any
+ */
+static thread_local LogCapture* g_logCaptureTop = nullptr;
+
+/**
+	@brief		Highest severity wanted by any LogCapture on this thread, 0 if there are none
+ */
+static thread_local int g_logCaptureSeverity = 0;
+
+/**
+	@brief		A LogTag, in an immutable list shared by every context snapshot taken while it was in effect
+ */
+struct LogTagNode
+{
+	string key;
+	string value;
+	shared_ptr<const LogTagNode> next;
+};
+
+/**
+	@brief		Innermost LogTag on this thread, if any
+ */
+static thread_local shared_ptr<const LogTagNode> g_logTags;
+
+struct LogRegionBuffer;
+
+/**
+	@brief		Buffer of the LogParallelRegion this thread is logging into, or null for normal output
+ */
+static thread_local LogRegionBuffer* g_logRegionBuffer = nullptr;
+
+/**
+	@brief		Key of the current LogParallelKey
+ */
+static thread_local uint64_t g_logRegionKey = 0;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // String formatting
 
 /**
-	@brief Like sprintf, but self-managing a buffer with a std::string
+	@brief Appends the note added to messages cut short by g_logMaxMessageSize
  */
-string LogSink::vstrprintf(const char* format, va_list va)
+static void AppendTruncationMarker(string& out, size_t omitted)
+{
+	out += "\n[message truncated, ";
+	out += to_string(omitted);
+	out += " bytes omitted]\n";
+}
+
+/**
+	@brief Formats a message into a caller-provided buffer, truncating it to g_logMaxMessageSize
+
+	The formatted text replaces everything in the buffer from offset start onwards. Existing capacity in the buffer
+	is reused, so most messages are formatted with a single vsnprintf() call.
+ */
+static void FormatMessage(string& out, const char* format, va_list va, size_t start = 0)
 {
-	//Figure out how much space we need
+	//Try formatting into whatever space we already have
+	if(out.capacity() < start + 256)
+		out.reserve(start + 256);
+	out.resize(out.capacity());
+	size_t avail = out.size() - start;
+
 	va_list va_tmp;
 	va_copy(va_tmp, va);
-
-	int len = vsnprintf(NULL, 0, format, va_tmp);
+	int len = vsnprintf(&out[start], avail + 1, format, va_tmp);
 	va_end(va_tmp);
 
 	if(len < 0)
-		return "";
+	{
+		out.resize(start);
+		return;
+	}
+
+	//Clamp to the size limit
+	size_t fulllen = len;
+	size_t outlen = fulllen;
+	if( (g_logMaxMessageSize != 0) && (outlen > g_logMaxMessageSize) )
+		outlen = g_logMaxMessageSize;
 
-	//and then format the real string
+	//If it didn't fit, format again with exactly as much space as we're going to keep
+	if(fulllen > avail)
+	{
+		out.resize(start + outlen);
+		vsnprintf(&out[start], outlen + 1, format, va);
+	}
+	out.resize(start + outlen);
+
+	if(outlen < fulllen)
+		AppendTruncationMarker(out, fulllen - outlen);
+}
+
+/**
+	@brief Like sprintf, but self-managing a buffer with a std::string
+ */
+string LogSink::vstrprintf(const char* format, va_list va)
+{
 	string ret;
-	ret.resize(len+1);
-	vsnprintf(&ret[0], len+1, format, va);
-	ret.resize(len);
+	FormatMessage(ret, format, va);
 	return ret;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+LogSink::LogSink(Severity min_severity)
+	: m_indentSize(4)
+	, m_termWidth(120)	//default if not using ioctls to check
+	, m_lastMessageWasNewline(true)
+	, m_min_severity(min_severity)
+	, m_keepsDemoted(false)
+	, m_concurrent(false)
+	, m_builtinType(DISPATCH_VIRTUAL)
+	, m_dispatchType(DISPATCH_UNKNOWN)
+{
+	//Make sure LogIsEnabled() knows about the new sink right away
+	int sev = static_cast<int>(min_severity);
+	int cached = g_logSeverityCache.load();
+	while( (cached >= 0) && (cached < sev) && !g_logSeverityCache.compare_exchange_weak(cached, sev) )
+	{}
+
+	g_logSinkCount ++;
+	g_logSinkGeneration ++;
+}
+
+LogSink::~LogSink()
+{
+	//Normally already done by the derived class, before it started tearing itself down
+	if(m_concurrent)
+	{
+		WaitForConcurrentCalls();
+		g_logConcurrentSinkCount --;
+	}
+
+	//We may have been the only sink printing some severity, so recompute next time it's needed
+	g_logSeverityCache = -1;
+	g_logDemotedSeverityCache = -1;
+
+	g_logSinkCount --;
+	g_logSinkGeneration ++;
+}
+
+/**
+	@brief Sets whether the sink keeps getting messages from sites demoted by LogSetSiteBudget()
+ */
+void LogSink::SetKeepsDemoted(bool keep)
+{
+	m_keepsDemoted = keep;
+
+	int sev = static_cast<int>(m_min_severity);
+	int cached = g_logDemotedSeverityCache.load();
+	if(!keep)
+		g_logDemotedSeverityCache = -1;
+	else
+	{
+		while( (cached >= 0) && (cached < sev) && !g_logDemotedSeverityCache.compare_exchange_weak(cached, sev) )
+		{}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Indentation and wrapping
+
 string LogSink::GetIndentString()
 	{ return std::string(m_indentSize * g_logIndentLevel, ' '); }
 
 /**
 	@brief Wraps long lines and adds indentation as needed
  */
-string LogSink::WrapString(string str)
+string LogSink::WrapString(const string& str)
 {
-	string ret = "";
+	return WrapString(str, m_lastMessageWasNewline);
+}
+
+/**
+	@brief Wraps long lines and adds indentation as needed, for sinks tracking line state themselves
+
+	@param str				Text to wrap
+	@param lastWasNewline	True if the previous text ended in a newline, so the first line is indented too
+ */
+string LogSink::WrapString(const string& str, bool lastWasNewline)
+{
+	string ret;
+	ret.reserve(str.length() + 64);
 
 	//Cache the indent string so we don't have to re-generate it each time
 	string indent = GetIndentString();
+	size_t width = 1;
+	if(m_termWidth > indent.length())
+		width = m_termWidth - indent.length();
+	bool preprocess = NeedsPreprocessing();
 
 	//Split the string into lines
-	string tmp;
+	string line;
+	const char* p = str.c_str();
+	size_t len = str.length();
 	bool firstLine = true;
-	for(size_t i=0; i<str.length(); i++)
+	while(len > 0)
 	{
-		//Append it
-		char ch = str[i];
-		tmp += ch;
+		//Line ends at a \n, the wrap width, or the end of the message
+		size_t span = min(len, width);
+		auto nl = static_cast<const char*>(memchr(p, '\n', span));
+		size_t linelen;
+		bool forced = false;
+		if(nl)
+			linelen = nl - p + 1;
+		else if(span == width)
+		{
+			linelen = width;
+			forced = true;
+		}
 
-		//Unless line is overly long, or done, nothing to do
-		if( ( (tmp.length() + indent.length() )  < m_termWidth) && (ch != '\n') )
-			continue;
+		//If we have any remaining stuff, append it
+		else
+		{
+			ret.append(p, len);
+			break;
+		}
 
 		//We're ending this line
 		//Only indent the first line if the previous message ended in \n
-		if( (firstLine && m_lastMessageWasNewline) || !firstLine )
+		if( (firstLine && lastWasNewline) || !firstLine )
 			ret += indent;
 		firstLine = false;
 
 		//Add the line after preprocessing as needed
-		PreprocessLine(tmp);
-		ret += tmp;
+		if(preprocess)
+		{
+			line.assign(p, linelen);
+			PreprocessLine(line);
+			ret += line;
+		}
+		else
+			ret.append(p, linelen);
 
 		//If we're wrapping due to a long line, add a \n to force it
-		if(ch != '\n')
-			ret += "\n";
+		if(forced)
+			ret += '\n';
 
-		//Either way, we're done with the current line
-		tmp = "";
+		p += linelen;
+		len -= linelen;
 	}
 
-	//If we have any remaining stuff, append it
-	if(tmp != "")
-		ret += tmp;
-
 	//Done
 	return ret;
 }
 
+/**
+	@brief Returns true if PreprocessLine() might modify lines
+
+	Only built-in sinks are known not to, anything else is assumed to need every line passed through it.
+ */
+bool LogSink::NeedsPreprocessing()
+{
+	auto type = GetDispatchType();
+	return (type != DISPATCH_STD) && (type != DISPATCH_FILE);
+}
+
+/**
+	@brief Figures out if this sink is exactly one of the built-in types, rather than something derived from one
+ */
+void LogSink::ResolveDispatchType()
+{
+	const type_info* expected = nullptr;
+	switch(m_builtinType)
+	{
+		case DISPATCH_STD:
+			expected = &typeid(STDLogSink);
+			break;
+
+		case DISPATCH_COLORED_STD:
+			expected = &typeid(ColoredSTDLogSink);
+			break;
+
+		case DISPATCH_FILE:
+			expected = &typeid(FILELogSink);
+			break;
+
+		default:
+			break;
+	}
+
+	if(expected && (typeid(*this) == *expected))
+		m_dispatchType = m_builtinType;
+	else
+		m_dispatchType = DISPATCH_VIRTUAL;
+}
+
+/**
+	@brief Prints a trace message, prefixed with the name of the function that logged it
+
+	Sinks that store the function name as a separate field can override this.
+
+	@param function	"class::function" name of the caller
+	@param msg		The formatted message
+ */
+void LogSink::LogTraceMessage(const string& function, const string& msg)
+{
+	//First, print the function name prefix
+	Log(Severity::DEBUG, string("[") + function + "] " + GetIndentString());
+
+	//then the message
+	Log(Severity::DEBUG, msg);
+}
+
 /**
 	@brief Do any processing required to a line before printing it. Nothing in the base class.
  */
@@ -160,6 +472,195 @@ void LogSink::PreprocessLine(string& /*line*/)
 {
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Streaming output of oversized messages
+
+#if defined(_WIN32) || defined(__EMSCRIPTEN__)
+struct LogIOVec
+{
+	void*	iov_base;
+	size_t	iov_len;
+};
+#else
+typedef struct iovec LogIOVec;
+#endif
+
+/**
+	@brief Collects pieces of output and writes them out with as few system calls as possible
+
+	Pieces normally point into the caller's message and are not copied. Lines that had to be modified by
+	PreprocessLine() are handed over with AppendOwned() and kept alive until the next flush.
+ */
+class LogGatherWriter
+{
+public:
+	LogGatherWriter(FILE* fp)
+	: m_fp(fp)
+	, m_count(0)
+	, m_owned(0)
+	{}
+
+	~LogGatherWriter()
+	{ Flush(); }
+
+	void Append(const char* p, size_t len)
+	{
+		if(len == 0)
+			return;
+		if(m_count == MAX_PIECES)
+			Flush();
+		m_pieces[m_count].iov_base = const_cast<char*>(p);
+		m_pieces[m_count].iov_len = len;
+		m_count ++;
+	}
+
+	///@brief Appends a string, taking over its contents (the caller gets back an empty string with spare capacity)
+	void AppendOwned(string& s)
+	{
+		if( (m_count == MAX_PIECES) || (m_owned == MAX_OWNED) )
+			Flush();
+		m_scratch[m_owned].swap(s);
+		s.clear();
+		Append(m_scratch[m_owned].data(), m_scratch[m_owned].size());
+		m_owned ++;
+	}
+
+	void Flush();
+
+protected:
+	static const int MAX_PIECES = 64;
+	static const int MAX_OWNED = 16;
+
+	FILE*		m_fp;
+	LogIOVec	m_pieces[MAX_PIECES];
+	int			m_count;
+	string		m_scratch[MAX_OWNED];
+	int			m_owned;
+};
+
+void LogGatherWriter::Flush()
+{
+	if(m_count == 0)
+		return;
+
+#if defined(_WIN32) || defined(__EMSCRIPTEN__)
+	for(int i=0; i<m_count; i++)
+		fwrite(m_pieces[i].iov_base, 1, m_pieces[i].iov_len, m_fp);
+#else
+	//Anything already sitting in the stdio buffer has to go out first
+	fflush(m_fp);
+
+	int fd = fileno(m_fp);
+	LogIOVec* iov = m_pieces;
+	int n = m_count;
+	while(n > 0)
+	{
+		ssize_t written = writev(fd, iov, n);
+		if(written < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		//Skip whatever went out, writev() may stop partway through a piece
+		size_t left = written;
+		while( (n > 0) && (left >= iov->iov_len) )
+		{
+			left -= iov->iov_len;
+			iov ++;
+			n --;
+		}
+		if(n > 0)
+		{
+			iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+			iov->iov_len -= left;
+		}
+	}
+#endif
+
+	m_count = 0;
+	m_owned = 0;
+}
+
+/**
+	@brief Wraps and writes a long message straight to a file, without building the wrapped copy in memory
+
+	Produces the same output as fputs(WrapString(str).c_str(), fp), except that very long lines are passed through
+	PreprocessLine() in pieces of at most g_logStreamChunkSize bytes. Memory use is bounded regardless of message size.
+ */
+void LogSink::WriteStreamed(FILE* fp, const string& str)
+{
+	string indent = GetIndentString();
+	size_t width = 1;
+	if(m_termWidth > indent.length())
+		width = m_termWidth - indent.length();
+	bool preprocess = NeedsPreprocessing();
+
+	LogGatherWriter writer(fp);
+	string line;
+
+	const char* p = str.c_str();
+	size_t len = str.length();
+	bool firstLine = true;
+	bool endsInNewline = false;
+	while(len > 0)
+	{
+		//Line ends at a \n, the wrap width, or the end of the message
+		size_t span = min(len, width);
+		auto nl = static_cast<const char*>(memchr(p, '\n', span));
+		size_t linelen;
+		bool forced = false;
+		if(nl)
+			linelen = nl - p + 1;
+		else if(span == width)
+		{
+			linelen = width;
+			forced = true;
+		}
+
+		//Trailing text without a newline is printed as-is, same as WrapString()
+		else
+		{
+			writer.Append(p, len);
+			endsInNewline = false;
+			break;
+		}
+
+		//Only indent the first line if the previous message ended in \n
+		if(!firstLine || m_lastMessageWasNewline)
+			writer.Append(indent.c_str(), indent.length());
+		firstLine = false;
+
+		if(preprocess)
+		{
+			for(size_t off = 0; off < linelen; off += g_logStreamChunkSize)
+			{
+				line.assign(p + off, min(g_logStreamChunkSize, linelen - off));
+				PreprocessLine(line);
+				writer.AppendOwned(line);
+			}
+		}
+		else
+			writer.Append(p, linelen);
+
+		//If we're wrapping due to a long line, add a \n to force it
+		if(forced)
+			writer.Append("\n", 1);
+		endsInNewline = true;
+
+		p += linelen;
+		len -= linelen;
+	}
+
+	writer.Flush();
+
+	if(endsInNewline)
+		m_lastMessageWasNewline = true;
+	else if(!str.empty())
+		m_lastMessageWasNewline = false;
+}
+
 
 LogIndenter::LogIndenter()
 {
@@ -220,6 +721,7 @@ bool ParseLoggerArguments(
 			if(sfilter == "::")
 				sfilter = "";
 			g_trace_filters.emplace(sfilter);
+			LogTraceFiltersChanged();
 		}
 		else
 		{
@@ -240,204 +742,2495 @@ bool ParseLoggerArguments(
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Convenience functions that log into all configured sinks
 
-void LogFatal(const char *format, ...)
-{
-	lock_guard<mutex> lock(g_log_mutex);
-
-	string sformat("INTERNAL ERROR: ");
-	sformat += format;
+/**
+	@brief Sends a message to one sink
 
-	va_list va;
-	for(auto &sink : g_log_sinks)
+	With LOGTOOLS_STATIC_DISPATCH defined, the built-in sink types are called directly rather than through the
+	vtable. Sinks of any other type, including classes derived from the built-in ones, use normal virtual dispatch.
+ */
+static inline void LogToSink(LogSink* sink, Severity severity, const string& msg)
+{
+#ifdef LOGTOOLS_STATIC_DISPATCH
+	switch(sink->GetDispatchType())
 	{
-		va_start(va, format);
-		sink->Log(Severity::FATAL, sformat.c_str(), va);
-		va_end(va);
+		case LogSink::DISPATCH_STD:
+		case LogSink::DISPATCH_COLORED_STD:
+			static_cast<STDLogSink*>(sink)->STDLogSink::Log(severity, msg);
+			return;
+
+		case LogSink::DISPATCH_FILE:
+			static_cast<FILELogSink*>(sink)->FILELogSink::Log(severity, msg);
+			return;
 
-		sink->Log(Severity::FATAL,
-			"    This indicates a bug in the program, please file a report via Github\n");
+		default:
+			break;
 	}
+#endif
 
-	abort();
+	sink->Log(severity, msg);
 }
 
-void LogError(const char *format, ...)
-{
-	lock_guard<mutex> lock(g_log_mutex);
+/**
+	@brief Returns true if at least one sink will print messages of the given severity
 
-	string sformat("ERROR: ");
-	sformat += format;
+	Caller must hold g_log_mutex.
+ */
+static bool HasSinksFor(Severity severity)
+{
+	if(static_cast<int>(severity) <= g_logCaptureSeverity)
+		return true;
 
-	va_list va;
 	for(auto &sink : g_log_sinks)
 	{
-		va_start(va, format);
-		sink->Log(Severity::ERROR, sformat.c_str(), va);
-		va_end(va);
+		if(sink->GetSeverity() >= severity)
+			return true;
 	}
+	return false;
 }
 
-void LogWarning(const char *format, ...)
-{
-	lock_guard<mutex> lock(g_log_mutex);
+/**
+	@brief Sends a message to this thread's captures and then (unless a capture consumed it) to every sink
 
-	string sformat("Warning: ");
-	sformat += format;
+	Caller must hold g_log_mutex.
 
-	va_list va;
-	for(auto &sink : g_log_sinks)
+	@param severity			Severity of the message
+	@param msg				The formatted message
+	@param skipConcurrent	True if the concurrent sinks already have the message
+ */
+static void LogToAllSinks(Severity severity, const string& msg, bool skipConcurrent = false)
+{
+	if(g_logCaptureTop && !LogCapture::Capture(severity, "", msg))
+		return;
+
+	for(auto &sink : g_log_sinks)
 	{
-		va_start(va, format);
-		sink->Log(Severity::WARNING, sformat.c_str(), va);
-		va_end(va);
+		if(skipConcurrent && sink->IsConcurrent())
+			continue;
+		LogToSink(sink.get(), severity, msg);
 	}
 }
 
-void LogNotice(const char *format, ...)
+/**
+	@brief Formats a message once and hands the result to every sink
+
+	Caller must hold g_log_mutex.
+ */
+static void LogToSinks(Severity severity, const char* format, va_list va)
 {
-	lock_guard<mutex> lock(g_log_mutex);
+	//Don't waste time formatting if nobody is going to print it
+	if(!HasSinksFor(severity))
+		return;
 
-	va_list va;
-	for(auto &sink : g_log_sinks)
-	{
-		va_start(va, format);
-		sink->Log(Severity::NOTICE, format, va);
-		va_end(va);
-	}
+	string& msg = g_logFormatBuffer;
+	FormatMessage(msg, format, va);
+	LogToAllSinks(severity, msg);
+
+	//Don't let one huge message pin a huge buffer to this thread
+	if(msg.capacity() > g_logStreamThreshold)
+		string().swap(msg);
 }
 
-void LogVerbose(const char *format, ...)
+static void AppendToRegion(Severity severity, uint32_t function, const string& msg, unsigned int indent);
+static void LogDispatch(Severity severity, const string& function, const string& msg);
+
+/**
+	@brief Formats a message and sends it to the sinks, or to the current parallel region's buffer
+
+	Takes g_log_mutex itself, except in a parallel region where it isn't needed, and for concurrent sinks.
+ */
+static void LogMessage(Severity severity, const char* format, va_list va)
 {
-	lock_guard<mutex> lock(g_log_mutex);
+	if(g_logRegionBuffer)
+	{
+		string& msg = g_logFormatBuffer;
+		FormatMessage(msg, format, va);
+		AppendToRegion(severity, 0, msg, g_logIndentLevel);
+		return;
+	}
 
-	va_list va;
-	for(auto &sink : g_log_sinks) {
-		va_start(va, format);
-		sink->Log(Severity::VERBOSE, format, va);
-		va_end(va);
+	if(g_logConcurrentSinkCount.load(memory_order_relaxed))
+	{
+		string& msg = g_logFormatBuffer;
+		FormatMessage(msg, format, va);
+		LogDispatch(severity, "", msg);
+
+		if(msg.capacity() > g_logStreamThreshold)
+			string().swap(msg);
+		return;
 	}
+
+	lock_guard<mutex> lock(g_log_mutex);
+	LogToSinks(severity, format, va);
 }
 
-void LogDebug(const char *format, ...)
+/**
+	@brief Recomputes g_logSeverityCache from the current set of sinks
+ */
+static int UpdateSeverityCache()
 {
 	lock_guard<mutex> lock(g_log_mutex);
 
-	va_list va;
+	int maxsev = 0;
 	for(auto &sink : g_log_sinks)
+		maxsev = max(maxsev, static_cast<int>(sink->GetSeverity()));
+
+	g_logSeverityCache = maxsev;
+	return maxsev;
+}
+
+/**
+	@brief Checks if any sink will print messages of a given severity
+
+	Normally this is a single atomic load, plus a thread-local one if no sink wants the message (in case a LogCapture
+	on this thread does). The answer may be a false positive for a short time after a sink is destroyed, but a sink
+	that has been constructed is always taken into account.
+ */
+bool LogIsEnabled(Severity severity)
+{
+	int cached = g_logSeverityCache.load(memory_order_relaxed);
+	if(cached < 0)
+		cached = UpdateSeverityCache();
+	return (static_cast<int>(severity) <= cached) || (static_cast<int>(severity) <= g_logCaptureSeverity);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Per-site budgets
+
+/**
+	@brief Rate estimate and state of one log site, identified by its format string
+
+	Sites are never destroyed, since threads keep pointers to them in their caches.
+ */
+struct LogBudgetSite
+{
+	///@brief Format string, or file:line for a LOG() statement
+	const char*			format;
+
+	///@brief Severity of the site's messages, and of the notices about it
+	Severity			severity;
+
+	///@brief Messages counted in the current window
+	atomic<uint64_t>	hits{0};
+
+	///@brief Start of the current window, in LogBudgetNow() ms
+	atomic<int64_t>		windowStart{0};
+
+	atomic<bool>		demoted{false};
+
+	///@brief Time of the latest message while demoted, in LogBudgetNow() ms
+	atomic<int64_t>		lastHit{0};
+
+	///@brief Messages held back from the normal sinks since the site was demoted
+	atomic<uint64_t>	held{0};
+};
+
+/**
+	@brief One entry of a thread's cache of sites, with hits not yet added to the site's count
+ */
+struct LogBudgetCacheEntry
+{
+	const char*		format;
+	LogBudgetSite*	site;
+	uint32_t		pending;
+};
+
+///@brief Messages per second a site may log before being demoted, or zero for no limit
+static atomic<uint32_t> g_logSiteBudget(0);
+
+///@brief Most severe level subject to the budget
+static atomic<int> g_logSiteBudgetSeverity(static_cast<int>(Severity::NOTICE));
+
+///@brief Every site seen so far, protected by g_logBudgetMutex and deliberately leaked like the sites
+static mutex g_logBudgetMutex;
+static unordered_map<const char*, LogBudgetSite*>* g_logBudgetSites = nullptr;
+
+///@brief Direct-mapped per-thread cache of sites, so the common case doesn't touch any shared state but the site
+static const size_t g_logBudgetCacheSize = 64;
+static thread_local LogBudgetCacheEntry g_logBudgetCache[g_logBudgetCacheSize];
+
+///@brief Hits a thread accumulates before adding them to the site and checking the rate
+static const uint32_t g_logBudgetBatch = 16;
+
+///@brief Length of the window the rate is measured over, in ms
+static const int64_t g_logBudgetWindow = 1000;
+
+/**
+	@brief Returns the current time in ms, as used for the windows
+
+	Demoted sites read this on every message. On Linux it's the coarse monotonic clock, which costs a few ns where
+	steady_clock costs tens, and whose resolution of a few ms is plenty for one second windows.
+ */
+static int64_t LogBudgetNow()
+{
+#ifdef __linux__
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+#else
+	return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+	@brief Looks up (or creates) the site for a format string and puts it in a cache entry
+ */
+static void LogBudgetCacheMiss(LogBudgetCacheEntry& entry, Severity severity, const char* format)
+{
+	lock_guard<mutex> lock(g_logBudgetMutex);
+	if(!g_logBudgetSites)
+		g_logBudgetSites = new unordered_map<const char*, LogBudgetSite*>;
+
+	auto& site = (*g_logBudgetSites)[format];
+	if(!site)
 	{
-		va_start(va, format);
-		sink->Log(Severity::DEBUG, format, va);
-		va_end(va);
+		site = new LogBudgetSite;
+		site->format = format;
+		site->severity = severity;
 	}
+
+	entry.format = format;
+	entry.site = site;
+	entry.pending = 0;
 }
 
-void LogDebugTrace(const char* function, const char *format, ...)
+/**
+	@brief Returns a site's format string for a notice, without the newline and shortened if it's long
+
+	Both ends are kept, so a long path in a LOG() site still shows the file name and line.
+ */
+static string LogBudgetSiteName(const LogBudgetSite& site)
 {
-	lock_guard<mutex> lock(g_log_mutex);
+	string name(site.format);
+	while(!name.empty() && (name.back() == '\n') )
+		name.pop_back();
+	if(name.length() > 60)
+		name = name.substr(0, 27) + "..." + name.substr(name.length() - 30);
+	return name;
+}
 
-	//Early out (for performance) if we don't have any debug-level sinks
-	bool has_debug_sinks = false;
-	for(auto &sink : g_log_sinks)
+/**
+	@brief Demotes a site, unless another thread just did
+ */
+static void LogBudgetDemote(LogBudgetSite& site, double rate, uint32_t budget, Severity severity)
+{
+	bool expected = false;
+	if(!site.demoted.compare_exchange_strong(expected, true))
+		return;
+	site.lastHit = LogBudgetNow();
+
+	Log(severity, "Demoting log site \"%s\" (%.0f messages/s, budget %u/s) until its rate drops\n",
+		LogBudgetSiteName(site).c_str(), rate, budget);
+}
+
+/**
+	@brief Restores a demoted site, unless another thread just did, and starts a new window
+ */
+static void LogBudgetRestore(LogBudgetSite& site, int64_t now)
+{
+	bool expected = true;
+	if(!site.demoted.compare_exchange_strong(expected, false))
+		return;
+	site.hits = 0;
+	site.windowStart = now;
+
+	Log(site.severity, "Log site \"%s\" is back under budget, %" PRIu64 " messages were held back\n",
+		LogBudgetSiteName(site).c_str(), site.held.exchange(0));
+}
+
+/**
+	@brief Adds hits to a site, demoting it as soon as it goes over budget, and restoring it at the end of a window
+
+	Only the thread that moves the window forward decides whether to restore the site. A site is restored when its
+	rate drops to half the budget, so a site hovering right at the budget doesn't flap.
+ */
+static void LogBudgetUpdate(LogBudgetSite& site, uint32_t hits, uint32_t budget)
+{
+	Severity severity = site.severity;
+	uint64_t total = site.hits.fetch_add(hits, memory_order_relaxed) + hits;
+
+	int64_t now = LogBudgetNow();
+	int64_t start = site.windowStart.load(memory_order_relaxed);
+	if(now - start < g_logBudgetWindow)
 	{
-		if(sink->GetSeverity() >= Severity::DEBUG)
-		{
-			has_debug_sinks = true;
-			break;
-		}
+		//No need to wait for the end of the window to know the site is over budget
+		if( (total > budget) && !site.demoted.load(memory_order_relaxed) )
+			LogBudgetDemote(site, total * 1000.0 / max(now - start, static_cast<int64_t>(1)), budget, severity);
+		return;
 	}
-	if(!has_debug_sinks)
+	if(!site.windowStart.compare_exchange_strong(start, now))
 		return;
 
-	string sfunc(function);
+	double rate = site.hits.exchange(0) * 1000.0 / (now - start);
+	if(!site.demoted && (rate > budget) )
+		LogBudgetDemote(site, rate, budget, severity);
+	else if(site.demoted && (rate <= budget / 2.0) )
+		LogBudgetRestore(site, now);
+}
 
-	//Strip off a "virtual " at the beginning, if present
-	size_t i = 0;
-	string vprefix = "virtual ";
-	if(sfunc.substr(0, vprefix.length()) == vprefix)
-		i = vprefix.length();
+/**
+	@brief Counts a message against its site's budget, returning false if the site is demoted
 
-	//Everything before the next space is the return type... UNLESS we're a constructor
-	//in which case there's no return type
-	size_t ispace = sfunc.find(' ', i);
-	if(ispace == string::npos)
-		return;
-	string rtype = sfunc.substr(i, ispace-i);
-	bool isCtor = false;
-	if(rtype.find('(') != string::npos)
+	This runs before the message is formatted. With no budget set it's two relaxed loads; with one, it's a lookup in
+	a thread-local cache and an increment, plus a shared update every g_logBudgetBatch messages. While the site is
+	demoted, each message also reads the clock: a site that was quiet for a whole window is restored by its first
+	message back, and a busy one has its rate checked as soon as the window is over.
+
+	@param severity	Severity of the message
+	@param format	Format string identifying the site (as passed by the caller, so the pointer is stable)
+ */
+static inline bool LogSiteWithinBudget(Severity severity, const char* format)
+{
+	uint32_t budget = g_logSiteBudget.load(memory_order_relaxed);
+	if( (budget == 0) || (static_cast<int>(severity) < g_logSiteBudgetSeverity.load(memory_order_relaxed)) )
+		return true;
+
+	uintptr_t key = reinterpret_cast<uintptr_t>(format);
+	auto& entry = g_logBudgetCache[(key ^ (key >> 6)) % g_logBudgetCacheSize];
+	if(entry.format != format)
 	{
-		isCtor = true;
-		rtype = "";
+		//Hand the evicted site its pending hits, so sites sharing an entry are still counted
+		if(entry.pending)
+		{
+			uint32_t hits = entry.pending;
+			entry.pending = 0;
+			LogBudgetUpdate(*entry.site, hits, budget);
+		}
+		LogBudgetCacheMiss(entry, severity, format);
 	}
-	else
-		i += rtype.length() + 1;	//skip space after the return type
+	auto& site = *entry.site;
 
-	//Extract class and function name
-	string cls = "";
-	string name = "";
-	size_t icolon = sfunc.find(':', i);
-	size_t iparen = sfunc.find('(', i);
-	if(iparen == string::npos)
-		return;
-	if(isCtor)
+	if(++entry.pending >= g_logBudgetBatch)
 	{
-		if(icolon == string::npos)
-			return;
-		cls = sfunc.substr(i, icolon-i);
-		name = cls;
+		LogBudgetUpdate(site, entry.pending, budget);
+		entry.pending = 0;
 	}
-	else
+
+	if(!site.demoted.load(memory_order_relaxed))
+		return true;
+
+	//Only store the time when it changes, so a flood from several threads doesn't bounce the cache line every message
+	int64_t now = LogBudgetNow();
+	int64_t last = site.lastHit.load(memory_order_relaxed);
+	if(last != now)
+		site.lastHit.store(now, memory_order_relaxed);
+
+	if(now - last >= g_logBudgetWindow)
+		LogBudgetRestore(site, now);
+	else if(now - site.windowStart.load(memory_order_relaxed) >= g_logBudgetWindow)
 	{
-		//Not a constructor. Global or member function.
+		LogBudgetUpdate(site, entry.pending, budget);
+		entry.pending = 0;
+	}
+	if(!site.demoted.load(memory_order_relaxed))
+		return true;
 
-		//If no colon, it's a global.
-		//If colon is after the parenthesis, we're a global taking a class type argument.
-		if( (icolon == string::npos) || (icolon > iparen) )
-		{
-			cls = "";
-			name = sfunc.substr(i, iparen-i);
-		}
+	site.held.fetch_add(1, memory_order_relaxed);
+	return false;
+}
 
-		else
+/**
+	@brief Returns true if a message from a demoted site should be formatted at all
+
+	Without any sink keeping demoted messages this is a single atomic load. Demoted messages logged in a
+	LogParallelRegion are dropped, since the region is replayed to every sink.
+ */
+static bool LogDemotedWanted(Severity severity)
+{
+	if(g_logRegionBuffer)
+		return false;
+
+	int cached = g_logDemotedSeverityCache.load(memory_order_relaxed);
+	if(cached < 0)
+	{
+		lock_guard<mutex> lock(g_log_mutex);
+
+		cached = 0;
+		for(auto& sink : g_log_sinks)
 		{
-			cls = sfunc.substr(i, icolon-i);
-			name = sfunc.substr(icolon+2, iparen-(icolon+2));
+			if(sink->GetKeepsDemoted())
+				cached = max(cached, static_cast<int>(sink->GetSeverity()));
 		}
+		g_logDemotedSeverityCache = cached;
 	}
+	return static_cast<int>(severity) <= cached;
+}
 
-	//Format final function name
-	sfunc = cls + "::" + name;
+/**
+	@brief Sends a formatted message from a demoted site to the sinks that keep demoted messages
 
-	//Check if class or function name is in the "to log" list
-	if(cls == "")
+	Must be called with g_log_mutex held.
+ */
+static void LogDemotedToSinks(Severity severity, const string& msg)
+{
+	for(auto& sink : g_log_sinks)
 	{
-		if(g_trace_filters.find(sfunc) == g_trace_filters.end())
-			return;
+		if(sink->GetKeepsDemoted() && (sink->GetSeverity() >= severity) )
+			LogToSink(sink.get(), severity, msg);
 	}
-	else if(g_trace_filters.find(cls) == g_trace_filters.end())
+}
+
+/**
+	@brief Sends a message from a demoted site to the sinks that keep demoted messages
+ */
+static void LogDemotedMessage(Severity severity, const char* format, va_list va)
+{
+	if(!LogDemotedWanted(severity))
 		return;
 
+	lock_guard<mutex> lock(g_log_mutex);
+
+	string& msg = g_logFormatBuffer;
+	FormatMessage(msg, format, va);
+	LogDemotedToSinks(severity, msg);
+
+	if(msg.capacity() > g_logStreamThreshold)
+		string().swap(msg);
+}
+
+/**
+	@brief Logs a message normally, or only to the sinks keeping demoted messages if its site is over budget
+
+	@param severity	Severity of the message
+	@param site		Format string as passed by the caller, identifying the site
+	@param format	Format string to print, which may have a prefix added to site
+	@param va		Arguments of the message
+ */
+static void LogBudgetedMessage(Severity severity, const char* site, const char* format, va_list va)
+{
+	if(LogSiteWithinBudget(severity, site))
+		LogMessage(severity, format, va);
+	else
+		LogDemotedMessage(severity, format, va);
+}
+
+/**
+	@brief Limits how fast any one log site may log, demoting sites that go over the limit
+
+	A site is a format string passed to LogNotice(), LogVerbose(), LogDebug() or Log(), or a LOG() statement (and
+	LogWarning() or LOG(WARNING) if mostSevere allows). Each site's rate is measured over one second windows. A site over budget is demoted: a
+	notice says so, and its messages only go to sinks that keep demoted messages (SHMLogSink rings, by default; see
+	LogSink::SetKeepsDemoted()) until its rate drops to half the budget, when another notice says how many were
+	held back. Errors are never demoted.
+
+	@param messagesPerSecond	Budget of each site, or zero to turn this off (the default)
+	@param mostSevere			Most severe level the budget applies to, at most Severity::WARNING
+ */
+void LogSetSiteBudget(unsigned int messagesPerSecond, Severity mostSevere)
+{
+	int sev = max(static_cast<int>(mostSevere), static_cast<int>(Severity::WARNING));
+	g_logSiteBudgetSeverity = sev;
+	g_logSiteBudget = messagesPerSecond;
+}
+
+///@brief Set by LogEnableErrorSummary()
+static atomic<bool> g_logErrorSummaryEnabled(false);
+
+static void LogSummarizeMessage(Severity severity, const char* prefix, const char* format, void* caller, va_list va);
+static void LogSummaryRecord(Severity severity, const char* format, void* caller, const string& msg, size_t start);
+
+#ifdef _MSC_VER
+#define LOG_CALLER _ReturnAddress()
+#else
+#define LOG_CALLER __builtin_return_address(0)
+#endif
+
+void LogFatal(const char *format, ...)
+{
+	lock_guard<mutex> lock(g_log_mutex);
+
+	string sformat("INTERNAL ERROR: ");
+	sformat += format;
+
 	va_list va;
-	for(auto &sink : g_log_sinks)
-	{
-		//First, print the function name prefix
-		sink->Log(Severity::DEBUG, string("[") + sfunc + "] " + sink->GetIndentString());
+	va_start(va, format);
+	LogToSinks(Severity::FATAL, sformat.c_str(), va);
+	va_end(va);
+
+	LogToAllSinks(Severity::FATAL, "    This indicates a bug in the program, please file a report via Github\n");
 
-		//then the message
+	abort();
+}
+
+void LogError(const char *format, ...)
+{
+	va_list va;
+	if(g_logErrorSummaryEnabled.load(memory_order_relaxed))
+	{
 		va_start(va, format);
-		sink->Log(Severity::DEBUG, format, va);
+		LogSummarizeMessage(Severity::ERROR, "ERROR: ", format, LOG_CALLER, va);
 		va_end(va);
+		return;
 	}
+
+	if(!LogIsEnabled(Severity::ERROR))
+		return;
+
+	string sformat("ERROR: ");
+	sformat += format;
+
+	va_start(va, format);
+	LogMessage(Severity::ERROR, sformat.c_str(), va);
+	va_end(va);
 }
 
-void Log(Severity severity, const char *format, ...)
+void LogWarning(const char *format, ...)
 {
-	lock_guard<mutex> lock(g_log_mutex);
-
 	va_list va;
-	for(auto &sink : g_log_sinks)
+	if(g_logErrorSummaryEnabled.load(memory_order_relaxed))
 	{
 		va_start(va, format);
-		sink->Log(severity, format, va);
+		LogSummarizeMessage(Severity::WARNING, "Warning: ", format, LOG_CALLER, va);
 		va_end(va);
+		return;
 	}
+
+	if(!LogIsEnabled(Severity::WARNING))
+		return;
+
+	string sformat("Warning: ");
+	sformat += format;
+
+	va_start(va, format);
+	LogBudgetedMessage(Severity::WARNING, format, sformat.c_str(), va);
+	va_end(va);
+}
+
+void LogNotice(const char *format, ...)
+{
+	if(!LogIsEnabled(Severity::NOTICE))
+		return;
+
+	va_list va;
+	va_start(va, format);
+	LogBudgetedMessage(Severity::NOTICE, format, format, va);
+	va_end(va);
+}
+
+void LogVerbose(const char *format, ...)
+{
+	if(!LogIsEnabled(Severity::VERBOSE))
+		return;
+
+	va_list va;
+	va_start(va, format);
+	LogBudgetedMessage(Severity::VERBOSE, format, format, va);
+	va_end(va);
+}
+
+void LogDebug(const char *format, ...)
+{
+	if(!LogIsEnabled(Severity::DEBUG))
+		return;
+
+	va_list va;
+	va_start(va, format);
+	LogBudgetedMessage(Severity::DEBUG, format, format, va);
+	va_end(va);
+}
+
+/**
+	@brief Parsed form of a function name passed to LogDebugTrace()
+ */
+struct LogTraceSite
+{
+	///@brief Full decorated name, to detect a call site pointer being reused for a different string
+	string	function;
+
+	///@brief Class name, or empty for a global function
+	string	cls;
+
+	///@brief "class::function" name
+	string	name;
+
+	///@brief Interned ID of name
+	uint32_t	id;
+
+	///@brief False if the name couldn't be parsed, in which case nothing is ever printed
+	bool	valid;
+};
+
+/**
+	@brief Cache of parsed trace call sites, keyed by the address of the __PRETTY_FUNCTION__ string
+
+	Protected by g_log_mutex.
+ */
+static unordered_map<const char*, LogTraceSite> g_logTraceSites;
+
+/**
+	@brief Extracts "class::function" from a __PRETTY_FUNCTION__ string
+ */
+static void ParseTraceSite(const char* function, LogTraceSite& site)
+{
+	string sfunc(function);
+	site.function = sfunc;
+	site.valid = false;
+
+	//Strip off a "virtual " at the beginning, if present
+	size_t i = 0;
+	string vprefix = "virtual ";
+	if(sfunc.substr(0, vprefix.length()) == vprefix)
+		i = vprefix.length();
+
+	//Everything before the next space is the return type... UNLESS we're a constructor
+	//in which case there's no return type
+	size_t ispace = sfunc.find(' ', i);
+	if(ispace == string::npos)
+		return;
+	string rtype = sfunc.substr(i, ispace-i);
+	bool isCtor = false;
+	if(rtype.find('(') != string::npos)
+	{
+		isCtor = true;
+		rtype = "";
+	}
+	else
+		i += rtype.length() + 1;	//skip space after the return type
+
+	//Extract class and function name
+	string cls = "";
+	string name = "";
+	size_t icolon = sfunc.find(':', i);
+	size_t iparen = sfunc.find('(', i);
+	if(iparen == string::npos)
+		return;
+	if(isCtor)
+	{
+		if(icolon == string::npos)
+			return;
+		cls = sfunc.substr(i, icolon-i);
+		name = cls;
+	}
+	else
+	{
+		//Not a constructor. Global or member function.
+
+		//If no colon, it's a global.
+		//If colon is after the parenthesis, we're a global taking a class type argument.
+		if( (icolon == string::npos) || (icolon > iparen) )
+		{
+			cls = "";
+			name = sfunc.substr(i, iparen-i);
+		}
+
+		else
+		{
+			cls = sfunc.substr(i, icolon-i);
+			name = sfunc.substr(icolon+2, iparen-(icolon+2));
+		}
+	}
+
+	//Format final function name
+	site.cls = cls;
+	site.name = cls + "::" + name;
+	site.id = LogInternString(site.name);
+	site.valid = true;
+}
+
+/**
+	@brief Checks a parsed call site against the trace filters
+ */
+static bool TraceFiltersMatch(const LogTraceSite& site)
+{
+	if(!site.valid)
+		return false;
+	if(site.cls == "")
+		return g_trace_filters.find(site.name) != g_trace_filters.end();
+	return g_trace_filters.find(site.cls) != g_trace_filters.end();
+}
+
+/**
+	@brief Checks a function name against the trace filters
+
+	Parsing __PRETTY_FUNCTION__ is only done the first time each call site is seen.
+
+	Caller must hold g_log_mutex.
+
+	@param function	Decorated function name
+
+	@return The call site if trace messages from this function should be printed, otherwise null
+ */
+static const LogTraceSite* GetTraceSite(const char* function)
+{
+	//Look up the call site, verifying the pointer still refers to the same string
+	auto it = g_logTraceSites.find(function);
+	if( (it == g_logTraceSites.end()) || (it->second.function != function) )
+	{
+		//Callers passing dynamically built names could grow this without bound
+		if(g_logTraceSites.size() > 4096)
+			g_logTraceSites.clear();
+
+		auto& site = g_logTraceSites[function];
+		ParseTraceSite(function, site);
+		it = g_logTraceSites.find(function);
+	}
+	auto& site = it->second;
+	if(!TraceFiltersMatch(site))
+		return nullptr;
+	return &site;
+}
+
+/**
+	@brief Makes every LogTraceSiteCache check g_trace_filters again
+ */
+void LogTraceFiltersChanged()
+{
+	g_logTraceGeneration.fetch_add(1, memory_order_release);
+}
+
+/**
+	@brief Checks a call site against the trace filters, without taking g_log_mutex
+
+	The answer is kept in the call site's cache until LogTraceFiltersChanged() is next called, so this is normally two
+	atomic loads. Racing threads may both parse the name, but they store the same answer.
+
+	@param cache	The call site's cache
+	@param function	Decorated function name
+
+	@return Interned "class::function" name of the site if its trace messages should be printed, otherwise 0
+ */
+uint32_t LogTraceSiteID(LogTraceSiteCache& cache, const char* function)
+{
+	uint32_t generation = g_logTraceGeneration.load(memory_order_acquire);
+	uint64_t state = cache.state.load(memory_order_relaxed);
+	if( (state != 0) && ( (state >> 32) == generation) )
+		return static_cast<uint32_t>(state);
+
+	LogTraceSite site;
+	ParseTraceSite(function, site);
+	uint32_t id = TraceFiltersMatch(site) ? site.id : 0;
+	cache.state.store( (static_cast<uint64_t>(generation) << 32) | id, memory_order_relaxed);
+	return id;
+}
+
+/**
+	@brief Checks if a trace message from a call site would be printed. Used by LOG_TRACE() and LogTraceLazy().
+
+	Never takes g_log_mutex.
+ */
+bool LogTraceIsEnabled(LogTraceSiteCache& cache, const char* function)
+{
+	return LogIsEnabled(Severity::DEBUG) && (LogTraceSiteID(cache, function) != 0);
+}
+
+/**
+	@brief Sends an already formatted trace message to every sink, prefixed with the function name
+
+	Caller must hold g_log_mutex.
+
+	@param sfunc			"class::function" name of the caller
+	@param msg				The formatted message
+	@param skipConcurrent	True if the concurrent sinks already have the message
+ */
+static void LogTraceToSinks(const string& sfunc, const string& msg, bool skipConcurrent = false)
+{
+	if(g_logCaptureTop && !LogCapture::Capture(Severity::DEBUG, sfunc, msg))
+		return;
+
+	for(auto &sink : g_log_sinks)
+	{
+		if(skipConcurrent && sink->IsConcurrent())
+			continue;
+
+#ifdef LOGTOOLS_STATIC_DISPATCH
+		if(sink->GetDispatchType() != LogSink::DISPATCH_VIRTUAL)
+		{
+			//First, print the function name prefix
+			LogToSink(sink.get(), Severity::DEBUG, string("[") + sfunc + "] " + sink->GetIndentString());
+
+			//then the message
+			LogToSink(sink.get(), Severity::DEBUG, msg);
+			continue;
+		}
+#endif
+
+		sink->LogTraceMessage(sfunc, msg);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Concurrent sinks
+
+/**
+	@brief One thread's view of g_log_sinks, so concurrent sinks can be called without g_log_mutex
+
+	Retaken under g_log_mutex whenever g_logSinkGeneration changes. The thread holds lock while it calls the sinks, so
+	LogSink::WaitForConcurrentCalls() can wait for it to be done with a sink that is being destroyed.
+ */
+struct LogSinkSnapshot
+{
+	LogSinkSnapshot();
+	~LogSinkSnapshot();
+
+	mutex lock;
+
+	///@brief g_logSinkGeneration when the snapshot was taken
+	uint64_t generation = 0;
+
+	///@brief True if some sink wasn't in g_log_sinks yet (constructed but not added), so it has to be retaken
+	bool incomplete = true;
+
+	///@brief The concurrent sinks in g_log_sinks
+	vector<LogSink*> sinks;
+
+	///@brief Highest severity printed by any other sink, or -1 if there are none
+	int lockedSeverity = -1;
+};
+
+/**
+	@brief Every thread's snapshot (never freed, so it outlives the threads' own thread_local destructors)
+ */
+static vector<LogSinkSnapshot*>* g_logSinkSnapshots = nullptr;
+
+/**
+	@brief Protects g_logSinkSnapshots
+ */
+static mutex g_logSinkSnapshotsMutex;
+
+static thread_local LogSinkSnapshot g_logSinkSnapshot;
+
+LogSinkSnapshot::LogSinkSnapshot()
+{
+	lock_guard<mutex> lock(g_logSinkSnapshotsMutex);
+	if(!g_logSinkSnapshots)
+		g_logSinkSnapshots = new vector<LogSinkSnapshot*>;
+	g_logSinkSnapshots->push_back(this);
+}
+
+LogSinkSnapshot::~LogSinkSnapshot()
+{
+	lock_guard<mutex> lock(g_logSinkSnapshotsMutex);
+	auto& v = *g_logSinkSnapshots;
+	v.erase(find(v.begin(), v.end(), this));
+}
+
+/**
+	@brief Marks the sink as doing its own locking
+
+	Call from the constructor. Messages are then sent to the sink straight from each logging thread without taking
+	g_log_mutex, so several threads may be in Log() or LogTraceMessage() at once, alongside calls made under
+	g_log_mutex (from LogBatch, summaries and so on). Only the sinks that aren't concurrent are still called under
+	the lock, and only if one of them wants the message. Like any sink, a concurrent sink must not log itself.
+
+	The destructor of a concurrent sink must call WaitForConcurrentCalls() before tearing anything down.
+ */
+void LogSink::SetConcurrent()
+{
+	if(m_concurrent)
+		return;
+
+	m_concurrent = true;
+	ResolveDispatchType();
+	g_logConcurrentSinkCount ++;
+	g_logSinkGeneration ++;
+}
+
+/**
+	@brief Stops new calls to a concurrent sink and waits for calls already in progress on other threads to return
+ */
+void LogSink::WaitForConcurrentCalls()
+{
+	g_logSinkGeneration ++;
+
+	//Any thread that takes its lock after we release it sees the new generation, and retakes its snapshot
+	lock_guard<mutex> lock(g_logSinkSnapshotsMutex);
+	if(!g_logSinkSnapshots)
+		return;
+	for(auto snap : *g_logSinkSnapshots)
+		lock_guard<mutex> wait(snap->lock);
+}
+
+/**
+	@brief Sends a message to every sink, calling concurrent sinks from this thread without g_log_mutex
+
+	g_log_mutex is only taken if a sink that isn't concurrent wants the message, or a LogCapture on this thread has to
+	see it first.
+
+	@param severity	Severity of the message
+	@param function	"class::function" name for trace messages, empty for anything else
+	@param msg		The formatted message
+ */
+static void LogDispatch(Severity severity, const string& function, const string& msg)
+{
+	if(!g_logCaptureTop)
+	{
+		auto& snap = g_logSinkSnapshot;
+		int lockedSeverity;
+		while(true)
+		{
+			if(snap.incomplete || (snap.generation != g_logSinkGeneration.load()) )
+			{
+				lock_guard<mutex> lock(g_log_mutex);
+				lock_guard<mutex> snaplock(snap.lock);
+				snap.generation = g_logSinkGeneration.load();
+				snap.sinks.clear();
+				snap.lockedSeverity = -1;
+				for(auto& sink : g_log_sinks)
+				{
+					if(sink->IsConcurrent())
+						snap.sinks.push_back(sink.get());
+					else
+						snap.lockedSeverity = max(snap.lockedSeverity, static_cast<int>(sink->GetSeverity()));
+				}
+				snap.incomplete = (g_log_sinks.size() < g_logSinkCount.load());
+			}
+
+			lock_guard<mutex> lock(snap.lock);
+			if(snap.generation != g_logSinkGeneration.load())
+				continue;
+
+			for(auto sink : snap.sinks)
+			{
+				if(function.empty())
+					sink->Log(severity, msg);
+				else
+					sink->LogTraceMessage(function, msg);
+			}
+			lockedSeverity = snap.lockedSeverity;
+			break;
+		}
+
+		if(static_cast<int>(severity) > lockedSeverity)
+			return;
+
+		lock_guard<mutex> lock(g_log_mutex);
+		if(function.empty())
+			LogToAllSinks(severity, msg, true);
+		else
+			LogTraceToSinks(function, msg, true);
+		return;
+	}
+
+	lock_guard<mutex> lock(g_log_mutex);
+	if(function.empty())
+		LogToAllSinks(severity, msg);
+	else
+		LogTraceToSinks(function, msg);
+}
+
+/**
+	@brief Checks if a message of a given severity from a given function would be printed
+
+	For DEBUG severity, the function's class is also checked against the trace filters. Parsing of the function name
+	is cached, but the cache is shared and takes g_log_mutex. LOG_TRACE() and LogTraceLazy() use LogTraceIsEnabled()
+	instead, which doesn't.
+
+	@param severity	Severity of the message
+	@param function	Decorated name of the calling function, normally __PRETTY_FUNCTION__
+ */
+bool LogIsEnabled(Severity severity, const char* function)
+{
+	if(!LogIsEnabled(severity))
+		return false;
+	if(severity != Severity::DEBUG)
+		return true;
+
+	lock_guard<mutex> lock(g_log_mutex);
+	return GetTraceSite(function) != nullptr;
+}
+
+void LogDebugTrace(const char* function, const char *format, ...)
+{
+	//Early out (for performance) if we don't have any debug-level sinks
+	if(!LogIsEnabled(Severity::DEBUG))
+		return;
+
+	unique_lock<mutex> lock(g_log_mutex);
+
+	if(!HasSinksFor(Severity::DEBUG))
+		return;
+
+	auto site = GetTraceSite(function);
+	if(!site)
+		return;
+
+	va_list va;
+	string& msg = g_logFormatBuffer;
+
+	//In a parallel region we only needed the lock for the trace filters
+	if(g_logRegionBuffer)
+	{
+		uint32_t id = site->id;
+		lock.unlock();
+
+		va_start(va, format);
+		FormatMessage(msg, format, va);
+		va_end(va);
+		AppendToRegion(Severity::DEBUG, id, msg, g_logIndentLevel);
+		return;
+	}
+
+	//Concurrent sinks are called without the lock, which was only needed for the trace filters
+	if(g_logConcurrentSinkCount.load(memory_order_relaxed))
+	{
+		string name = site->name;
+		lock.unlock();
+
+		va_start(va, format);
+		FormatMessage(msg, format, va);
+		va_end(va);
+		LogDispatch(Severity::DEBUG, name, msg);
+	}
+	else
+	{
+		va_start(va, format);
+		FormatMessage(msg, format, va);
+		va_end(va);
+
+		LogTraceToSinks(site->name, msg);
+	}
+
+	if(msg.capacity() > g_logStreamThreshold)
+		string().swap(msg);
+}
+
+/**
+	@brief Prints a trace message from a call site with its own LogTraceSiteCache, as LogTrace() does
+
+	Only printing to sinks that aren't concurrent takes g_log_mutex; the filter check doesn't.
+ */
+void LogDebugTrace(LogTraceSiteCache& cache, const char* function, const char *format, ...)
+{
+	if(!LogIsEnabled(Severity::DEBUG))
+		return;
+	uint32_t id = LogTraceSiteID(cache, function);
+	if(!id)
+		return;
+
+	string& msg = g_logFormatBuffer;
+	va_list va;
+	va_start(va, format);
+	FormatMessage(msg, format, va);
+	va_end(va);
+
+	if(g_logRegionBuffer)
+		AppendToRegion(Severity::DEBUG, id, msg, g_logIndentLevel);
+	else
+	{
+		string name(LogGetInternedString(id));
+		if(g_logConcurrentSinkCount.load(memory_order_relaxed))
+			LogDispatch(Severity::DEBUG, name, msg);
+		else
+		{
+			lock_guard<mutex> lock(g_log_mutex);
+			LogTraceToSinks(name, msg);
+		}
+	}
+
+	if(msg.capacity() > g_logStreamThreshold)
+		string().swap(msg);
+}
+
+void Log(Severity severity, const char *format, ...)
+{
+	if(!LogIsEnabled(severity))
+		return;
+
+	va_list va;
+	va_start(va, format);
+	LogBudgetedMessage(severity, format, format, va);
+	va_end(va);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Batched output
+
+/**
+	@brief Text of a LogBatch, plus where each line starts and how far it's indented
+ */
+struct LogBatchBuffer
+{
+	struct Line
+	{
+		size_t			offset;
+		unsigned int	indent;
+	};
+
+	string			text;
+	vector<Line>	lines;
+};
+
+/**
+	@brief Per-thread pool of batch buffers, so building a batch doesn't allocate once the pool is warm
+ */
+static thread_local vector<unique_ptr<LogBatchBuffer>> g_logBatchPool;
+
+LogBatch::LogBatch(Severity severity)
+	: m_severity(severity)
+	, m_indent(0)
+{
+	if(g_logBatchPool.empty())
+		m_buffer = new LogBatchBuffer;
+	else
+	{
+		m_buffer = g_logBatchPool.back().release();
+		g_logBatchPool.pop_back();
+	}
+}
+
+LogBatch::~LogBatch()
+{
+	Commit();
+
+	//Return the buffer to the pool, unless an oversized batch grew it out of proportion
+	if(m_buffer->text.capacity() > g_logStreamThreshold)
+		delete m_buffer;
+	else
+		g_logBatchPool.emplace_back(m_buffer);
+}
+
+/**
+	@brief Formats a line and appends it to the batch
+
+	As with LogNotice() etc, the format string should include the trailing newline.
+ */
+void LogBatch::Add(const char* format, ...)
+{
+	m_buffer->lines.push_back({m_buffer->text.length(), g_logIndentLevel + m_indent});
+
+	va_list va;
+	va_start(va, format);
+	FormatMessage(m_buffer->text, format, va, m_buffer->text.length());
+	va_end(va);
+}
+
+/**
+	@brief Sends everything added so far to the sinks and empties the batch
+
+	All lines are printed under a single acquisition of g_log_mutex, so they can't be interleaved with output from
+	other threads. Each run of consecutive lines at the same indentation level is passed to every sink as one message.
+ */
+void LogBatch::Commit()
+{
+	auto& buf = *m_buffer;
+	if(buf.lines.empty())
+		return;
+
+	if(g_logRegionBuffer)
+	{
+		//Each line goes to the parallel region's buffer with its own indentation
+		size_t nlines = buf.lines.size();
+		for(size_t i=0; i<nlines; i++)
+		{
+			size_t end = (i+1 < nlines) ? buf.lines[i+1].offset : buf.text.length();
+			AppendToRegion(m_severity, 0, buf.text.substr(buf.lines[i].offset, end - buf.lines[i].offset),
+				buf.lines[i].indent);
+		}
+	}
+
+	else
+	{
+		lock_guard<mutex> lock(g_log_mutex);
+
+		if(HasSinksFor(m_severity))
+		{
+			unsigned int oldIndent = g_logIndentLevel;
+
+			size_t nlines = buf.lines.size();
+			size_t i = 0;
+			while(i < nlines)
+			{
+				//Find the end of this run of lines
+				size_t j = i + 1;
+				while( (j < nlines) && (buf.lines[j].indent == buf.lines[i].indent) )
+					j ++;
+				size_t start = buf.lines[i].offset;
+				size_t end = (j < nlines) ? buf.lines[j].offset : buf.text.length();
+
+				//Common case: the whole batch is one run and can go out without copying
+				g_logIndentLevel = buf.lines[i].indent;
+				if( (start == 0) && (end == buf.text.length()) )
+					LogToAllSinks(m_severity, buf.text);
+				else
+				{
+					string& run = g_logFormatBuffer;
+					run.assign(buf.text, start, end - start);
+					LogToAllSinks(m_severity, run);
+				}
+
+				i = j;
+			}
+
+			g_logIndentLevel = oldIndent;
+		}
+	}
+
+	buf.text.clear();
+	buf.lines.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stream-style output
+
+/**
+	@brief Stream buffer that writes straight into a reusable std::string
+ */
+class LogStringBuf : public streambuf
+{
+public:
+	LogStringBuf()
+	{
+		m_text.resize(256);
+		Reset();
+	}
+
+	///@brief Discards the current message, keeping the allocated space
+	void Reset()
+	{
+		m_text.resize(m_text.capacity());
+		setp(&m_text[0], &m_text[0] + m_text.size());
+	}
+
+	///@brief Trims the string down to what has been written and returns it
+	string& Finish()
+	{
+		m_text.resize(pptr() - pbase());
+		return m_text;
+	}
+
+	size_t GetCapacity()
+	{ return m_text.capacity(); }
+
+protected:
+	int_type overflow(int_type ch) override
+	{
+		//Out of space, double the buffer
+		size_t len = pptr() - pbase();
+		m_text.resize(m_text.size() * 2);
+		setp(&m_text[0], &m_text[0] + m_text.size());
+		pbump(len);
+
+		if(!traits_type::eq_int_type(ch, traits_type::eof()))
+		{
+			*pptr() = traits_type::to_char_type(ch);
+			pbump(1);
+		}
+		return traits_type::not_eof(ch);
+	}
+
+	string m_text;
+};
+
+/**
+	@brief An ostream and its buffer, recycled between messages
+ */
+struct LogStreamBuffer
+{
+	LogStreamBuffer()
+	: stream(&buf)
+	{}
+
+	LogStringBuf	buf;
+	ostream			stream;
+};
+
+/**
+	@brief Per-thread pool of stream buffers
+
+	Normally only one is in use at a time, but an operator<< that itself logs needs a second.
+ */
+static thread_local vector<unique_ptr<LogStreamBuffer>> g_logStreamPool;
+
+/**
+	@brief Returns true if a LOG() message should be built: some sink prints it, or the error summary counts it
+ */
+bool LogStreamIsEnabled(Severity severity)
+{
+	if(LogIsEnabled(severity))
+		return true;
+	return ( (severity == Severity::ERROR) || (severity == Severity::WARNING) ) &&
+		g_logErrorSummaryEnabled.load(memory_order_relaxed);
+}
+
+/**
+	@brief Starts a new stream-style message
+
+	@param severity	Severity of the message
+	@param function	For trace messages, the __PRETTY_FUNCTION__ of the caller. Null for everything else.
+	@param site		String literal identifying the LOG() statement for LogSetSiteBudget(), or null if not budgeted
+ */
+LogStream::LogStream(Severity severity, const char* function, const char* site)
+	: m_severity(severity)
+	, m_function(function)
+	, m_traceID(0)
+	, m_site(site ? site : "LOG()")
+	, m_caller(LOG_CALLER)
+	, m_summarized( ( (severity == Severity::ERROR) || (severity == Severity::WARNING) ) && !function &&
+		g_logErrorSummaryEnabled.load(memory_order_relaxed))
+	, m_demoted(site && !m_summarized && !LogSiteWithinBudget(severity, site))
+{
+	if(g_logStreamPool.empty())
+		m_buffer = new LogStreamBuffer;
+	else
+	{
+		m_buffer = g_logStreamPool.back().release();
+		g_logStreamPool.pop_back();
+	}
+
+	//Same prefixes as LogFatal() etc
+	auto& s = m_buffer->stream;
+	switch(severity)
+	{
+		case Severity::FATAL:
+			s << "INTERNAL ERROR: ";
+			break;
+
+		case Severity::ERROR:
+			s << "ERROR: ";
+			break;
+
+		case Severity::WARNING:
+			s << "Warning: ";
+			break;
+
+		default:
+			break;
+	}
+
+	//Nothing will print it, so make every << a no-op rather than formatting text to throw away
+	if(m_demoted && !LogDemotedWanted(severity))
+		s.setstate(ios_base::badbit);
+}
+
+/**
+	@brief Starts a new trace message from LOG_TRACE(), checking the trace filters through the call site's cache
+
+	@param cache	The call site's cache
+	@param function	The __PRETTY_FUNCTION__ of the caller
+ */
+LogStream::LogStream(LogTraceSiteCache& cache, const char* function)
+	: LogStream(Severity::DEBUG, function)
+{
+	m_traceID = LogTraceSiteID(cache, function);
+}
+
+/**
+	@brief Prints the message, adding a trailing newline if it doesn't already end in one
+ */
+LogStream::~LogStream()
+{
+	bool discard = m_buffer->stream.bad();
+	string& msg = m_buffer->buf.Finish();
+	if(msg.empty() || (msg[msg.length() - 1] != '\n'))
+		msg += '\n';
+
+	if( (g_logMaxMessageSize != 0) && (msg.length() > g_logMaxMessageSize) )
+	{
+		size_t omitted = msg.length() - g_logMaxMessageSize;
+		msg.resize(g_logMaxMessageSize);
+		AppendTruncationMarker(msg, omitted);
+	}
+
+	if(m_summarized)
+	{
+		size_t prefix = strlen( (m_severity == Severity::ERROR) ? "ERROR: " : "Warning: ");
+		LogSummaryRecord(m_severity, m_site, m_caller, msg, prefix);
+		if(!LogIsEnabled(m_severity))
+			discard = true;
+	}
+
+	//Trace messages not from LOG_TRACE() look up their call site under the lock
+	uint32_t traceID = m_traceID;
+	if(m_function && !traceID && !discard)
+	{
+		lock_guard<mutex> lock(g_log_mutex);
+		const LogTraceSite* site = nullptr;
+		if(HasSinksFor(Severity::DEBUG))
+			site = GetTraceSite(m_function);
+		if(site)
+			traceID = site->id;
+	}
+	if(m_function && !traceID)
+		discard = true;
+
+	//A discarded message was only wanted by the error summary, or nothing keeps demoted messages
+	if(m_demoted || discard)
+	{
+		if(!discard)
+		{
+			lock_guard<mutex> lock(g_log_mutex);
+			LogDemotedToSinks(m_severity, msg);
+		}
+	}
+
+	else if(g_logRegionBuffer && (m_severity != Severity::FATAL) )
+	{
+		if(m_function)
+			AppendToRegion(Severity::DEBUG, traceID, msg, g_logIndentLevel);
+		else
+			AppendToRegion(m_severity, 0, msg, g_logIndentLevel);
+	}
+
+	//Concurrent sinks are called without the lock
+	else if(g_logConcurrentSinkCount.load(memory_order_relaxed) && (m_severity != Severity::FATAL) )
+	{
+		if(m_function)
+			LogDispatch(Severity::DEBUG, string(LogGetInternedString(traceID)), msg);
+		else
+			LogDispatch(m_severity, "", msg);
+	}
+
+	else
+	{
+		lock_guard<mutex> lock(g_log_mutex);
+
+		if(m_function)
+			LogTraceToSinks(string(LogGetInternedString(traceID)), msg);
+		else
+			LogToAllSinks(m_severity, msg);
+
+		if(m_severity == Severity::FATAL)
+		{
+			LogToAllSinks(Severity::FATAL, "    This indicates a bug in the program, please file a report via Github\n");
+			abort();
+		}
+	}
+
+	//Reset formatting state so the next message starts clean, then return the buffer to the pool
+	auto& s = m_buffer->stream;
+	s.clear();
+	s.flags(ios_base::dec | ios_base::skipws);
+	s.precision(6);
+	s.width(0);
+	s.fill(' ');
+	m_buffer->buf.Reset();
+
+	if(m_buffer->buf.GetCapacity() > g_logStreamThreshold)
+		delete m_buffer;
+	else
+		g_logStreamPool.emplace_back(m_buffer);
+}
+
+ostream& LogStream::stream()
+{
+	return m_buffer->stream;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scoped capture
+
+/**
+	@brief Starts capturing this thread's messages
+
+	@param min_severity	Least severe level to capture
+	@param propagate	True to also pass captured messages on to enclosing captures and the sinks, false to keep
+						them to this capture only
+ */
+LogCapture::LogCapture(Severity min_severity, bool propagate)
+	: m_severity(min_severity)
+	, m_propagate(propagate)
+	, m_parent(g_logCaptureTop)
+	, m_savedSeverity(g_logCaptureSeverity)
+{
+	g_logCaptureTop = this;
+	g_logCaptureSeverity = max(g_logCaptureSeverity, static_cast<int>(min_severity));
+}
+
+LogCapture::~LogCapture()
+{
+	g_logCaptureTop = m_parent;
+	g_logCaptureSeverity = m_savedSeverity;
+
+	if(m_onComplete)
+		m_onComplete(*this);
+}
+
+/**
+	@brief Records a message in this thread's captures, innermost first
+
+	Called by the logging functions with g_log_mutex held.
+
+	@return True if the message should also go to the sinks
+ */
+bool LogCapture::Capture(Severity severity, const string& function, const string& msg)
+{
+	for(auto c = g_logCaptureTop; c; c = c->m_parent)
+	{
+		if(severity <= c->m_severity)
+			c->m_records.push_back(Record{severity, g_logIndentLevel, function, msg});
+		if(!c->m_propagate)
+			return false;
+	}
+	return true;
+}
+
+/**
+	@brief Returns a copy of the messages captured so far
+ */
+vector<LogCapture::Record> LogCapture::GetRecords() const
+{
+	lock_guard<mutex> lock(g_log_mutex);
+	return m_records;
+}
+
+/**
+	@brief Returns the captured messages as they would have been printed to a console (without line wrapping)
+ */
+string LogCapture::GetText() const
+{
+	lock_guard<mutex> lock(g_log_mutex);
+
+	string ret;
+	bool lineStart = true;
+	for(auto& r : m_records)
+	{
+		string indent(4 * r.indent, ' ');
+		if(!r.function.empty())
+		{
+			ret += "[" + r.function + "] " + indent;
+			lineStart = false;
+		}
+
+		for(auto c : r.text)
+		{
+			if(lineStart && (c != '\n'))
+				ret += indent;
+			ret += c;
+			lineStart = (c == '\n');
+		}
+	}
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Context propagation
+
+/**
+	@brief Creates an empty context: no indentation, tags or captures
+ */
+LogContext::LogContext()
+	: m_indent(0)
+	, m_capture(nullptr)
+	, m_captureSeverity(0)
+{
+}
+
+/**
+	@brief Takes a snapshot of the calling thread's context
+ */
+LogContext LogContext::Current()
+{
+	LogContext ret;
+	ret.m_indent = g_logIndentLevel;
+	ret.m_tags = g_logTags;
+	ret.m_capture = g_logCaptureTop;
+	ret.m_captureSeverity = g_logCaptureSeverity;
+	return ret;
+}
+
+/**
+	@brief Makes this the calling thread's context
+
+	Normally used through LogContextScope, so the previous context comes back afterwards.
+ */
+void LogContext::Apply() const
+{
+	g_logIndentLevel = m_indent;
+	g_logTags = m_tags;
+	g_logCaptureTop = m_capture;
+	g_logCaptureSeverity = m_captureSeverity;
+}
+
+/**
+	@brief Returns the tags in this context, outermost first
+ */
+vector<pair<string, string>> LogContext::GetTags() const
+{
+	vector<pair<string, string>> ret;
+	for(auto t = m_tags.get(); t; t = t->next.get())
+		ret.emplace_back(t->key, t->value);
+	reverse(ret.begin(), ret.end());
+	return ret;
+}
+
+LogTag::LogTag(const string& key, const string& value)
+	: m_saved(g_logTags)
+{
+	g_logTags = make_shared<const LogTagNode>(LogTagNode{key, value, m_saved});
+}
+
+LogTag::~LogTag()
+{
+	g_logTags = m_saved;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ordered output from parallel regions
+
+/**
+	@brief One buffered message
+ */
+struct LogRegionEntry
+{
+	///@brief Logical key (e.g. loop index) the message was logged under
+	uint64_t key;
+
+	///@brief Order of the message among those this thread logged in the region
+	uint64_t sequence;
+
+	Severity severity;
+	unsigned int indent;
+
+	///@brief Interned trace function name, or 0
+	uint32_t function;
+
+	///@brief Offset and length of the text in the buffer's text
+	size_t offset;
+	size_t length;
+};
+
+/**
+	@brief Messages logged by one thread within a LogParallelRegion
+ */
+struct LogRegionBuffer
+{
+	LogRegionBuffer()
+	: owner(this_thread::get_id())
+	{}
+
+	~LogRegionBuffer()
+	{ Release(); }
+
+	///@brief Frees the storage, after the entries have been printed
+	void Release()
+	{
+		vector<LogRegionEntry>().swap(entries);
+		string().swap(text);
+		LogMemoryCharge(LOG_MEMORY_REGIONS, -static_cast<ptrdiff_t>(charged));
+		charged = 0;
+	}
+
+	///@brief Thread logging into this buffer
+	thread::id owner;
+
+	vector<LogRegionEntry> entries;
+	string text;
+
+	///@brief Capacity of the above charged to the logging memory budget
+	size_t charged = 0;
+};
+
+/**
+	@brief Source of unique LogParallelRegion IDs, so a stale per-thread cache is never mistaken for a current one
+ */
+static atomic<uint64_t> g_logNextRegionID(1);
+
+/**
+	@brief One entry in the per-thread cache of region buffers
+ */
+struct LogRegionCacheEntry
+{
+	uint64_t			region;
+	LogRegionBuffer*	buffer;
+};
+
+/**
+	@brief This thread's buffers in the regions it used most recently
+
+	A few entries, so that alternating between regions (for example nested ones) doesn't go back to the region's
+	mutex every time.
+ */
+static thread_local LogRegionCacheEntry g_logRegionCache[4] = {};
+
+/**
+	@brief Next entry of g_logRegionCache to replace
+ */
+static thread_local unsigned int g_logRegionCacheNext = 0;
+
+/**
+	@brief Order of this thread's messages across all the regions it logs into
+ */
+static thread_local uint64_t g_logRegionSequence = 0;
+
+/**
+	@brief Adds a message to this thread's buffer in the current parallel region. No locks are taken.
+ */
+static void AppendToRegion(Severity severity, uint32_t function, const string& msg, unsigned int indent)
+{
+	if(LogMemoryShed(severity))
+		return;
+
+	auto& buf = *g_logRegionBuffer;
+	buf.entries.push_back(
+		LogRegionEntry{g_logRegionKey, g_logRegionSequence++, severity, indent, function, buf.text.length(), msg.length()});
+	buf.text += msg;
+
+	size_t bytes = buf.entries.capacity() * sizeof(LogRegionEntry) + buf.text.capacity();
+	if(bytes != buf.charged)
+	{
+		LogMemoryCharge(LOG_MEMORY_REGIONS, bytes - buf.charged);
+		buf.charged = bytes;
+	}
+}
+
+LogParallelRegion::LogParallelRegion()
+	: m_id(g_logNextRegionID++)
+{
+}
+
+LogParallelRegion::~LogParallelRegion()
+{
+	Flush();
+}
+
+/**
+	@brief Gets the calling thread's buffer, creating it the first time the thread logs in this region
+
+	The region's mutex is only taken when the buffer isn't in the per-thread cache. Each thread has exactly one
+	buffer per region, however often it switches between regions.
+ */
+LogRegionBuffer* LogParallelRegion::GetBuffer()
+{
+	for(auto& c : g_logRegionCache)
+	{
+		if(c.region == m_id)
+			return c.buffer;
+	}
+
+	LogRegionBuffer* buf = nullptr;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		auto self = this_thread::get_id();
+		for(auto& b : m_buffers)
+		{
+			if(b->owner == self)
+			{
+				buf = b.get();
+				break;
+			}
+		}
+		if(!buf)
+		{
+			m_buffers.emplace_back(make_unique<LogRegionBuffer>());
+			buf = m_buffers.back().get();
+		}
+	}
+
+	auto& slot = g_logRegionCache[g_logRegionCacheNext];
+	g_logRegionCacheNext = (g_logRegionCacheNext + 1) % (sizeof(g_logRegionCache) / sizeof(g_logRegionCache[0]));
+	slot.region = m_id;
+	slot.buffer = buf;
+	return buf;
+}
+
+/**
+	@brief Prints everything buffered so far in key order, as one block, and empties the buffers
+
+	Messages with the same key come out in the order they were logged. Called automatically when the region is
+	destroyed; may also be called in between parallel loops, but never while another thread could be logging into
+	the region.
+ */
+void LogParallelRegion::Flush()
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	//Merge all threads' entries by key
+	vector<pair<const LogRegionEntry*, const LogRegionBuffer*>> order;
+	for(auto& b : m_buffers)
+	{
+		for(auto& e : b->entries)
+			order.emplace_back(&e, b.get());
+	}
+	if(order.empty())
+		return;
+	stable_sort(order.begin(), order.end(),
+		[](const auto& a, const auto& b)
+		{
+			if(a.first->key != b.first->key)
+				return a.first->key < b.first->key;
+			return a.first->sequence < b.first->sequence;
+		});
+
+	{
+		lock_guard<mutex> loglock(g_log_mutex);
+		unsigned int oldIndent = g_logIndentLevel;
+
+		string& msg = g_logFormatBuffer;
+		string name;
+		uint32_t nameID = 0;
+		for(auto& it : order)
+		{
+			auto& e = *it.first;
+			msg.assign(it.second->text, e.offset, e.length);
+			g_logIndentLevel = e.indent;
+			if(!e.function)
+				LogToAllSinks(e.severity, msg);
+			else
+			{
+				if(e.function != nameID)
+				{
+					name = LogGetInternedString(e.function);
+					nameID = e.function;
+				}
+				LogTraceToSinks(name, msg);
+			}
+		}
+
+		g_logIndentLevel = oldIndent;
+	}
+
+	//Give the memory back rather than keeping it for the next loop, which may never come
+	for(auto& b : m_buffers)
+		b->Release();
+}
+
+/**
+	@brief Starts buffering this thread's messages in a region, under a key
+
+	@param region	Region to log into
+	@param key		Position of this work in the output, typically the loop index
+ */
+LogParallelKey::LogParallelKey(LogParallelRegion& region, uint64_t key)
+	: m_savedBuffer(g_logRegionBuffer)
+	, m_savedKey(g_logRegionKey)
+{
+	g_logRegionBuffer = region.GetBuffer();
+	g_logRegionKey = key;
+}
+
+LogParallelKey::~LogParallelKey()
+{
+	g_logRegionBuffer = m_savedBuffer;
+	g_logRegionKey = m_savedKey;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Aggregated counters
+
+atomic<uint64_t> g_logCountEpoch(1);
+
+/**
+	@brief Every LogCount() site reached so far, protected by g_logCountMutex
+
+	Sites are never destroyed, so the list and the sites are deliberately leaked.
+ */
+static vector<LogCountSite*>* g_logCountSites = nullptr;
+
+/**
+	@brief Protects g_logCountSites and serializes printing the summaries
+ */
+static mutex g_logCountMutex;
+
+///@brief Time the current interval started
+static chrono::steady_clock::time_point g_logCountStart;
+
+///@brief Interval between summaries, in ms
+static atomic<int64_t> g_logCountInterval(1000);
+
+static void StartSummaryThread();
+static void WakeSummaryThread();
+
+/**
+	@brief Registers a new LogCount() site, starting the summary thread the first time
+ */
+LogCountSite& LogCountSite::Create(Severity severity, const char* function, const char* format)
+{
+	auto site = new LogCountSite(severity, function, format);
+
+	lock_guard<mutex> lock(g_logCountMutex);
+	if(!g_logCountSites)
+	{
+		g_logCountSites = new vector<LogCountSite*>;
+		g_logCountStart = chrono::steady_clock::now();
+		StartSummaryThread();
+	}
+	g_logCountSites->push_back(site);
+	return *site;
+}
+
+LogCountSite::LogCountSite(Severity severity, const char* function, const char* format)
+	: m_severity(severity)
+	, m_format(format)
+	, m_retired(0)
+	, m_firstEpoch(0)
+{
+	LogTraceSite site;
+	ParseTraceSite(function, site);
+	if(site.valid)
+		m_function = site.name;
+}
+
+/**
+	@brief Formats a message for a summary
+ */
+string LogCountSite::Format(const char* format, ...)
+{
+	string ret;
+	va_list va;
+	va_start(va, format);
+	FormatMessage(ret, format, va);
+	va_end(va);
+
+	while(!ret.empty() && (ret.back() == '\n') )
+		ret.pop_back();
+	return ret;
+}
+
+void LogCountSite::AddSlot(LogCountSlot* slot)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_slots.push_back(slot);
+}
+
+/**
+	@brief Keeps the unprinted hits of a thread that's exiting, so they make it into the next summary
+ */
+void LogCountSite::RemoveSlot(LogCountSlot* slot)
+{
+	lock_guard<mutex> lock(m_mutex);
+	uint64_t hits = slot->m_count.load(memory_order_relaxed) - slot->m_printed;
+	if(hits)
+	{
+		m_retired += hits;
+		m_retiredLast = slot->FormatLast();
+	}
+	m_slots.erase(find(m_slots.begin(), m_slots.end(), slot));
+}
+
+/**
+	@brief Remembers the message of the first hit in an interval, unless another thread got there first
+ */
+void LogCountSite::SetFirst(uint64_t epoch, string text)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if(m_firstEpoch != epoch)
+	{
+		m_first = move(text);
+		m_firstEpoch = epoch;
+	}
+}
+
+/**
+	@brief Prints the summary for an interval, if there were any hits
+
+	The latest message is taken from the thread with the most hits in the interval, since threads' hits aren't
+	ordered relative to each other.
+
+	@param epoch	The interval that just ended
+	@param seconds	Length of the interval
+ */
+void LogCountSite::Emit(uint64_t epoch, double seconds)
+{
+	uint64_t total;
+	string first;
+	string last;
+	{
+		lock_guard<mutex> lock(m_mutex);
+
+		total = m_retired;
+		uint64_t most = m_retired;
+		LogCountSlot* busiest = nullptr;
+		for(auto slot : m_slots)
+		{
+			uint64_t count = slot->m_count.load(memory_order_relaxed);
+			uint64_t hits = count - slot->m_printed;
+			slot->m_printed = count;
+			total += hits;
+			if(hits > most)
+			{
+				most = hits;
+				busiest = slot;
+			}
+		}
+		if(total == 0)
+			return;
+
+		last = busiest ? busiest->FormatLast() : m_retiredLast;
+		if(m_firstEpoch == epoch)
+			first = m_first;
+		m_retired = 0;
+		m_retiredLast.clear();
+	}
+
+	string prefix = m_function.empty() ? "" : m_function + ": ";
+	if(total == 1)
+		Log(m_severity, "%s%s\n", prefix.c_str(), last.c_str());
+	else if(first.empty())
+	{
+		Log(m_severity, "%s%" PRIu64 " times in %.2f s (last: %s)\n",
+			prefix.c_str(), total, seconds, last.c_str());
+	}
+	else
+	{
+		Log(m_severity, "%s%" PRIu64 " times in %.2f s (first: %s, last: %s)\n",
+			prefix.c_str(), total, seconds, first.c_str(), last.c_str());
+	}
+}
+
+/**
+	@brief Sets how often LogCount() summaries are printed
+ */
+void LogSetCountInterval(chrono::milliseconds interval)
+{
+	g_logCountInterval = max(static_cast<int64_t>(interval.count()), static_cast<int64_t>(1));
+	WakeSummaryThread();
+}
+
+/**
+	@brief Ends the current interval and prints a summary for every LogCount() site hit during it
+ */
+void LogFlushCounts()
+{
+	lock_guard<mutex> lock(g_logCountMutex);
+	if(!g_logCountSites)
+		return;
+
+	auto now = chrono::steady_clock::now();
+	double seconds = chrono::duration<double>(now - g_logCountStart).count();
+	g_logCountStart = now;
+
+	//Hits from here on are in the next interval
+	uint64_t epoch = g_logCountEpoch.fetch_add(1);
+	for(auto site : *g_logCountSites)
+		site->Emit(epoch, seconds);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Error summary
+
+/**
+	@brief Identifies a warning or error by its format string and the code that logged it
+
+	Both are compared by address: a format string is almost always a literal, and the same literal logged from two
+	places is two different problems. Copies of a call made by inlining or loop unrolling count as separate sites.
+ */
+struct LogErrorKey
+{
+	const char*	format;
+	void*		caller;
+
+	bool operator==(const LogErrorKey& rhs) const
+	{ return (format == rhs.format) && (caller == rhs.caller); }
+};
+
+struct LogErrorKeyHash
+{
+	size_t operator()(const LogErrorKey& key) const
+	{
+		return hash<const void*>()(key.format) ^ (hash<const void*>()(key.caller) * 31);
+	}
+};
+
+/**
+	@brief Everything collected about one LogErrorKey
+ */
+struct LogErrorRecord
+{
+	Severity	severity = Severity::ERROR;
+	uint64_t	count = 0;
+	time_t		first = 0;
+	time_t		last = 0;
+	string		firstMessage;
+	string		lastMessage;
+};
+
+///@brief Protects everything below
+static mutex g_logErrorMutex;
+
+static unordered_map<LogErrorKey, LogErrorRecord, LogErrorKeyHash> g_logErrors;
+
+///@brief Most sites kept in g_logErrors, so formats built at run time can't grow it without bound
+static const size_t g_logErrorSitesMax = 1024;
+
+///@brief Everything from sites that didn't fit in g_logErrors
+static LogErrorRecord g_logErrorOther;
+
+///@brief Set when something was recorded since the last periodic summary
+static bool g_logErrorsChanged = false;
+
+///@brief Interval between periodic summaries in ms, or zero for none
+static atomic<int64_t> g_logErrorSummaryInterval(0);
+
+/**
+	@brief Adds a formatted warning or error to the summary
+
+	Once g_logErrorSitesMax sites are known, messages from any other site are counted in g_logErrorOther.
+
+	@param severity	Severity of the message
+	@param format	Format string, or file:line of a LOG() statement
+	@param caller	Return address of the LogError() etc call
+	@param msg		The message, starting with its prefix
+	@param start	Length of the prefix, which isn't part of the sample kept in the summary
+ */
+static void LogSummaryRecord(Severity severity, const char* format, void* caller, const string& msg, size_t start)
+{
+	size_t end = msg.length();
+	while( (end > start) && (msg[end-1] == '\n') )
+		end --;
+
+	//Seconds are all the summary prints, and time() is much cheaper than a full clock read
+	time_t now = time(nullptr);
+
+	lock_guard<mutex> lock(g_logErrorMutex);
+
+	LogErrorKey key{format, caller};
+	auto it = g_logErrors.find(key);
+	LogErrorRecord* rec;
+	if(it != g_logErrors.end())
+		rec = &it->second;
+	else if(g_logErrors.size() < g_logErrorSitesMax)
+		rec = &g_logErrors[key];
+	else
+		rec = &g_logErrorOther;
+
+	if(rec->count == 0)
+	{
+		rec->severity = severity;
+		rec->first = now;
+		rec->firstMessage.assign(msg, start, end - start);
+	}
+	else if(static_cast<int>(severity) < static_cast<int>(rec->severity))
+		rec->severity = severity;
+	rec->count ++;
+	rec->last = now;
+
+	//Reuses the previous sample's buffer, so a repeated error doesn't allocate
+	rec->lastMessage.assign(msg, start, end - start);
+	g_logErrorsChanged = true;
+}
+
+/**
+	@brief Formats a warning or error once, adds it to the summary, and sends it to the sinks if any of them want it
+
+	@param severity	Severity of the message
+	@param prefix	"ERROR: " etc, which isn't part of the sample kept in the summary
+	@param format	Format string, without the prefix
+	@param caller	Return address of the LogError() etc call
+	@param va		Arguments of the message
+ */
+static void LogSummarizeMessage(Severity severity, const char* prefix, const char* format, void* caller, va_list va)
+{
+	string& msg = g_logFormatBuffer;
+	size_t start = strlen(prefix);
+	msg.assign(prefix, start);
+	FormatMessage(msg, format, va, start);
+
+	LogSummaryRecord(severity, format, caller, msg, start);
+
+	if(!LogIsEnabled(severity))
+		return;
+
+	if(g_logRegionBuffer)
+	{
+		AppendToRegion(severity, 0, msg, g_logIndentLevel);
+		return;
+	}
+
+	lock_guard<mutex> lock(g_log_mutex);
+	if(HasSinksFor(severity))
+		LogToAllSinks(severity, msg);
+
+	if(msg.capacity() > g_logStreamThreshold)
+		string().swap(msg);
+}
+
+/**
+	@brief Describes a return address as "symbol+offset", or "module+offset" for symbols that aren't exported
+
+	The address is moved back by one byte so it points into the call instruction rather than the one after it, and
+	can be passed straight to addr2line.
+ */
+static string LogDescribeCaller(void* caller)
+{
+	uintptr_t addr = reinterpret_cast<uintptr_t>(caller) - 1;
+	char offset[32];
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+	Dl_info info;
+	if(dladdr(reinterpret_cast<void*>(addr), &info) && info.dli_fname)
+	{
+		if(info.dli_sname && info.dli_saddr)
+		{
+			string name = info.dli_sname;
+#ifdef __GNUC__
+			int status;
+			char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			if(demangled)
+			{
+				name = demangled;
+				free(demangled);
+			}
+#endif
+			snprintf(offset, sizeof(offset), "+0x%zx", static_cast<size_t>(addr - reinterpret_cast<uintptr_t>(info.dli_saddr)));
+			return name + offset;
+		}
+
+		const char* module = strrchr(info.dli_fname, '/');
+		module = module ? module + 1 : info.dli_fname;
+		snprintf(offset, sizeof(offset), "+0x%zx", static_cast<size_t>(addr - reinterpret_cast<uintptr_t>(info.dli_fbase)));
+		return module + string(offset);
+	}
+#endif
+
+	snprintf(offset, sizeof(offset), "0x%zx", static_cast<size_t>(addr));
+	return offset;
+}
+
+/**
+	@brief Formats a time as local "YYYY-MM-DD HH:MM:SS"
+ */
+static string LogFormatTime(chrono::system_clock::time_point t)
+{
+	time_t tt = chrono::system_clock::to_time_t(t);
+	struct tm tm;
+#ifdef _WIN32
+	localtime_s(&tm, &tt);
+#else
+	localtime_r(&tt, &tm);
+#endif
+	char buf[32];
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+	return buf;
+}
+
+/**
+	@brief Starts or stops collecting warnings and errors for the summary
+
+	While enabled, every LogWarning(), LogError(), LOG(WARNING) and LOG(ERROR) is counted by format string (or LOG()
+	statement) and call site, whether or not any sink prints it. Up to 1024 sites are kept apart; messages from
+	any further sites are counted together as "other sites". The summary is printed by LogPrintErrorSummary(), periodically if
+	LogSetErrorSummaryInterval() was called, and when the program exits. Disabling keeps what was collected so far.
+ */
+void LogEnableErrorSummary(bool enable)
+{
+	g_logErrorSummaryEnabled = enable;
+	if(enable)
+		StartSummaryThread();
+}
+
+/**
+	@brief Prints the summary every interval, if anything new was logged. Zero (the default) turns this off.
+ */
+void LogSetErrorSummaryInterval(chrono::milliseconds interval)
+{
+	g_logErrorSummaryInterval = max(static_cast<int64_t>(interval.count()), static_cast<int64_t>(0));
+	WakeSummaryThread();
+}
+
+/**
+	@brief Returns everything collected so far, most frequent first
+ */
+vector<LogErrorSummaryEntry> LogGetErrorSummary()
+{
+	vector<LogErrorSummaryEntry> ret;
+	{
+		lock_guard<mutex> lock(g_logErrorMutex);
+		ret.reserve(g_logErrors.size());
+		for(auto& it : g_logErrors)
+		{
+			LogErrorSummaryEntry entry;
+			entry.severity = it.second.severity;
+			entry.format = it.first.format;
+			entry.caller = it.first.caller;
+			entry.count = it.second.count;
+			entry.first = chrono::system_clock::from_time_t(it.second.first);
+			entry.last = chrono::system_clock::from_time_t(it.second.last);
+			entry.firstMessage = it.second.firstMessage;
+			entry.lastMessage = it.second.lastMessage;
+			ret.push_back(move(entry));
+		}
+
+		auto& other = g_logErrorOther;
+		if(other.count)
+		{
+			LogErrorSummaryEntry entry;
+			entry.severity = other.severity;
+			entry.format = "(other sites, over the limit of " + to_string(g_logErrorSitesMax) + ")";
+			entry.caller = nullptr;
+			entry.count = other.count;
+			entry.first = chrono::system_clock::from_time_t(other.first);
+			entry.last = chrono::system_clock::from_time_t(other.last);
+			entry.firstMessage = other.firstMessage;
+			entry.lastMessage = other.lastMessage;
+			ret.push_back(move(entry));
+		}
+	}
+
+	for(auto& entry : ret)
+	{
+		if(entry.caller)
+			entry.site = LogDescribeCaller(entry.caller);
+		while(!entry.format.empty() && (entry.format.back() == '\n') )
+			entry.format.pop_back();
+	}
+
+	sort(ret.begin(), ret.end(),
+		[](const LogErrorSummaryEntry& a, const LogErrorSummaryEntry& b)
+		{
+			if(a.count != b.count)
+				return a.count > b.count;
+			return a.first < b.first;
+		});
+	return ret;
+}
+
+/**
+	@brief Forgets everything collected so far
+ */
+void LogClearErrorSummary()
+{
+	lock_guard<mutex> lock(g_logErrorMutex);
+	g_logErrors.clear();
+	g_logErrorOther = LogErrorRecord();
+	g_logErrorsChanged = false;
+}
+
+/**
+	@brief Prints the summary, one line per format string and call site plus samples of the first and latest message
+
+		Error summary: 12006 messages from 2 sites
+		    12000 x ERROR: short read on %s (Decoder::Read(int)+0x4b)
+		        first 2026-10-18 10:00:01: short read on /dev/foo
+		        last  2026-10-18 12:33:10: short read on /dev/bar
+		    6 x Warning: retrying (Decoder::Open()+0x21)
+		        ...
+
+	Each line is logged at the severity of the message it describes.
+ */
+void LogPrintErrorSummary()
+{
+	{
+		lock_guard<mutex> lock(g_logErrorMutex);
+		g_logErrorsChanged = false;
+	}
+
+	auto entries = LogGetErrorSummary();
+	if(entries.empty())
+		return;
+
+	uint64_t total = 0;
+	Severity worst = Severity::WARNING;
+	for(auto& entry : entries)
+	{
+		total += entry.count;
+		worst = min(worst, entry.severity);
+	}
+
+	Log(worst, "Error summary: %" PRIu64 " messages from %zu sites\n", total, entries.size());
+	LogIndenter li;
+	for(auto& entry : entries)
+	{
+		const char* prefix = (entry.severity == Severity::WARNING) ? "Warning: " : "ERROR: ";
+		if(entry.site.empty())
+			Log(entry.severity, "%" PRIu64 " x %s%s\n", entry.count, prefix, entry.format.c_str());
+		else
+		{
+			Log(entry.severity, "%" PRIu64 " x %s%s (%s)\n",
+				entry.count, prefix, entry.format.c_str(), entry.site.c_str());
+		}
+
+		LogIndenter li2;
+		if(entry.count == 1)
+			Log(entry.severity, "at %s: %s\n", LogFormatTime(entry.first).c_str(), entry.firstMessage.c_str());
+		else
+		{
+			Log(entry.severity, "first %s: %s\n", LogFormatTime(entry.first).c_str(), entry.firstMessage.c_str());
+			Log(entry.severity, "last  %s: %s\n", LogFormatTime(entry.last).c_str(), entry.lastMessage.c_str());
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Summary thread
+
+/**
+	@brief Thread printing the LogCount() and error summaries, and how to stop it
+
+	It also prints the final summaries at exit, because by then the main thread's thread_local format buffer has been
+	destroyed. Slots of the main thread have been destroyed too, so their hits are already retired into their sites.
+ */
+static thread* g_logSummaryThread = nullptr;
+static mutex g_logSummaryMutex;
+static condition_variable g_logSummaryCond;
+static bool g_logSummaryQuit = false;
+
+static void LogSummaryThreadProc()
+{
+	auto lastCounts = chrono::steady_clock::now();
+	auto lastErrors = lastCounts;
+
+	unique_lock<mutex> lock(g_logSummaryMutex);
+	while(!g_logSummaryQuit)
+	{
+		auto countInterval = chrono::milliseconds(g_logCountInterval.load());
+		auto errorInterval = chrono::milliseconds(g_logErrorSummaryInterval.load());
+
+		auto deadline = lastCounts + countInterval;
+		if(errorInterval.count())
+			deadline = min(deadline, lastErrors + errorInterval);
+
+		//Also wakes up early when an interval changes, to recompute the deadline
+		g_logSummaryCond.wait_until(lock, deadline);
+		if(g_logSummaryQuit)
+			break;
+
+		auto now = chrono::steady_clock::now();
+		bool counts = (now >= lastCounts + countInterval);
+		bool errors = errorInterval.count() && (now >= lastErrors + errorInterval);
+		if(!counts && !errors)
+			continue;
+
+		lock.unlock();
+		if(counts)
+		{
+			LogFlushCounts();
+			lastCounts = now;
+		}
+		if(errors)
+		{
+			bool changed;
+			{
+				lock_guard<mutex> elock(g_logErrorMutex);
+				changed = g_logErrorsChanged;
+			}
+			if(changed)
+				LogPrintErrorSummary();
+			lastErrors = now;
+		}
+		lock.lock();
+	}
+
+	lock.unlock();
+	LogFlushCounts();
+
+	//Skip the summary if it was already printed and nothing happened since
+	bool changed;
+	{
+		lock_guard<mutex> elock(g_logErrorMutex);
+		changed = g_logErrorsChanged;
+	}
+	if(changed)
+		LogPrintErrorSummary();
+}
+
+/**
+	@brief Stops the summary thread, which prints what's left while the sinks still exist
+ */
+static void LogSummaryAtExit()
+{
+	{
+		lock_guard<mutex> lock(g_logSummaryMutex);
+		g_logSummaryQuit = true;
+	}
+	g_logSummaryCond.notify_all();
+	if(g_logSummaryThread->joinable())
+		g_logSummaryThread->join();
+}
+
+/**
+	@brief Starts the summary thread, if it isn't running yet
+ */
+static void StartSummaryThread()
+{
+	lock_guard<mutex> lock(g_logSummaryMutex);
+	if(g_logSummaryThread)
+		return;
+
+	g_logSummaryThread = new thread(LogSummaryThreadProc);
+	atexit(LogSummaryAtExit);
+}
+
+static void WakeSummaryThread()
+{
+	lock_guard<mutex> lock(g_logSummaryMutex);
+	g_logSummaryCond.notify_all();
 }
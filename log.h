@@ -36,11 +36,27 @@
 	@ingroup	liblog
  */
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <set>
+#include <map>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
 
 #if defined(__MINGW32__)
 #undef ERROR
@@ -72,6 +88,72 @@ enum class Severity
 };
 
 extern __thread unsigned int g_logIndentLevel;
+extern size_t g_logMaxMessageSize;
+extern size_t g_logStreamThreshold;
+
+/**
+	@brief		Interned strings: small integer IDs for class names, function names, format strings etc
+	@ingroup	liblog
+
+	The table is global and append-only. Each distinct string is stored once and keeps its ID for the life of the
+	process, so records can carry a 4-byte ID instead of a copy of the string. Looking up a string by ID never takes
+	a lock, and neither does interning a string that's already in the table. ID 0 is the empty string.
+ */
+uint32_t LogInternString(std::string_view str);
+uint32_t LogLookupInternedString(std::string_view str);
+std::string_view LogGetInternedString(uint32_t id);
+size_t LogGetInternedStringCount();
+
+/**
+	@brief		Kinds of buffers charged to the logging memory budget
+	@ingroup	liblog
+ */
+enum LogMemoryPool
+{
+	///@brief Queues of sinks sending to a collector (TCPLogSink, OTLPLogSink)
+	LOG_MEMORY_QUEUES,
+
+	///@brief Records retained by SubscriberLogSink
+	LOG_MEMORY_RECORDERS,
+
+	///@brief Records stored by IndexedLogSink
+	LOG_MEMORY_INDEXES,
+
+	///@brief Messages buffered by LogParallelRegion
+	LOG_MEMORY_REGIONS,
+
+	LOG_MEMORY_POOL_COUNT
+};
+
+/**
+	@brief		Memory used by logging buffers, as returned by LogGetMemoryStats()
+	@ingroup	liblog
+ */
+struct LogMemoryStats
+{
+	///@brief Budget set by LogSetMemoryBudget(), or 0 for unlimited
+	size_t budget;
+
+	///@brief Bytes currently charged, in total and per pool
+	size_t used;
+	size_t pools[LOG_MEMORY_POOL_COUNT];
+
+	///@brief Highest total so far
+	size_t peak;
+
+	///@brief Messages dropped to stay within the budget
+	uint64_t shed;
+
+	///@brief Records discarded early by shrinking SubscriberLogSink retention
+	uint64_t trimmed;
+};
+
+void LogSetMemoryBudget(size_t bytes);
+LogMemoryStats LogGetMemoryStats();
+void LogMemoryCharge(LogMemoryPool pool, ptrdiff_t bytes);
+bool LogMemoryShed(Severity severity);
+bool LogMemoryShouldShrink();
+void LogMemoryCountTrimmed(uint64_t records);
 
 /**
 	@brief		Base class for all log sinks
@@ -80,19 +162,23 @@ extern __thread unsigned int g_logIndentLevel;
 class LogSink
 {
 public:
-	LogSink(Severity min_severity = Severity::VERBOSE)
-	: m_indentSize(4)
-	, m_termWidth(120)	//default if not using ioctls to check
-	, m_lastMessageWasNewline(true)
-	, m_min_severity(min_severity)
-	{}
-
-	virtual ~LogSink() {}
+	LogSink(Severity min_severity = Severity::VERBOSE);
+	virtual ~LogSink();
 
 	///@brief Returns the current severity / verbosity level
 	Severity GetSeverity()
 	{ return m_min_severity; }
 
+	///@brief Returns true if the sink still gets messages from sites demoted by LogSetSiteBudget()
+	bool GetKeepsDemoted()
+	{ return m_keepsDemoted; }
+
+	void SetKeepsDemoted(bool keep);
+
+	///@brief Returns true if the sink does its own locking, so messages are sent to it without holding g_log_mutex
+	bool IsConcurrent()
+	{ return m_concurrent; }
+
 	/**
 		@brief Gets the indent string (for now, only used by STDLogSink)
 
@@ -103,14 +189,41 @@ public:
 
 	virtual void Log(Severity severity, const std::string &msg) = 0;
 	virtual void Log(Severity severity, const char *format, va_list va) = 0;
+	virtual void LogTraceMessage(const std::string& function, const std::string& msg);
 
 	std::string vstrprintf(const char* format, va_list va);
 
+	///@brief Concrete type of a sink, for calling built-in sinks without going through the vtable
+	enum DispatchType
+	{
+		DISPATCH_UNKNOWN,		//not yet resolved
+		DISPATCH_VIRTUAL,		//custom sink, use virtual calls
+		DISPATCH_STD,
+		DISPATCH_COLORED_STD,
+		DISPATCH_FILE
+	};
+
+	///@brief Returns the concrete type of the sink if it's exactly one of the built-in classes
+	DispatchType GetDispatchType()
+	{
+		if(m_dispatchType == DISPATCH_UNKNOWN)
+			ResolveDispatchType();
+		return m_dispatchType;
+	}
+
 protected:
+	void ResolveDispatchType();
 
-	std::string WrapString(std::string str);
+	std::string WrapString(const std::string& str);
+	std::string WrapString(const std::string& str, bool lastWasNewline);
+	void WriteStreamed(FILE* fp, const std::string& str);
 	virtual void PreprocessLine(std::string& line);
 
+	bool NeedsPreprocessing();
+
+	void SetConcurrent();
+	void WaitForConcurrentCalls();
+
 	/// @brief Number of spaces in one indentation
 	unsigned int m_indentSize;
 
@@ -122,6 +235,18 @@ protected:
 
 	/// @brief Minimum severity of messages to be printed
 	Severity m_min_severity;
+
+	/// @brief True to keep getting messages from demoted sites (off by default, on for SHMLogSink)
+	bool m_keepsDemoted;
+
+	/// @brief True if the sink may be called from several threads at once, without g_log_mutex held
+	bool m_concurrent;
+
+	/// @brief Set by the constructor of each built-in sink class
+	DispatchType m_builtinType;
+
+	/// @brief m_builtinType if the object is exactly that class, DISPATCH_VIRTUAL if not
+	DispatchType m_dispatchType;
 };
 
 /**
@@ -153,6 +278,7 @@ public:
 
 protected:
 	void PreprocessLine(std::string& line) override;
+
 	std::string replace(
 		const std::string& search,
 		const std::string& before,
@@ -177,73 +303,1529 @@ protected:
 	FILE		*m_file;
 };
 
-extern std::mutex g_log_mutex;
-extern std::vector<std::unique_ptr<LogSink>> g_log_sinks;
-extern std::set<std::string> g_trace_filters;
+/**
+	@brief A log sink that keeps recent records in memory for in-process viewers (e.g. a GUI log pane)
+
+	Records are appended to a chain of fixed-size segments. Loggers already hold g_log_mutex, so there is only ever
+	one writer; it fills a slot and then publishes it with a release store of the segment's count. Readers never take
+	a lock and never block the writer: Pull() hands back spans pointing straight into the segments, holding a
+	reference so the records stay valid even if retention discards the segment meanwhile. Record text is allocated
+	with LogArenaAllocate() by whichever thread is logging, and freed with the segment.
+
+	The oldest segments are discarded once more than the retention limit of records is held. A cursor that falls
+	behind that far skips the lost records and counts them.
+ */
+class SubscriberLogSink : public LogSink
+{
+public:
+	///@brief One line of log output
+	struct Record
+	{
+		///@brief Position in the stream of records written to this sink, starting at 0
+		uint64_t sequence;
+
+		///@brief Time the line was completed, in ns since the Unix epoch
+		uint64_t timestamp;
+
+		///@brief Most severe message that contributed to this line
+		Severity severity;
+
+		///@brief Interned class and function name for LogTrace() output, otherwise 0
+		uint32_t function;
+
+		///@brief Text of the line (including indentation, without the newline), owned by the record's segment
+		std::string_view text;
+
+		///@brief Class and function name for LogTrace() output, otherwise empty
+		std::string_view GetFunction() const
+		{ return LogGetInternedString(function); }
+	};
+
+	///@brief Records per segment
+	static constexpr size_t SEGMENT_SIZE = 256;
+
+	struct Segment;
+
+	///@brief A run of consecutive records within one segment
+	struct Span
+	{
+		///@brief Keeps the segment alive while the span is in use
+		std::shared_ptr<const Segment> owner;
+
+		const Record* begin;
+		const Record* end;
+	};
+
+	///@brief The records returned by one call to Pull()
+	struct Batch
+	{
+		std::vector<Span> spans;
+
+		///@brief Number of records skipped because retention discarded them before they were pulled
+		uint64_t lost = 0;
+
+		size_t size() const;
+
+		void clear()
+		{
+			spans.clear();
+			lost = 0;
+		}
+
+		///@brief Calls fn on each record, oldest first
+		template<class F> void ForEach(F fn) const
+		{
+			for(auto& s : spans)
+			{
+				for(auto r = s.begin; r != s.end; r++)
+					fn(*r);
+			}
+		}
+	};
+
+	///@brief A reader's position in the record stream
+	class Cursor
+	{
+	public:
+		Cursor()
+			: m_index(0)
+			, m_sequence(0)
+		{}
+
+	protected:
+		friend class SubscriberLogSink;
+
+		std::weak_ptr<Segment> m_segment;
+		size_t m_index;
+		uint64_t m_sequence;
+	};
+
+	SubscriberLogSink(size_t retention = 65536, Severity min_severity = Severity::DEBUG);
+	~SubscriberLogSink() override;
+
+	void Log(Severity severity, const std::string &msg) override;
+	void Log(Severity severity, const char *format, va_list va) override;
+	void LogTraceMessage(const std::string& function, const std::string& msg) override;
+
+	Cursor Subscribe(bool fromOldest = false);
+	void Pull(Cursor& cursor, Batch& batch);
+
+	///@brief Sets how many records to keep (rounded up to whole segments)
+	void SetRetention(size_t records)
+	{ m_retention = records; }
+
+protected:
+	void Append(Severity severity, const std::string& text, const std::string& function);
+	void Publish(Severity severity, const char* line, size_t len, uint32_t function);
+	std::shared_ptr<Segment> GetHead();
+
+	///@brief Text not yet published because it doesn't end in a newline
+	std::string m_pending;
+
+	///@brief Most severe message that contributed to m_pending
+	Severity m_pendingSeverity;
+
+	///@brief Owning reference to the oldest retained segment (writer only)
+	std::shared_ptr<Segment> m_headRef;
+
+	///@brief Oldest retained segment, for readers. Only dereferenced while counted in m_headReaders.
+	std::atomic<Segment*> m_head;
+
+	///@brief Number of readers between loading m_head and taking a reference to it
+	std::atomic<unsigned> m_headReaders;
+
+	///@brief Segments dropped from the head, kept until no reader can still be looking at them (writer only)
+	std::vector<std::shared_ptr<Segment>> m_retired;
+
+	///@brief Segment currently being filled (writer only)
+	std::shared_ptr<Segment> m_tail;
+
+	///@brief Number of segments reachable from m_head (writer only)
+	size_t m_segmentCount;
+
+	///@brief Sequence number of the next record
+	std::atomic<uint64_t> m_nextSequence;
+
+	///@brief Maximum number of records to keep
+	std::atomic<size_t> m_retention;
+};
 
 /**
-	@brief		RAII wrapper for log indentation
-	@ingroup	liblog
+	@brief A log sink keeping every line in memory, indexed for fast filtering (e.g. by a GUI log view)
 
-	Log messages are indented once for each LogIndenter object in the call stack.
+	Record metadata is stored as columns (timestamp, severity, thread, class) and the text of all records is packed
+	into one arena, newline separated, so substring searches scan a single contiguous buffer (with SSE2 where
+	available). Posting lists of record numbers are kept per class and per thread as records arrive.
+
+	Readers describe what they want with a Filter and keep the results in a View. Update() only examines records
+	added since the view was last updated, so keeping a view current costs time proportional to the new records.
+
+	Writers are serialized by g_log_mutex; readers take a shared lock that blocks the writer only while they run.
  */
-class LogIndenter
+class IndexedLogSink : public LogSink
 {
 public:
-	LogIndenter();
+	///@brief Criteria a record must meet to appear in a View
+	struct Filter
+	{
+		///@brief Least severe level to include
+		Severity maxSeverity = Severity::DEBUG;
 
-	~LogIndenter();
+		///@brief Class IDs to include (empty for all)
+		std::set<uint32_t> classes;
+
+		///@brief Thread IDs to include (empty for all)
+		std::set<uint32_t> threads;
+
+		///@brief Substring the text must contain (empty for any)
+		std::string text;
+	};
+
+	///@brief The records matching a filter, kept up to date incrementally
+	class View
+	{
+	public:
+		View()
+			: m_scanned(0)
+		{}
+
+		View(const Filter& filter)
+			: m_filter(filter)
+			, m_scanned(0)
+		{}
+
+		///@brief Record numbers of the matching records, in ascending order
+		const std::vector<uint32_t>& GetMatches() const
+		{ return m_matches; }
+
+		const Filter& GetFilter() const
+		{ return m_filter; }
+
+	protected:
+		friend class IndexedLogSink;
+
+		Filter m_filter;
+		std::vector<uint32_t> m_matches;
+
+		///@brief Number of records already examined
+		uint32_t m_scanned;
+	};
+
+	IndexedLogSink(Severity min_severity = Severity::DEBUG);
+	~IndexedLogSink() override;
+
+	void Log(Severity severity, const std::string &msg) override;
+	void Log(Severity severity, const char *format, va_list va) override;
+	void LogTraceMessage(const std::string& function, const std::string& msg) override;
+
+	void Update(View& view);
+
+	size_t GetRecordCount();
+	std::string GetText(uint32_t record);
+	Severity GetSeverity(uint32_t record);
+	uint64_t GetTimestamp(uint32_t record);
+	uint32_t GetThread(uint32_t record);
+	uint32_t GetClass(uint32_t record);
+
+	std::string GetClassName(uint32_t id);
+	bool FindClass(const std::string& name, uint32_t& id);
+
+protected:
+	void Append(Severity severity, const std::string& text, const std::string& function);
+	void AddRecord(Severity severity, const char* line, size_t len, const std::string& function);
+	uint32_t GetClassID(const std::string& function);
+	uint32_t GetThreadID();
+	bool Matches(const Filter& filter, uint32_t record);
+	void ScanText(View& view, uint32_t start, uint32_t end);
+	void ScanPostings(View& view, const std::vector<uint32_t>& postings, uint32_t start, uint32_t end);
+
+	///@brief Text not yet stored because it doesn't end in a newline
+	std::string m_pending;
+
+	///@brief Most severe message that contributed to m_pending
+	Severity m_pendingSeverity;
+
+	///@brief Protects everything below
+	std::shared_mutex m_storeMutex;
+
+	///@brief Record text, each line followed by a newline
+	std::string m_arena;
+
+	///@brief Offset of each record's text in m_arena, plus one past the end
+	std::vector<uint64_t> m_offsets;
+
+	///@brief Time each record was completed, in ns since the Unix epoch
+	std::vector<uint64_t> m_timestamps;
+
+	///@brief Severity of each record
+	std::vector<uint8_t> m_severities;
+
+	///@brief Thread ID of each record (small integers, in order of first appearance)
+	std::vector<uint32_t> m_threads;
+
+	///@brief Class ID (interned class name) of each record, 0 for records not from LogTrace()
+	std::vector<uint32_t> m_classes;
+
+	///@brief Native thread ID to our thread ID
+	std::map<std::thread::id, uint32_t> m_threadIDs;
+
+	///@brief Record numbers for each class ID, indexed by interned string ID
+	std::vector<std::vector<uint32_t>> m_classPostings;
+
+	///@brief Record numbers for each thread ID
+	std::vector<std::vector<uint32_t>> m_threadPostings;
+
+	///@brief Bytes charged to the logging memory budget
+	size_t m_charged;
+
+	///@brief Capacity of all posting lists, in bytes
+	size_t m_postingBytes;
 };
 
 /**
-	@brief		Helper function for parsing arguments that use common syntax
+	@brief A log sink writing to a set of files, one per thread or per trace class, for offline merging
+
+	Each line is written as a record of tab separated fields:
+
+		sequence	timestamp	severity	text
+
+	where sequence is a global counter across all shards of the sink, timestamp is in ns since the Unix epoch and
+	severity is the numeric Severity. logtools-merge combines the shards back into a single ordered log.
+
+	The sequence number and the timestamp are read separately for each line, so across shards they can disagree by
+	the time it takes to format a line: a line with a later sequence number may have a slightly earlier timestamp.
+	logtools-merge orders by sequence number alone unless asked to order by time.
+
+	This is a concurrent sink (see LogSink::SetConcurrent()): messages reach it straight from the logging thread,
+	without g_log_mutex. Shards share nothing with each other except the sequence counter: each has its own lock,
+	line buffer, output buffer and file, and each thread finds its shards through a per-thread cache, so threads
+	writing to different shards never wait for each other. Output is written a block at a time, and immediately for
+	WARNING and more severe messages.
+ */
+class ShardedFileLogSink : public LogSink
+{
+public:
+	enum ShardMode
+	{
+		///@brief One file per logging thread
+		SHARD_BY_THREAD,
+
+		///@brief One file per LogTrace() class, plus one for everything else
+		SHARD_BY_CLASS
+	};
+
+	ShardedFileLogSink(
+		const std::string& prefix,
+		ShardMode mode = SHARD_BY_THREAD,
+		Severity min_severity = Severity::VERBOSE);
+	~ShardedFileLogSink() override;
+
+	void Log(Severity severity, const std::string &msg) override;
+	void Log(Severity severity, const char *format, va_list va) override;
+	void LogTraceMessage(const std::string& function, const std::string& msg) override;
+
+	void Flush();
+
+	///@brief Names of the files written so far
+	std::vector<std::string> GetFileNames();
+
+protected:
+	struct Shard
+	{
+		///@brief Protects everything below. Only contended in SHARD_BY_CLASS mode, or by Flush().
+		std::mutex lock;
+
+		std::string path;
+		FILE* file;
+
+		///@brief Text not yet written because it doesn't end in a newline
+		std::string pending;
+
+		///@brief Most severe message that contributed to pending
+		Severity pendingSeverity;
+
+		///@brief Formatted records not yet written to the file
+		std::string out;
+
+		///@brief Equivalent of LogSink::m_lastMessageWasNewline, per shard
+		bool lastWasNewline;
+	};
+
+	Shard* GetShard(const std::string& function);
+	void Append(Shard& shard, Severity severity, const std::string& text);
+	void WriteShard(Shard& shard);
+
+	///@brief Unique ID, for the per-thread shard cache
+	uint64_t m_id;
+
+	///@brief Path prefix of the shard files
+	std::string m_prefix;
+
+	ShardMode m_mode;
+
+	///@brief Protects m_shards and m_threadNames (not the shards themselves)
+	std::mutex m_shardsMutex;
+
+	///@brief Shards by thread or class name
+	std::map<std::string, std::unique_ptr<Shard>> m_shards;
+
+	///@brief Short names given to threads, in order of first appearance
+	std::map<std::thread::id, std::string> m_threadNames;
+
+	///@brief Sequence number of the next record
+	std::atomic<uint64_t> m_nextSequence;
+};
+
+class LogColumnWriter;
+
+/**
+	@brief A log sink writing a columnar binary file, for aggregate queries over long periods
+
+	Each line becomes a record of timestamp, severity, LogTrace() class and function (if any) and text. Records are
+	stored a column at a time in segments: timestamps delta encoded, severities run length encoded, class and function
+	names dictionary encoded and the text compressed. LogColumnReader (in LogColumnStore.h) reads the file back,
+	decoding only the columns a query needs.
+ */
+class ColumnarLogSink : public LogSink
+{
+public:
+	ColumnarLogSink(const std::string& path, Severity min_severity = Severity::VERBOSE);
+	~ColumnarLogSink() override;
+
+	void Log(Severity severity, const std::string &msg) override;
+	void Log(Severity severity, const char *format, va_list va) override;
+	void LogTraceMessage(const std::string& function, const std::string& msg) override;
+
+	bool IsOpen();
+	void Flush();
+
+protected:
+	void Append(Severity severity, const std::string& function, const std::string& text);
+
+	std::unique_ptr<LogColumnWriter> m_writer;
+
+	///@brief Text not yet written because it doesn't end in a newline
+	std::string m_pending;
+
+	///@brief Most severe message that contributed to m_pending
+	Severity m_pendingSeverity;
+
+	///@brief Trace function of the message that started m_pending
+	std::string m_pendingFunction;
+};
+
+#ifndef _WIN32
+
+struct SHMLogRingHeader;
+
+/**
+	@brief		A log sink writing to a ring buffer in POSIX shared memory
 	@ingroup	liblog
+
+	Any number of processes can write to the same ring without locking, and the logtools-collect tool reads one or
+	more rings and merges them by timestamp. Output is buffered until the end of a line so that partial lines from
+	different processes don't get mixed together.
+
+	The shared memory object is created by the first sink to open it and is not removed when the sink is destroyed.
  */
-bool ParseLoggerArguments(
-	int& i,
-	int argc,
-	char* argv[],
-	Severity& console_verbosity);
+class SHMLogSink : public LogSink
+{
+public:
+	SHMLogSink(const std::string& name, uint32_t slotCount = 16384, Severity min_severity = Severity::VERBOSE);
+	~SHMLogSink() override;
+
+	void Log(Severity severity, const std::string &msg) override;
+	void Log(Severity severity, const char *format, va_list va) override;
 
+	///@brief Returns true if the ring was opened successfully
+	bool IsOpen()
+	{ return m_ring != nullptr; }
 
-#ifdef __GNUC__
-#if defined(__MINGW32__) && !defined(__clang__)
-#define ATTR_FORMAT(n, m) __attribute__((__format__ (gnu_printf, n, m)))
-#else
-#define ATTR_FORMAT(n, m) __attribute__((__format__ (__printf__, n, m)))
-#endif
-#define ATTR_NORETURN     __attribute__((noreturn))
-#else
-//FIXME on MSVC/Windows
-#define ATTR_FORMAT(n, m)
-#define ATTR_NORETURN
-#endif
+protected:
+	void Commit(Severity severity, const char* text, size_t len);
+
+	///@brief Mapped ring
+	SHMLogRingHeader* m_ring;
+
+	///@brief Size of the mapping
+	size_t m_mapSize;
+
+	///@brief Text not yet written because it doesn't end in a newline
+	std::string m_pending;
+
+	///@brief Most severe message that contributed to m_pending
+	Severity m_pendingSeverity;
+};
 
 /**
-	\def(LogTrace(...)
+	@brief		A log sink sending to the system log daemon over a local datagram socket
 	@ingroup	liblog
 
-	Helper for logging "trace" messages with the class::function name prepended to the message.
+	Speaks either RFC 5424 syslog (normally to /dev/log) or the systemd-journald native protocol (normally to
+	/run/systemd/journal/socket). Each line becomes one log entry; the class and function of LogTrace() messages are
+	sent as structured fields rather than as part of the text.
 
-	Only printed if at debug level verbosity, plus explicitly turned on for this class or function
-	(usually by --trace command line argument)
+	Entries are queued and sent in batches, with sendmmsg() where available, whenever the batch fills up, a warning or
+	worse is logged, or the flush interval expires. Sends never block: if the daemon can't keep up, entries are
+	dropped and counted.
  */
-#ifdef __GNUC__
-#define LogTrace(...) LogDebugTrace(__PRETTY_FUNCTION__, ##__VA_ARGS__)
-#else
-#define LogTrace(...) LogDebugTrace(__func__, __VA_ARGS__)
-#endif
+class SyslogLogSink : public LogSink
+{
+public:
+	enum Protocol
+	{
+		PROTOCOL_SYSLOG,
+		PROTOCOL_JOURNALD
+	};
 
-ATTR_FORMAT(1, 2) void LogVerbose(const char *format, ...);
-ATTR_FORMAT(1, 2) void LogNotice(const char *format, ...);
-ATTR_FORMAT(1, 2) void LogWarning(const char *format, ...);
-ATTR_FORMAT(1, 2) void LogError(const char *format, ...);
-ATTR_FORMAT(1, 2) void LogDebug(const char *format, ...);
-ATTR_FORMAT(2, 3) void LogDebugTrace(const char* function, const char *format, ...);
-ATTR_FORMAT(1, 2) ATTR_NORETURN void LogFatal(const char *format, ...);
+	SyslogLogSink(
+		Protocol protocol,
+		const std::string& ident,
+		Severity min_severity = Severity::VERBOSE,
+		const std::string& path = "");
+	~SyslogLogSink() override;
 
-///Just print the message at given log level, don't do anything special for warnings or errors
-ATTR_FORMAT(2, 3) void Log(Severity severity, const char *format, ...);
+	void Log(Severity severity, const std::string &msg) override;
+	void Log(Severity severity, const char *format, va_list va) override;
+	void LogTraceMessage(const std::string& function, const std::string& msg) override;
+
+	void Flush();
+
+	///@brief Number of entries dropped because the daemon wasn't reachable or was too slow
+	uint64_t GetDroppedCount()
+	{ return m_dropped; }
+
+	///@brief Syslog facility for PROTOCOL_SYSLOG (default 1, user-level messages)
+	void SetFacility(int facility)
+	{ m_facility = facility; }
+
+protected:
+	void Append(Severity severity, const std::string& text, const std::string& function);
+	void Enqueue(Severity severity, const char* line, size_t len, const std::string& function);
+	void SendBatch();
+	void FlushThreadProc();
+	bool Connect();
+
+	///@brief Wire protocol
+	Protocol m_protocol;
+
+	///@brief Path of the daemon's socket
+	std::string m_path;
+
+	///@brief SYSLOG_IDENTIFIER / APP-NAME
+	std::string m_ident;
+
+	///@brief Our host name, for the syslog header
+	std::string m_hostname;
+
+	///@brief Syslog facility
+	int m_facility;
+
+	///@brief Socket connected to the daemon, or -1
+	int m_socket;
+
+	///@brief Encoded entries waiting to be sent
+	std::vector<std::string> m_batch;
+
+	///@brief Text not yet queued because it doesn't end in a newline
+	std::string m_pending;
+
+	///@brief Most severe message that contributed to m_pending
+	Severity m_pendingSeverity;
+
+	///@brief Number of entries dropped
+	std::atomic<uint64_t> m_dropped;
+
+	///@brief Protects m_batch and m_socket against the flush thread
+	std::mutex m_batchMutex;
+
+	///@brief Wakes up the flush thread
+	std::condition_variable m_flushCond;
+
+	///@brief Set to stop the flush thread
+	bool m_quit;
+
+	///@brief Thread sending out partial batches when the flush interval expires
+	std::thread m_flushThread;
+};
+
+/**
+	@brief		A log sink forwarding records to a remote collector over TCP
+	@ingroup	liblog
+
+	Each complete line is encoded as a length-prefixed frame: a little-endian uint32 giving the length of everything
+	after it, a uint64 timestamp (nanoseconds since the Unix epoch), a uint8 severity, a reserved byte, a uint16
+	function name length, the function name (for LogTrace() messages, otherwise empty) and finally the text.
+
+	Logging threads only append frames to an in-memory queue. A background thread sends the queue in batches,
+	reconnecting with exponential backoff when the connection drops. While disconnected, frames are spilled to an
+	optional on-disk spool file, which is replayed ahead of new frames once the connection comes back. Both the queue
+	and the spool are bounded; frames that don't fit are dropped and counted.
+ */
+class TCPLogSink : public LogSink
+{
+public:
+	TCPLogSink(
+		const std::string& host,
+		uint16_t port,
+		const std::string& spoolPath = "",
+		Severity min_severity = Severity::VERBOSE);
+	~TCPLogSink() override;
+
+	void Log(Severity severity, const std::string &msg) override;
+	void Log(Severity severity, const char *format, va_list va) override;
+	void LogTraceMessage(const std::string& function, const std::string& msg) override;
+
+	///@brief Number of frames dropped because the queue or spool was full
+	uint64_t GetDroppedCount()
+	{ return m_dropped; }
+
+	///@brief Returns true if the background thread currently has a connection to the collector
+	bool IsConnected()
+	{ return m_connected; }
+
+	///@brief Sets the maximum size of the in-memory queue, in bytes
+	void SetMaxQueueSize(size_t bytes)
+	{ m_maxQueueSize = bytes; }
+
+	///@brief Sets the maximum size of the spool file, in bytes
+	void SetMaxSpoolSize(size_t bytes)
+	{ m_maxSpoolSize = bytes; }
+
+protected:
+	void Append(Severity severity, const std::string& text, const std::string& function);
+	void EnqueueFrame(Severity severity, const char* line, size_t len, const std::string& function);
+	void SenderThreadProc();
+	bool ReplaySpool(int sock);
+	void SpillToSpool(const std::string& data);
+
+	///@brief Collector host name or address
+	std::string m_host;
+
+	///@brief Collector port
+	uint16_t m_port;
+
+	///@brief Spool file, empty if spooling is disabled. Only used by the sender thread once it's started.
+	std::string m_spoolPath;
+
+	///@brief Text not yet queued because it doesn't end in a newline
+	std::string m_pending;
+
+	///@brief Most severe message that contributed to m_pending
+	Severity m_pendingSeverity;
+
+	///@brief Encoded frames waiting to be sent
+	std::string m_queue;
+
+	///@brief Limit on m_queue
+	size_t m_maxQueueSize;
+
+	///@brief Limit on the spool file
+	size_t m_maxSpoolSize;
+
+	///@brief Number of frames dropped
+	std::atomic<uint64_t> m_dropped;
+
+	///@brief True while connected to the collector
+	std::atomic<bool> m_connected;
+
+	///@brief Protects m_queue and m_quit
+	std::mutex m_queueMutex;
+
+	///@brief Wakes up the sender thread
+	std::condition_variable m_queueCond;
+
+	///@brief Set to stop the sender thread
+	bool m_quit;
+
+	///@brief Thread doing all the network and spool I/O
+	std::thread m_senderThread;
+};
+
+/**
+	@brief A log sink exporting records to an OpenTelemetry collector using OTLP/HTTP with JSON encoding
+
+	Each complete line becomes one log record, carrying the OTLP severity number and text, the thread ID, any LogTag
+	attributes in effect, and (for LogTrace() output) the class and function name as code.function. Records are batched on a background thread and
+	POSTed to the collector once a batch reaches its size limit or has been waiting for the flush interval, whichever
+	comes first. Batches that fail with a connection error, 429 or 5xx are retried with exponential backoff; new
+	records keep queueing meanwhile, up to a byte limit past which they are dropped and counted.
+ */
+class OTLPLogSink : public LogSink
+{
+public:
+	OTLPLogSink(
+		const std::string& host,
+		uint16_t port,
+		const std::string& serviceName,
+		Severity min_severity = Severity::VERBOSE);
+	~OTLPLogSink() override;
+
+	void Log(Severity severity, const std::string &msg) override;
+	void Log(Severity severity, const char *format, va_list va) override;
+	void LogTraceMessage(const std::string& function, const std::string& msg) override;
+
+	void SetResourceAttribute(const std::string& key, const std::string& value);
+
+	///@brief Sets the HTTP path requests are POSTed to (default /v1/logs)
+	void SetPath(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		m_path = path;
+	}
+
+	///@brief Sets the size (in bytes of encoded records) at which a batch is sent without waiting
+	void SetMaxBatchSize(size_t bytes)
+	{ m_maxBatchSize = bytes; }
+
+	///@brief Sets how long a record may wait for more to fill its batch before being sent anyway
+	void SetFlushInterval(std::chrono::milliseconds interval)
+	{ m_flushInterval = interval; }
+
+	///@brief Sets the maximum number of bytes of encoded records queued for sending
+	void SetMaxQueueSize(size_t bytes)
+	{ m_maxQueueSize = bytes; }
+
+	///@brief Number of records dropped because the queue was full or the collector rejected them
+	uint64_t GetDroppedCount()
+	{ return m_dropped; }
+
+	///@brief Number of records the collector has accepted
+	uint64_t GetExportedCount()
+	{ return m_exported; }
+
+protected:
+	void Append(Severity severity, const std::string& text, const std::string& function);
+	void EnqueueRecord(Severity severity, const char* line, size_t len, const std::string& function);
+	void SenderThreadProc();
+	std::string BuildRequestBody(const std::string& records);
+	int PostBatch(int& sock, const std::string& body);
+
+	///@brief Collector host name or address
+	std::string m_host;
+
+	///@brief Collector port
+	uint16_t m_port;
+
+	///@brief HTTP request path
+	std::string m_path;
+
+	///@brief Encoded resource attributes (a JSON array body, without the brackets)
+	std::string m_resourceAttributes;
+
+	///@brief Text not yet queued because it doesn't end in a newline
+	std::string m_pending;
+
+	///@brief Most severe message that contributed to m_pending
+	Severity m_pendingSeverity;
+
+	///@brief Encoded log records waiting to be sent, each terminated by a newline
+	std::string m_queue;
+
+	///@brief Number of records in m_queue
+	size_t m_queueCount;
+
+	///@brief When the oldest record in m_queue was added
+	std::chrono::steady_clock::time_point m_queueStart;
+
+	///@brief Limit on m_queue
+	std::atomic<size_t> m_maxQueueSize;
+
+	///@brief Batch size that triggers an immediate send
+	std::atomic<size_t> m_maxBatchSize;
+
+	///@brief Longest a record waits for its batch to fill
+	std::atomic<std::chrono::milliseconds> m_flushInterval;
+
+	///@brief Records dropped
+	std::atomic<uint64_t> m_dropped;
+
+	///@brief Records exported
+	std::atomic<uint64_t> m_exported;
+
+	std::mutex m_queueMutex;
+	std::condition_variable m_queueCond;
+	bool m_quit;
+	std::thread m_senderThread;
+};
+
+#endif
+
+extern std::mutex g_log_mutex;
+extern std::vector<std::unique_ptr<LogSink>> g_log_sinks;
+extern std::set<std::string> g_trace_filters;
+
+/**
+	@brief		RAII wrapper for log indentation
+	@ingroup	liblog
+
+	Log messages are indented once for each LogIndenter object in the call stack.
+ */
+class LogIndenter
+{
+public:
+	LogIndenter();
+
+	~LogIndenter();
+};
+
+/**
+	@brief		Helper function for parsing arguments that use common syntax
+	@ingroup	liblog
+ */
+bool ParseLoggerArguments(
+	int& i,
+	int argc,
+	char* argv[],
+	Severity& console_verbosity);
+
+
+#ifdef __GNUC__
+#if defined(__MINGW32__) && !defined(__clang__)
+#define ATTR_FORMAT(n, m) __attribute__((__format__ (gnu_printf, n, m)))
+#else
+#define ATTR_FORMAT(n, m) __attribute__((__format__ (__printf__, n, m)))
+#endif
+#define ATTR_NORETURN     __attribute__((noreturn))
+#else
+//FIXME on MSVC/Windows
+#define ATTR_FORMAT(n, m)
+#define ATTR_NORETURN
+#endif
+
+/**
+	\def(LogTrace(...)
+	@ingroup	liblog
+
+	Helper for logging "trace" messages with the class::function name prepended to the message.
+
+	Only printed if at debug level verbosity, plus explicitly turned on for this class or function
+	(usually by --trace command line argument)
+ */
+#ifdef __GNUC__
+#define LogTrace(...) LogDebugTrace(LOG_TRACE_SITE(), __PRETTY_FUNCTION__, ##__VA_ARGS__)
+#else
+#define LogTrace(...) LogDebugTrace(LOG_TRACE_SITE(), __func__, __VA_ARGS__)
+#endif
+
+/**
+	@brief		Per-call-site result of the trace filter check, for LogTrace(), LOG_TRACE() and LogTraceLazy()
+	@ingroup	liblog
+
+	Holds the interned "class::function" ID of the call site (0 if its trace messages aren't printed) in the low half,
+	and the LogTraceFiltersChanged() generation it was computed at in the high half. Zero means not computed yet, which
+	is what a function-local static starts as without any initialization guard. Don't use directly.
+ */
+struct LogTraceSiteCache
+{
+	std::atomic<uint64_t> state;
+};
+
+/**
+	\def LOG_TRACE_SITE()
+	@ingroup	liblog
+
+	A LogTraceSiteCache unique to the place the macro is expanded
+ */
+#define LOG_TRACE_SITE() ([]() -> LogTraceSiteCache& { static LogTraceSiteCache cache_; return cache_; }())
+
+uint32_t LogTraceSiteID(LogTraceSiteCache& cache, const char* function);
+bool LogTraceIsEnabled(LogTraceSiteCache& cache, const char* function);
+void LogTraceFiltersChanged();
+
+ATTR_FORMAT(1, 2) void LogVerbose(const char *format, ...);
+ATTR_FORMAT(1, 2) void LogNotice(const char *format, ...);
+ATTR_FORMAT(1, 2) void LogWarning(const char *format, ...);
+ATTR_FORMAT(1, 2) void LogError(const char *format, ...);
+ATTR_FORMAT(1, 2) void LogDebug(const char *format, ...);
+ATTR_FORMAT(2, 3) void LogDebugTrace(const char* function, const char *format, ...);
+ATTR_FORMAT(3, 4) void LogDebugTrace(LogTraceSiteCache& cache, const char* function, const char *format, ...);
+ATTR_FORMAT(1, 2) ATTR_NORETURN void LogFatal(const char *format, ...);
+
+///Just print the message at given log level, don't do anything special for warnings or errors
+ATTR_FORMAT(2, 3) void Log(Severity severity, const char *format, ...);
+
+struct LogBatchBuffer;
+
+/**
+	@brief		Builder for printing many lines at once
+	@ingroup	liblog
+
+	Lines added to a batch are buffered in a per-thread buffer (reused from one batch to the next) and sent to the
+	sinks under a single lock acquisition when Commit() is called or the batch goes out of scope. Lines from one batch
+	are never interleaved with output from other threads.
+
+	Each line is indented by the LogIndenter level at the time it was added plus the batch's own Indent() level.
+	Lines are printed as-is at the batch's severity, like Log(); no "ERROR: " etc prefix is added.
+ */
+class LogBatch
+{
+public:
+	LogBatch(Severity severity = Severity::NOTICE);
+	~LogBatch();
+
+	LogBatch(const LogBatch&) = delete;
+	LogBatch& operator=(const LogBatch&) = delete;
+
+	ATTR_FORMAT(2, 3) void Add(const char* format, ...);
+
+	///@brief Indents subsequently added lines by one more level
+	void Indent()
+	{ m_indent ++; }
+
+	///@brief Undoes one Indent() call
+	void Unindent()
+	{
+		if(m_indent)
+			m_indent --;
+	}
+
+	void Commit();
+
+protected:
+
+	///@brief Severity all lines in the batch are printed at
+	Severity m_severity;
+
+	///@brief Extra indentation applied to new lines, on top of g_logIndentLevel
+	unsigned int m_indent;
+
+	///@brief Buffered text, borrowed from the per-thread pool
+	LogBatchBuffer* m_buffer;
+};
+
+bool LogIsEnabled(Severity severity);
+bool LogIsEnabled(Severity severity, const char* function);
+bool LogStreamIsEnabled(Severity severity);
+
+struct LogStreamBuffer;
+
+/**
+	@brief		A single message built with stream-style << syntax
+	@ingroup	liblog
+
+	Text is formatted into a per-thread ostream and buffer that are reused from one message to the next, and sent to
+	the sinks when the LogStream is destroyed. Don't use directly, use the LOG() and LOG_TRACE() macros.
+ */
+class LogStream
+{
+public:
+	LogStream(Severity severity, const char* function = nullptr, const char* site = nullptr);
+	LogStream(LogTraceSiteCache& cache, const char* function);
+	~LogStream();
+
+	LogStream(const LogStream&) = delete;
+	LogStream& operator=(const LogStream&) = delete;
+
+	std::ostream& stream();
+
+protected:
+
+	///@brief Severity of the message
+	Severity m_severity;
+
+	///@brief Decorated name of the calling function, for trace messages only
+	const char* m_function;
+
+	///@brief Interned "class::function" of a trace message from LOG_TRACE(), or 0 to look it up from m_function
+	uint32_t m_traceID;
+
+	///@brief File and line of the LOG() statement, or null
+	const char* m_site;
+
+	///@brief Return address of the constructor, identifying the call site in the error summary
+	void* m_caller;
+
+	///@brief Stream and buffer, borrowed from the per-thread pool
+	LogStreamBuffer* m_buffer;
+
+	///@brief True if the message goes to the error summary (and isn't budgeted, like LogWarning() then)
+	bool m_summarized;
+
+	///@brief True if the site is over its LogSetSiteBudget() budget
+	bool m_demoted;
+};
+
+/**
+	@brief		Helper for LOG(): swallows the ostream so both branches of the ?: have type void
+	@ingroup	liblog
+ */
+class LogStreamVoidify
+{
+public:
+	void operator&(std::ostream&)
+	{}
+};
+
+/**
+	\def LOG(severity)
+	@ingroup	liblog
+
+	Stream-style logging, for example LOG(NOTICE) << "rate " << r << " Hz";
+
+	Nothing to the right of LOG() is evaluated unless some sink will print the message. A newline is added to the end
+	of the message if it doesn't already have one. ERROR, WARNING and FATAL messages get the same prefixes as
+	LogError() etc, and LOG(FATAL) aborts. Like LogFatal(), it does so even when no sink is registered.
+
+	Each LOG() statement is a site for LogSetSiteBudget() and LogEnableErrorSummary(), named by its file and line.
+ */
+#ifndef LOG
+#define LOG_STRINGIFY_(x) #x
+#define LOG_STRINGIFY(x) LOG_STRINGIFY_(x)
+#define LOG(severity) \
+	( (Severity::severity != Severity::FATAL) && !LogStreamIsEnabled(Severity::severity) ) ? \
+		(void)0 : LogStreamVoidify() & \
+		LogStream(Severity::severity, nullptr, __FILE__ ":" LOG_STRINGIFY(__LINE__)).stream()
+#endif
+
+/**
+	\def LOG_TRACE()
+	@ingroup	liblog
+
+	Stream-style equivalent of LogTrace(), printed only at debug verbosity for classes in the trace filter list.
+ */
+#ifndef LOG_TRACE
+#ifdef __GNUC__
+#define LOG_TRACE() \
+	!LogTraceIsEnabled(LOG_TRACE_SITE(), __PRETTY_FUNCTION__) ? \
+		(void)0 : LogStreamVoidify() & LogStream(LOG_TRACE_SITE(), __PRETTY_FUNCTION__).stream()
+#else
+#define LOG_TRACE() \
+	!LogTraceIsEnabled(LOG_TRACE_SITE(), __func__) ? \
+		(void)0 : LogStreamVoidify() & LogStream(LOG_TRACE_SITE(), __func__).stream()
+#endif
+#endif
+
+/**
+	@ingroup	liblog
+
+	Macro wrappers for the functions above that skip evaluating their arguments (and formatting) entirely when the
+	message would be discarded, for example LogDebugLazy("%s", waveform->ToString().c_str()).
+ */
+#define LogVerboseLazy(...) (LogIsEnabled(Severity::VERBOSE) ? LogVerbose(__VA_ARGS__) : (void)0)
+#define LogNoticeLazy(...) (LogIsEnabled(Severity::NOTICE) ? LogNotice(__VA_ARGS__) : (void)0)
+#define LogWarningLazy(...) (LogIsEnabled(Severity::WARNING) ? LogWarning(__VA_ARGS__) : (void)0)
+#define LogErrorLazy(...) (LogIsEnabled(Severity::ERROR) ? LogError(__VA_ARGS__) : (void)0)
+#define LogDebugLazy(...) (LogIsEnabled(Severity::DEBUG) ? LogDebug(__VA_ARGS__) : (void)0)
+
+#ifdef __GNUC__
+#define LogTraceLazy(...) \
+	(LogTraceIsEnabled(LOG_TRACE_SITE(), __PRETTY_FUNCTION__) ? \
+		LogDebugTrace(LOG_TRACE_SITE(), __PRETTY_FUNCTION__, ##__VA_ARGS__) : (void)0)
+#else
+#define LogTraceLazy(...) \
+	(LogTraceIsEnabled(LOG_TRACE_SITE(), __func__) ? LogDebugTrace(LOG_TRACE_SITE(), __func__, __VA_ARGS__) : (void)0)
+#endif
+
+/**
+	@brief		Captures the messages logged by the current thread while it exists
+	@ingroup	liblog
+
+	For example, to attach everything logged during one operation to an error report:
+
+		LogCapture capture;
+		SaveSession();
+		if(failed)
+			ReportError(capture.GetText());
+
+	Only messages from the thread that created the capture are recorded; other threads are unaffected. Captures nest:
+	a message goes to the innermost capture first and then outward, and finally to the sinks as usual. A capture
+	created with propagate = false stops it there, so neither enclosing captures nor the sinks see it (useful to keep
+	expected errors in a test out of the console).
+
+	Captures must be destroyed on the thread that created them, in reverse order of creation (which is automatic
+	for local variables). A capture is part of the LogContext, so work handed to other threads with LogThread(),
+	LogContext::Wrap() or LogThreadPool is captured too; such work must finish before the capture is destroyed.
+ */
+class LogCapture
+{
+public:
+	///@brief One captured message
+	struct Record
+	{
+		Severity severity;
+
+		///@brief LogIndenter level at the time of the message
+		unsigned int indent;
+
+		///@brief Class and function name for LogTrace() output, otherwise empty
+		std::string function;
+
+		///@brief Message text as formatted, including any "ERROR: " etc prefix
+		std::string text;
+	};
+
+	LogCapture(Severity min_severity = Severity::DEBUG, bool propagate = true);
+	~LogCapture();
+
+	LogCapture(const LogCapture&) = delete;
+	LogCapture& operator=(const LogCapture&) = delete;
+
+	std::vector<Record> GetRecords() const;
+	std::string GetText() const;
+
+	///@brief Sets a function to be called with the capture just before it's destroyed
+	void OnComplete(std::function<void(const LogCapture&)> fn)
+	{ m_onComplete = fn; }
+
+	static bool Capture(Severity severity, const std::string& function, const std::string& msg);
+
+protected:
+
+	///@brief Least severe level to capture
+	Severity m_severity;
+
+	///@brief True to pass captured messages on to enclosing captures and the sinks
+	bool m_propagate;
+
+	///@brief Enclosing capture on this thread, if any
+	LogCapture* m_parent;
+
+	///@brief Value of the per-thread capture severity before this capture was created
+	int m_savedSeverity;
+
+	std::vector<Record> m_records;
+
+	std::function<void(const LogCapture&)> m_onComplete;
+};
+
+struct LogTagNode;
+
+/**
+	@brief		The per-thread state that affects logging: indentation, tags and active captures
+	@ingroup	liblog
+
+	A context is a few words plus one reference-counted pointer, so taking a snapshot with Current() and installing
+	it on another thread with LogContextScope are both O(1). Executors should snapshot when work is submitted and
+	install the snapshot while it runs, so the work logs as if it were still on the submitting thread:
+
+		pool.Submit(LogContext::Current().Wrap([]{ LogNotice("indented like the caller\n"); }));
+
+	LogThread() and LogThreadPool do this automatically.
+ */
+class LogContext
+{
+public:
+	LogContext();
+
+	static LogContext Current();
+	void Apply() const;
+
+	std::vector<std::pair<std::string, std::string>> GetTags() const;
+
+	///@brief Returns a function that runs fn with this context installed
+	template<class F> auto Wrap(F fn) const;
+
+protected:
+
+	///@brief LogIndenter level
+	unsigned int m_indent;
+
+	///@brief Innermost tag, linked to the ones outside it
+	std::shared_ptr<const LogTagNode> m_tags;
+
+	///@brief Innermost active capture
+	LogCapture* m_capture;
+
+	///@brief Highest severity wanted by the captures
+	int m_captureSeverity;
+};
+
+/**
+	@brief		Installs a LogContext on the current thread, restoring the previous one when destroyed
+	@ingroup	liblog
+ */
+class LogContextScope
+{
+public:
+	LogContextScope(const LogContext& context)
+		: m_saved(LogContext::Current())
+	{ context.Apply(); }
+
+	~LogContextScope()
+	{ m_saved.Apply(); }
+
+	LogContextScope(const LogContextScope&) = delete;
+	LogContextScope& operator=(const LogContextScope&) = delete;
+
+protected:
+	LogContext m_saved;
+};
+
+template<class F> auto LogContext::Wrap(F fn) const
+{
+	return [context = *this, fn = std::move(fn)]() mutable
+	{
+		LogContextScope scope(context);
+		return fn();
+	};
+}
+
+/**
+	@brief		Attaches a key/value tag to the current context while it exists
+	@ingroup	liblog
+
+	Tags are carried along with the context to other threads. Sinks producing structured output (such as
+	OTLPLogSink) attach the current tags to each record.
+ */
+class LogTag
+{
+public:
+	LogTag(const std::string& key, const std::string& value);
+	~LogTag();
+
+	LogTag(const LogTag&) = delete;
+	LogTag& operator=(const LogTag&) = delete;
+
+protected:
+
+	///@brief Tags in effect before this one
+	std::shared_ptr<const LogTagNode> m_saved;
+};
+
+/**
+	@brief		Starts a std::thread that runs with the calling thread's LogContext
+	@ingroup	liblog
+ */
+template<class F, class... Args> std::thread LogThread(F&& fn, Args&&... args)
+{
+	return std::thread(
+		[context = LogContext::Current(), fn = std::forward<F>(fn)](auto&&... a) mutable
+		{
+			LogContextScope scope(context);
+			std::invoke(fn, std::forward<decltype(a)>(a)...);
+		},
+		std::forward<Args>(args)...);
+}
+
+struct LogRegionBuffer;
+
+/**
+	@brief		Collects the output of a parallel loop and prints it in a deterministic order when the loop is done
+	@ingroup	liblog
+
+	Within a LogParallelKey, messages from the current thread are appended to a private per-thread buffer instead
+	of being printed, so parallel iterations don't contend on g_log_mutex. When the region is destroyed (or Flush()
+	is called) all buffers are merged in key order and printed as one block:
+
+		LogParallelRegion region;
+		#pragma omp parallel for
+		for(int i=0; i<n; i++)
+		{
+			LogParallelKey key(region, i);
+			LogDebug("channel %d: gain %f\n", i, gain[i]);
+		}
+
+	Messages are printed on the thread flushing the region, so that thread's LogCapture (if any) sees them. LOG(FATAL)
+	and LogFatal() are printed immediately.
+ */
+class LogParallelRegion
+{
+public:
+	LogParallelRegion();
+	~LogParallelRegion();
+
+	LogParallelRegion(const LogParallelRegion&) = delete;
+	LogParallelRegion& operator=(const LogParallelRegion&) = delete;
+
+	void Flush();
+
+protected:
+	friend class LogParallelKey;
+
+	LogRegionBuffer* GetBuffer();
+
+	///@brief Unique ID, for the per-thread buffer cache
+	uint64_t m_id;
+
+	///@brief Protects m_buffers
+	std::mutex m_mutex;
+
+	///@brief One buffer per thread that has logged in this region
+	std::vector<std::unique_ptr<LogRegionBuffer>> m_buffers;
+};
+
+/**
+	@brief		Routes the current thread's messages into a LogParallelRegion, under a key, while it exists
+	@ingroup	liblog
+ */
+class LogParallelKey
+{
+public:
+	LogParallelKey(LogParallelRegion& region, uint64_t key);
+	~LogParallelKey();
+
+	LogParallelKey(const LogParallelKey&) = delete;
+	LogParallelKey& operator=(const LogParallelKey&) = delete;
+
+protected:
+	LogRegionBuffer* m_savedBuffer;
+	uint64_t m_savedKey;
+};
+
+class LogCountSlot;
+
+/**
+	@brief		A LogCount() call site, which prints one summary per interval instead of a line per hit
+	@ingroup	liblog
+
+	Sites are created the first time they're reached and live until the program exits.
+ */
+class LogCountSite
+{
+public:
+	static LogCountSite& Create(Severity severity, const char* function, const char* format);
+
+	static std::string Format(const char* format, ...);
+
+	///@brief printf-style format of the site's message
+	const char* GetFormat() const
+	{ return m_format; }
+
+	void AddSlot(LogCountSlot* slot);
+	void RemoveSlot(LogCountSlot* slot);
+	void SetFirst(uint64_t epoch, std::string text);
+	void Emit(uint64_t epoch, double seconds);
+
+protected:
+	LogCountSite(Severity severity, const char* function, const char* format);
+
+	Severity m_severity;
+	const char* m_format;
+
+	///@brief "class::function" name of the caller, or empty if it couldn't be parsed
+	std::string m_function;
+
+	///@brief Protects everything below
+	std::mutex m_mutex;
+
+	///@brief Counters of the threads that have hit the site
+	std::vector<LogCountSlot*> m_slots;
+
+	///@brief Hits not yet printed from threads that have exited, and their last message
+	uint64_t m_retired;
+	std::string m_retiredLast;
+
+	///@brief Message of the first hit in interval m_firstEpoch
+	std::string m_first;
+	uint64_t m_firstEpoch;
+};
+
+/**
+	@brief		One thread's hit counter for a LogCount() site
+	@ingroup	liblog
+
+	The count is only written by the owning thread, so a hit is a plain increment; the thread printing the summary
+	reads it and remembers how much it has already printed.
+ */
+class LogCountSlot
+{
+public:
+	LogCountSlot(LogCountSite& site)
+		: m_site(site)
+		, m_count(0)
+		, m_printed(0)
+		, m_epoch(0)
+	{}
+
+	virtual ~LogCountSlot()
+	{}
+
+	///@brief Formats the message with the arguments of the latest hit
+	virtual std::string FormatLast() = 0;
+
+	LogCountSite& m_site;
+
+	///@brief Number of hits on this thread
+	std::atomic<uint64_t> m_count;
+
+	///@brief Hits already included in a summary (owned by LogCountSite)
+	uint64_t m_printed;
+
+	///@brief Interval of this thread's latest hit, to spot its first hit in each interval
+	uint64_t m_epoch;
+};
+
+/**
+	@brief Number of the current LogCount() interval
+ */
+extern std::atomic<uint64_t> g_logCountEpoch;
+
+/**
+	@brief		LogCountSlot for a particular set of argument types
+	@ingroup	liblog
+
+	The arguments of the latest hit are kept as raw bits behind a sequence lock, so the thread printing the summary
+	can copy out a consistent set while the owning thread keeps hitting the site.
+ */
+template<class... Args> class LogCountSlotT : public LogCountSlot
+{
+public:
+	LogCountSlotT(LogCountSite& site)
+		: LogCountSlot(site)
+		, m_sequence(0)
+	{
+		for(auto& a : m_args)
+			a.store(0, std::memory_order_relaxed);
+		site.AddSlot(this);
+	}
+
+	~LogCountSlotT() override
+	{ m_site.RemoveSlot(this); }
+
+	void Hit(Args... args)
+	{
+		m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		uint64_t epoch = g_logCountEpoch.load(std::memory_order_relaxed);
+		if(epoch != m_epoch)
+		{
+			m_epoch = epoch;
+			m_site.SetFirst(epoch, LogCountSite::Format(m_site.GetFormat(), args...));
+		}
+
+		unsigned int seq = m_sequence.load(std::memory_order_relaxed);
+		m_sequence.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		size_t i = 0;
+		(m_args[i++].store(Pack(args), std::memory_order_relaxed), ...);
+		m_sequence.store(seq + 2, std::memory_order_release);
+	}
+
+	std::string FormatLast() override
+	{
+		uint64_t values[sizeof(m_args) / sizeof(m_args[0])];
+		unsigned int before;
+		unsigned int after;
+		do
+		{
+			before = m_sequence.load(std::memory_order_acquire);
+			for(size_t i=0; i<sizeof...(Args); i++)
+				values[i] = m_args[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = m_sequence.load(std::memory_order_relaxed);
+		} while( (before & 1) || (before != after) );
+
+		return FormatValues(values, std::index_sequence_for<Args...>());
+	}
+
+protected:
+	template<class T> static uint64_t Pack(T value)
+	{
+		uint64_t bits = 0;
+		memcpy(&bits, &value, sizeof(T));
+		return bits;
+	}
+
+	template<class T> static T Unpack(uint64_t bits)
+	{
+		T value;
+		memcpy(&value, &bits, sizeof(T));
+		return value;
+	}
+
+	template<size_t... I> std::string FormatValues(const uint64_t* values, std::index_sequence<I...>)
+	{ return LogCountSite::Format(m_site.GetFormat(), Unpack<Args>(values[I])...); }
+
+	///@brief Odd while the arguments are being written
+	std::atomic<unsigned int> m_sequence;
+
+	std::atomic<uint64_t> m_args[sizeof...(Args) ? sizeof...(Args) : 1];
+};
+
+/**
+	@brief		Owns a thread's LogCountSlot for one site, deleting it when the thread exits
+	@ingroup	liblog
+ */
+struct LogCountSlotHolder
+{
+	LogCountSlot* slot = nullptr;
+
+	~LogCountSlotHolder()
+	{ delete slot; }
+};
+
+/**
+	@brief		Records a hit on a LogCount() site. Use the LogCount() macro rather than calling this directly.
+	@ingroup	liblog
+ */
+template<class... Args> void LogCountHit(LogCountSite& site, LogCountSlotHolder& holder, Args... args)
+{
+	static_assert( ( (std::is_arithmetic<Args>::value && (sizeof(Args) <= 8) ) && ...),
+		"LogCount() arguments must be numbers, since the latest ones are kept without copying strings on every hit");
+
+	if(!holder.slot)
+		holder.slot = new LogCountSlotT<Args...>(site);
+	static_cast<LogCountSlotT<Args...>*>(holder.slot)->Hit(args...);
+}
+
+void LogSetCountInterval(std::chrono::milliseconds interval);
+void LogFlushCounts();
+
+/**
+	\def LogCount(severity, format, ...)
+	@ingroup	liblog
+
+	Counts hits on a log site that's too hot to print a line for every time. Once per interval (one second by default,
+	see LogSetCountInterval()) a background thread prints one line per site that was hit, like:
+
+		Decoder::OnPacket: 1000000 times in 1.00 s (first: got packet 17 len 64, last: got packet 1000016 len 128)
+
+	A hit costs an increment and a few stores. The message is only formatted for the first hit on each thread in each
+	interval, and for the latest hit when the summary is printed. Arguments must be numbers, and format must be a
+	string literal. LogFlushCounts() prints the summaries immediately; it also runs when the program exits.
+ */
+#ifdef __GNUC__
+#define LogCount(severity, format, ...) \
+	do \
+	{ \
+		static LogCountSite& logCountSite_ = LogCountSite::Create(severity, __PRETTY_FUNCTION__, format); \
+		static thread_local LogCountSlotHolder logCountSlot_; \
+		if(LogIsEnabled(severity)) \
+			LogCountHit(logCountSite_, logCountSlot_, ##__VA_ARGS__); \
+	} while(0)
+#else
+#define LogCount(severity, format, ...) \
+	do \
+	{ \
+		static LogCountSite& logCountSite_ = LogCountSite::Create(severity, __func__, format); \
+		static thread_local LogCountSlotHolder logCountSlot_; \
+		if(LogIsEnabled(severity)) \
+			LogCountHit(logCountSite_, logCountSlot_, __VA_ARGS__); \
+	} while(0)
+#endif
+
+/**
+	@brief		Occurrences of one warning or error, as collected after LogEnableErrorSummary()
+	@ingroup	liblog
+ */
+struct LogErrorSummaryEntry
+{
+	Severity severity;
+
+	///@brief printf-style format of the message
+	std::string format;
+
+	///@brief Return address of the LogError() etc call, and the same as "symbol+offset" or "module+offset"
+	void* caller;
+	std::string site;
+
+	uint64_t count;
+	std::chrono::system_clock::time_point first;
+	std::chrono::system_clock::time_point last;
+
+	///@brief Text of the first and latest occurrence, as samples of the arguments
+	std::string firstMessage;
+	std::string lastMessage;
+};
+
+void LogSetSiteBudget(unsigned int messagesPerSecond, Severity mostSevere = Severity::NOTICE);
+
+void LogEnableErrorSummary(bool enable = true);
+void LogSetErrorSummaryInterval(std::chrono::milliseconds interval);
+std::vector<LogErrorSummaryEntry> LogGetErrorSummary();
+void LogClearErrorSummary();
+void LogPrintErrorSummary();
 
 #undef ATTR_FORMAT
 #undef ATTR_NORETURN
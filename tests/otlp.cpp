@@ -0,0 +1,699 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Tests for OTLPLogSink against a minimal HTTP/1.1 collector on the loopback interface
+	@ingroup	liblog
+
+	Covers the encoded request (valid JSON, severity mapping, escaping, attributes), batching by size and by time, and
+	the retry policy: connection errors, 429 and 5xx are retried with backoff, other 4xx responses drop the batch.
+ */
+
+#include "log.h"
+#include <cstring>
+#include <deque>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+//Not on macOS. The sinks never hang up mid-response in these tests, so SIGPIPE isn't a concern there
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static int g_failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+	if(!ok)
+	{
+		fprintf(stderr, "FAILED: %s\n", what);
+		g_failures ++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stand-in collector
+
+/**
+	@brief A request received by TestCollector
+ */
+struct TestRequest
+{
+	string method;
+	string path;
+	string headers;
+	string body;
+	chrono::steady_clock::time_point received;
+};
+
+/**
+	@brief Just enough of an HTTP/1.1 server to receive OTLP exports
+
+	Serves one keep-alive connection at a time, answers each request with the next status from a script (200 once
+	the script runs out) and records everything it receives.
+ */
+class TestCollector
+{
+public:
+	TestCollector()
+	: m_listener(-1)
+	, m_port(0)
+	, m_quit(false)
+	{
+		m_listener = socket(AF_INET, SOCK_STREAM, 0);
+		int yes = 1;
+		setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		socklen_t len = sizeof(addr);
+		if( (bind(m_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) ||
+			(listen(m_listener, 4) != 0) ||
+			(getsockname(m_listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0) )
+		{
+			perror("TestCollector");
+			exit(1);
+		}
+		m_port = ntohs(addr.sin_port);
+
+		m_thread = thread(&TestCollector::ThreadProc, this);
+	}
+
+	~TestCollector()
+	{
+		m_quit = true;
+		m_thread.join();
+		close(m_listener);
+	}
+
+	uint16_t GetPort()
+	{ return m_port; }
+
+	///@brief Queues status codes to answer the next requests with
+	void Script(initializer_list<int> statuses)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_script.insert(m_script.end(), statuses);
+	}
+
+	///@brief Waits until at least count requests have arrived, returns false on timeout
+	bool WaitFor(size_t count, chrono::milliseconds timeout = chrono::milliseconds(5000))
+	{
+		unique_lock<mutex> lock(m_mutex);
+		return m_cond.wait_for(lock, timeout, [&] { return m_requests.size() >= count; });
+	}
+
+	vector<TestRequest> GetRequests()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_requests;
+	}
+
+	void Clear()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_requests.clear();
+		m_script.clear();
+	}
+
+protected:
+
+	///@brief Waits for a socket to become readable, returns false if we're shutting down
+	bool WaitReadable(int sock)
+	{
+		while(!m_quit)
+		{
+			pollfd pfd = {sock, POLLIN, 0};
+			if(poll(&pfd, 1, 20) > 0)
+				return true;
+		}
+		return false;
+	}
+
+	void ThreadProc()
+	{
+		while(WaitReadable(m_listener))
+		{
+			int sock = accept(m_listener, nullptr, nullptr);
+			if(sock < 0)
+				continue;
+			Serve(sock);
+			close(sock);
+		}
+	}
+
+	///@brief Handles requests on one connection until the client closes it
+	void Serve(int sock)
+	{
+		string data;
+		char buf[4096];
+		while(true)
+		{
+			size_t headerEnd;
+			while( (headerEnd = data.find("\r\n\r\n")) == string::npos)
+			{
+				if(!WaitReadable(sock))
+					return;
+				ssize_t n = recv(sock, buf, sizeof(buf), 0);
+				if(n <= 0)
+					return;
+				data.append(buf, n);
+			}
+
+			TestRequest req;
+			req.headers = data.substr(0, headerEnd + 2);
+			char method[16];
+			char path[256];
+			if(sscanf(req.headers.c_str(), "%15s %255s HTTP/1.1", method, path) != 2)
+				return;
+			req.method = method;
+			req.path = path;
+
+			size_t clen = 0;
+			size_t pos = req.headers.find("Content-Length: ");
+			if(pos != string::npos)
+				clen = strtoul(req.headers.c_str() + pos + 16, nullptr, 10);
+			data.erase(0, headerEnd + 4);
+			while(data.length() < clen)
+			{
+				if(!WaitReadable(sock))
+					return;
+				ssize_t n = recv(sock, buf, sizeof(buf), 0);
+				if(n <= 0)
+					return;
+				data.append(buf, n);
+			}
+			req.body = data.substr(0, clen);
+			data.erase(0, clen);
+			req.received = chrono::steady_clock::now();
+
+			int status = 200;
+			{
+				lock_guard<mutex> lock(m_mutex);
+				if(!m_script.empty())
+				{
+					status = m_script.front();
+					m_script.pop_front();
+				}
+				m_requests.push_back(req);
+			}
+			m_cond.notify_all();
+
+			string response = "HTTP/1.1 " + to_string(status) + " Test\r\nContent-Length: 2\r\n\r\n{}";
+			if(send(sock, response.data(), response.length(), MSG_NOSIGNAL) != static_cast<ssize_t>(response.length()))
+				return;
+		}
+	}
+
+	int m_listener;
+	uint16_t m_port;
+	atomic<bool> m_quit;
+	thread m_thread;
+
+	mutex m_mutex;
+	condition_variable m_cond;
+	deque<int> m_script;
+	vector<TestRequest> m_requests;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Request parsing helpers
+
+/**
+	@brief Minimal JSON syntax checker, returns true if text is exactly one valid JSON value
+ */
+class JSONChecker
+{
+public:
+	JSONChecker(const string& text)
+	: m_text(text)
+	, m_pos(0)
+	{}
+
+	bool Check()
+	{
+		if(!Value())
+			return false;
+		SkipSpace();
+		return m_pos == m_text.length();
+	}
+
+protected:
+	void SkipSpace()
+	{
+		while( (m_pos < m_text.length()) && isspace(static_cast<unsigned char>(m_text[m_pos])) )
+			m_pos ++;
+	}
+
+	bool Literal(const char* word)
+	{
+		size_t len = strlen(word);
+		if(m_text.compare(m_pos, len, word) != 0)
+			return false;
+		m_pos += len;
+		return true;
+	}
+
+	bool String()
+	{
+		if( (m_pos >= m_text.length()) || (m_text[m_pos] != '\"') )
+			return false;
+		for(m_pos ++; m_pos < m_text.length(); m_pos ++)
+		{
+			char c = m_text[m_pos];
+			if(c == '\"')
+			{
+				m_pos ++;
+				return true;
+			}
+			if(static_cast<unsigned char>(c) < 0x20)
+				return false;
+			if(c == '\\')
+			{
+				m_pos ++;
+				if(m_pos >= m_text.length())
+					return false;
+				if(m_text[m_pos] == 'u')
+				{
+					for(int i=0; i<4; i++)
+					{
+						if( (++m_pos >= m_text.length()) || !isxdigit(static_cast<unsigned char>(m_text[m_pos])) )
+							return false;
+					}
+				}
+				else if(!strchr("\"\\/bfnrt", m_text[m_pos]))
+					return false;
+			}
+		}
+		return false;
+	}
+
+	bool Number()
+	{
+		size_t start = m_pos;
+		if( (m_pos < m_text.length()) && (m_text[m_pos] == '-') )
+			m_pos ++;
+		while( (m_pos < m_text.length()) && strchr("0123456789.eE+-", m_text[m_pos]) )
+			m_pos ++;
+		return m_pos > start;
+	}
+
+	bool Value()
+	{
+		SkipSpace();
+		if(m_pos >= m_text.length())
+			return false;
+
+		char c = m_text[m_pos];
+		if(c == '{')
+			return Container('}', true);
+		if(c == '[')
+			return Container(']', false);
+		if(c == '\"')
+			return String();
+		if( (c == '-') || isdigit(static_cast<unsigned char>(c)) )
+			return Number();
+		return Literal("true") || Literal("false") || Literal("null");
+	}
+
+	bool Container(char close, bool object)
+	{
+		m_pos ++;
+		SkipSpace();
+		if( (m_pos < m_text.length()) && (m_text[m_pos] == close) )
+		{
+			m_pos ++;
+			return true;
+		}
+		while(true)
+		{
+			if(object)
+			{
+				SkipSpace();
+				if(!String())
+					return false;
+				SkipSpace();
+				if( (m_pos >= m_text.length()) || (m_text[m_pos++] != ':') )
+					return false;
+			}
+			if(!Value())
+				return false;
+			SkipSpace();
+			if(m_pos >= m_text.length())
+				return false;
+			char c = m_text[m_pos++];
+			if(c == close)
+				return true;
+			if(c != ',')
+				return false;
+		}
+	}
+
+	const string& m_text;
+	size_t m_pos;
+};
+
+/**
+	@brief Returns the number of log records in a request body
+ */
+static size_t CountRecords(const string& body)
+{
+	size_t count = 0;
+	for(size_t pos = 0; (pos = body.find("\"severityNumber\":", pos)) != string::npos; pos ++)
+		count ++;
+	return count;
+}
+
+static size_t CountRecords(const vector<TestRequest>& requests)
+{
+	size_t count = 0;
+	for(auto& r : requests)
+		count += CountRecords(r.body);
+	return count;
+}
+
+static double Milliseconds(chrono::steady_clock::duration d)
+{
+	return chrono::duration<double, milli>(d).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests
+
+/**
+	@brief One batch with every severity: checks the encoding of the request
+ */
+static void TestEncoding()
+{
+	TestCollector collector;
+	{
+		OTLPLogSink sink("127.0.0.1", collector.GetPort(), "otlp-test", Severity::DEBUG);
+		sink.SetResourceAttribute("host.name", "test \"box\"");
+		sink.SetFlushInterval(chrono::milliseconds(50));
+
+		sink.Log(Severity::FATAL, "fatal\n");
+		sink.Log(Severity::ERROR, "error\n");
+		sink.Log(Severity::WARNING, "warning\n");
+		sink.Log(Severity::NOTICE, "notice\n");
+		sink.Log(Severity::VERBOSE, "verbose\n");
+		sink.Log(Severity::DEBUG, "debug\n");
+		{
+			LogTag tag("request.id", "42");
+			sink.Log(Severity::NOTICE, "say \"hi\"\tback\\slash\x01\n");
+		}
+		sink.LogTraceMessage("Foo::Bar", "traced\n");
+
+		Check(collector.WaitFor(1), "encoding: a request arrives");
+	}
+
+	auto requests = collector.GetRequests();
+	if(requests.empty())
+		return;
+	auto& req = requests[0];
+	auto& body = req.body;
+
+	Check(req.method == "POST", "encoding: method is POST");
+	Check(req.path == "/v1/logs", "encoding: default path is /v1/logs");
+	Check(req.headers.find("Content-Type: application/json\r\n") != string::npos, "encoding: JSON content type");
+	Check(JSONChecker(body).Check(), "encoding: body is valid JSON");
+	Check(CountRecords(requests) == 8, "encoding: all 8 records exported in one batch");
+
+	Check(body.find("{\"key\":\"service.name\",\"value\":{\"stringValue\":\"otlp-test\"}}") != string::npos,
+		"encoding: service.name resource attribute");
+	Check(body.find("{\"key\":\"host.name\",\"value\":{\"stringValue\":\"test \\\"box\\\"\"}}") != string::npos,
+		"encoding: custom resource attribute is escaped");
+	Check(body.find("\"key\":\"process.pid\"") != string::npos, "encoding: process.pid resource attribute");
+
+	static const struct
+	{
+		const char* text;
+		const char* severity;
+	} expected[] =
+	{
+		{ "fatal",		"\"severityNumber\":21,\"severityText\":\"FATAL\"" },
+		{ "error",		"\"severityNumber\":17,\"severityText\":\"ERROR\"" },
+		{ "warning",	"\"severityNumber\":13,\"severityText\":\"WARN\"" },
+		{ "notice",		"\"severityNumber\":10,\"severityText\":\"INFO2\"" },
+		{ "verbose",	"\"severityNumber\":9,\"severityText\":\"INFO\"" },
+		{ "debug",		"\"severityNumber\":5,\"severityText\":\"DEBUG\"" },
+		{ "traced",		"\"severityNumber\":5,\"severityText\":\"DEBUG\"" },
+	};
+	for(auto& e : expected)
+	{
+		string record = string(e.severity) + ",\"body\":{\"stringValue\":\"" + e.text + "\"}";
+		string what = string("encoding: severity of \"") + e.text + "\"";
+		Check(body.find(record) != string::npos, what.c_str());
+	}
+
+	Check(body.find("\"body\":{\"stringValue\":\"say \\\"hi\\\"\\tback\\\\slash\\u0001\"}") != string::npos,
+		"encoding: message text is escaped");
+	Check(body.find("{\"key\":\"request.id\",\"value\":{\"stringValue\":\"42\"}}") != string::npos,
+		"encoding: LogTag becomes a record attribute");
+	Check(body.find("{\"key\":\"code.function\",\"value\":{\"stringValue\":\"Foo::Bar\"}}") != string::npos,
+		"encoding: trace messages carry code.function");
+	Check(body.find("\"key\":\"thread.id\"") != string::npos, "encoding: records carry thread.id");
+}
+
+/**
+	@brief A batch is sent as soon as it reaches the size limit, without waiting for the flush interval
+ */
+static void TestBatchBySize()
+{
+	TestCollector collector;
+	OTLPLogSink sink("127.0.0.1", collector.GetPort(), "otlp-test");
+	sink.SetMaxBatchSize(4096);
+	sink.SetFlushInterval(chrono::milliseconds(60000));
+
+	const size_t count = 100;
+	string line(100, 'x');
+	line += '\n';
+	auto start = chrono::steady_clock::now();
+	for(size_t i=0; i<count; i++)
+		sink.Log(Severity::NOTICE, line);
+
+	//Records are a few hundred bytes encoded, so 100 of them make well over 4 full batches
+	Check(collector.WaitFor(4), "size batching: full batches are sent before the flush interval");
+	this_thread::sleep_for(chrono::milliseconds(200));
+
+	auto requests = collector.GetRequests();
+	Check(Milliseconds(requests.back().received - start) < 5000, "size batching: no waiting for the interval");
+	for(auto& r : requests)
+	{
+		size_t recordBytes = r.body.find("]}]}]}") - r.body.find("\"logRecords\":[");
+		Check(recordBytes <= 4096 + 32, "size batching: no batch is larger than the limit");
+		Check(JSONChecker(r.body).Check(), "size batching: body is valid JSON");
+	}
+
+	//Whatever didn't fill a batch is still waiting, and is less than one batch
+	size_t sent = CountRecords(requests);
+	Check(sent < count, "size batching: a partial batch waits for the interval");
+	Check(sent + (4096 / 200) >= count, "size batching: only a partial batch is left over");
+	Check(sink.GetExportedCount() == sent, "size batching: exported count matches");
+}
+
+/**
+	@brief A batch that doesn't fill up is sent once its oldest record has waited for the flush interval
+ */
+static void TestBatchByTime()
+{
+	TestCollector collector;
+	OTLPLogSink sink("127.0.0.1", collector.GetPort(), "otlp-test");
+	sink.SetFlushInterval(chrono::milliseconds(300));
+
+	auto start = chrono::steady_clock::now();
+	sink.Log(Severity::NOTICE, "one\n");
+	sink.Log(Severity::NOTICE, "two\n");
+	this_thread::sleep_for(chrono::milliseconds(100));
+	sink.Log(Severity::NOTICE, "three\n");
+
+	Check(collector.WaitFor(1), "time batching: a request arrives");
+	this_thread::sleep_for(chrono::milliseconds(100));
+
+	auto requests = collector.GetRequests();
+	if(requests.empty())
+		return;
+	double ms = Milliseconds(requests[0].received - start);
+	Check(ms >= 290, "time batching: batch waits for the flush interval");
+	Check(ms < 3000, "time batching: batch is sent once the interval expires");
+	Check(requests.size() == 1, "time batching: all records go in one request");
+	Check(CountRecords(requests[0].body) == 3, "time batching: batch holds all three records");
+}
+
+/**
+	@brief 429 and 5xx are retried with exponential backoff until the collector accepts the batch
+ */
+static void TestRetry()
+{
+	TestCollector collector;
+	collector.Script({503, 429, 500});
+	OTLPLogSink sink("127.0.0.1", collector.GetPort(), "otlp-test");
+	sink.SetFlushInterval(chrono::milliseconds(10));
+
+	sink.Log(Severity::ERROR, "first\n");
+	sink.Log(Severity::ERROR, "second\n");
+
+	Check(collector.WaitFor(4), "retry: batch is retried until accepted");
+	this_thread::sleep_for(chrono::milliseconds(100));
+
+	auto requests = collector.GetRequests();
+	if(requests.size() < 4)
+		return;
+	Check(requests.size() == 4, "retry: no extra requests after success");
+	for(auto& r : requests)
+		Check(r.body == requests[0].body, "retry: the same batch is resent");
+
+	//Backoff starts at 100 ms and doubles
+	double gap1 = Milliseconds(requests[1].received - requests[0].received);
+	double gap2 = Milliseconds(requests[2].received - requests[1].received);
+	double gap3 = Milliseconds(requests[3].received - requests[2].received);
+	Check(gap1 >= 95, "retry: first retry after 100 ms");
+	Check(gap2 >= 195, "retry: second retry after 200 ms");
+	Check(gap3 >= 395, "retry: third retry after 400 ms");
+
+	Check(sink.GetExportedCount() == 2, "retry: records are exported once accepted");
+	Check(sink.GetDroppedCount() == 0, "retry: nothing dropped");
+}
+
+/**
+	@brief A connection failure is retried too, and the batch is delivered once the collector is back
+ */
+static void TestRetryConnect()
+{
+	//Grab a free port, then close it so the first attempts are refused
+	uint16_t port;
+	{
+		TestCollector probe;
+		port = probe.GetPort();
+	}
+
+	OTLPLogSink sink("127.0.0.1", port, "otlp-test");
+	sink.SetFlushInterval(chrono::milliseconds(10));
+	sink.Log(Severity::WARNING, "queued while down\n");
+	this_thread::sleep_for(chrono::milliseconds(250));
+	Check(sink.GetExportedCount() == 0, "connect retry: nothing exported while the collector is down");
+	Check(sink.GetDroppedCount() == 0, "connect retry: nothing dropped while the collector is down");
+
+	//Bring a collector up on that port
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if( (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) || (listen(listener, 4) != 0) )
+	{
+		//Somebody else took the port in the meantime, can't run this one
+		close(listener);
+		return;
+	}
+
+	pollfd pfd = {listener, POLLIN, 0};
+	bool connected = poll(&pfd, 1, 5000) > 0;
+	Check(connected, "connect retry: sink reconnects once the collector is up");
+	if(connected)
+	{
+		int sock = accept(listener, nullptr, nullptr);
+		string data;
+		char buf[4096];
+		while(data.find("queued while down") == string::npos)
+		{
+			pollfd cfd = {sock, POLLIN, 0};
+			if(poll(&cfd, 1, 5000) <= 0)
+				break;
+			ssize_t n = recv(sock, buf, sizeof(buf), 0);
+			if(n <= 0)
+				break;
+			data.append(buf, n);
+		}
+		Check(data.find("queued while down") != string::npos, "connect retry: queued record is delivered");
+		const char* ok = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+		send(sock, ok, strlen(ok), MSG_NOSIGNAL);
+		for(int i=0; (i<500) && (sink.GetExportedCount() == 0); i++)
+			this_thread::sleep_for(chrono::milliseconds(10));
+		Check(sink.GetExportedCount() == 1, "connect retry: record is exported");
+		close(sock);
+	}
+	close(listener);
+}
+
+/**
+	@brief Any other 4xx means the collector will never take the batch, so it's dropped without retrying
+ */
+static void TestReject()
+{
+	TestCollector collector;
+	collector.Script({400});
+	OTLPLogSink sink("127.0.0.1", collector.GetPort(), "otlp-test");
+	sink.SetFlushInterval(chrono::milliseconds(10));
+
+	sink.Log(Severity::NOTICE, "rejected one\n");
+	sink.Log(Severity::NOTICE, "rejected two\n");
+	Check(collector.WaitFor(1), "reject: a request arrives");
+
+	//Give it long enough to retry, if it (wrongly) would
+	this_thread::sleep_for(chrono::milliseconds(400));
+	Check(collector.GetRequests().size() == 1, "reject: a 400 is not retried");
+	Check(sink.GetDroppedCount() == 2, "reject: rejected records are counted as dropped");
+	Check(sink.GetExportedCount() == 0, "reject: rejected records are not counted as exported");
+
+	//The sink carries on with the next batch
+	sink.Log(Severity::NOTICE, "accepted\n");
+	Check(collector.WaitFor(2), "reject: later records are still exported");
+	for(int i=0; (i<500) && (sink.GetExportedCount() == 0); i++)
+		this_thread::sleep_for(chrono::milliseconds(10));
+	Check(sink.GetExportedCount() == 1, "reject: later records are counted as exported");
+}
+
+int main()
+{
+	TestEncoding();
+	TestBatchBySize();
+	TestBatchByTime();
+	TestRetry();
+	TestRetryConnect();
+	TestReject();
+
+	if(g_failures)
+	{
+		fprintf(stderr, "%d check(s) failed\n", g_failures);
+		return 1;
+	}
+	printf("All OTLPLogSink tests passed\n");
+	return 0;
+}
@@ -0,0 +1,314 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Tests for SyslogLogSink against a datagram socket standing in for the daemon
+	@ingroup	liblog
+
+	Covers the RFC 5424 and journald encodings, the severity to priority mapping, the class/function structured data
+	of trace messages, line splitting, and counting drops when there's no daemon.
+ */
+
+#include "log.h"
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+static int g_failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+	if(!ok)
+	{
+		fprintf(stderr, "FAILED: %s\n", what);
+		g_failures ++;
+	}
+}
+
+static bool StartsWith(const string& str, const string& prefix)
+{
+	return str.compare(0, prefix.length(), prefix) == 0;
+}
+
+static bool EndsWith(const string& str, const string& suffix)
+{
+	return (str.length() >= suffix.length()) && (str.compare(str.length() - suffix.length(), string::npos, suffix) == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stand-in daemon
+
+/**
+	@brief A datagram socket bound to a temporary path, like /dev/log or the journal socket
+ */
+class TestDaemon
+{
+public:
+	TestDaemon()
+	: m_socket(socket(AF_UNIX, SOCK_DGRAM, 0))
+	{
+		m_path = "/tmp/logtools-test-syslog." + to_string(getpid()) + ".sock";
+		unlink(m_path.c_str());
+
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, m_path.c_str(), sizeof(addr.sun_path) - 1);
+		if( (m_socket < 0) || (bind(m_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) )
+		{
+			perror("TestDaemon");
+			exit(1);
+		}
+	}
+
+	~TestDaemon()
+	{
+		close(m_socket);
+		unlink(m_path.c_str());
+	}
+
+	const string& GetPath()
+	{ return m_path; }
+
+	///@brief Receives datagrams until count have arrived, or none arrives for the timeout
+	vector<string> Receive(size_t count, int timeoutMs = 2000)
+	{
+		vector<string> ret;
+		char buf[65536];
+		while(ret.size() < count)
+		{
+			pollfd pfd = {m_socket, POLLIN, 0};
+			if(poll(&pfd, 1, timeoutMs) <= 0)
+				break;
+			ssize_t n = recv(m_socket, buf, sizeof(buf), 0);
+			if(n < 0)
+				break;
+			ret.emplace_back(buf, n);
+		}
+		return ret;
+	}
+
+protected:
+	int m_socket;
+	string m_path;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests
+
+///@brief Every severity, most severe first, with its syslog priority
+static const struct
+{
+	Severity severity;
+	const char* text;
+	int priority;
+} g_severities[] =
+{
+	{ Severity::FATAL,		"fatal",	2 },
+	{ Severity::ERROR,		"error",	3 },
+	{ Severity::WARNING,	"warning",	4 },
+	{ Severity::NOTICE,		"notice",	5 },
+	{ Severity::VERBOSE,	"verbose",	6 },
+	{ Severity::DEBUG,		"debug",	7 }
+};
+
+/**
+	@brief RFC 5424 header fields and priorities, one datagram per line
+ */
+static void TestSyslogEncoding()
+{
+	TestDaemon daemon;
+	SyslogLogSink sink(SyslogLogSink::PROTOCOL_SYSLOG, "syslog-test", Severity::DEBUG, daemon.GetPath());
+	for(auto& s : g_severities)
+		sink.Log(s.severity, string(s.text) + "\n");
+	sink.Flush();
+
+	auto msgs = daemon.Receive(6);
+	Check(msgs.size() == 6, "syslog: one datagram per message");
+	if(msgs.size() != 6)
+		return;
+
+	char hostname[256] = "-";
+	gethostname(hostname, sizeof(hostname));
+	hostname[sizeof(hostname) - 1] = '\0';
+
+	for(size_t i=0; i<6; i++)
+	{
+		auto& m = msgs[i];
+		auto& s = g_severities[i];
+
+		//Default facility is 1 (user-level)
+		string pri = "<" + to_string(8 + s.priority) + ">1 ";
+		string what = string("syslog: PRI of \"") + s.text + "\"";
+		Check(StartsWith(m, pri), what.c_str());
+
+		//<PRI>1 YYYY-MM-DDTHH:MM:SS.uuuuuuZ HOSTNAME APP-NAME PROCID MSGID SD MSG
+		int year, month, day, hour, minute, second, usec, consumed = 0;
+		const char* stamp = m.c_str() + pri.length();
+		bool parsed = (sscanf(stamp, "%4d-%2d-%2dT%2d:%2d:%2d.%6dZ %n",
+			&year, &month, &day, &hour, &minute, &second, &usec, &consumed) == 7) && (consumed == 28);
+		Check(parsed, "syslog: RFC 3339 UTC timestamp with microseconds");
+		if(!parsed)
+			continue;
+
+		string rest = string(stamp + consumed);
+		string fields = string(hostname) + " syslog-test " + to_string(getpid()) + " - - " + s.text;
+		Check(rest == fields, "syslog: hostname, app name, pid, no MSGID or SD, then the message");
+	}
+}
+
+/**
+	@brief The facility goes into the PRI
+ */
+static void TestSyslogFacility()
+{
+	TestDaemon daemon;
+	SyslogLogSink sink(SyslogLogSink::PROTOCOL_SYSLOG, "syslog-test", Severity::DEBUG, daemon.GetPath());
+	sink.SetFacility(16);
+	sink.Log(Severity::NOTICE, "local0\n");
+	sink.Flush();
+
+	auto msgs = daemon.Receive(1);
+	Check( (msgs.size() == 1) && StartsWith(msgs[0], "<133>1 "), "syslog: local0.notice is PRI 133");
+}
+
+/**
+	@brief Trace messages carry their class and function as structured data, escaped as RFC 5424 requires
+ */
+static void TestSyslogStructuredData()
+{
+	TestDaemon daemon;
+	SyslogLogSink sink(SyslogLogSink::PROTOCOL_SYSLOG, "syslog-test", Severity::DEBUG, daemon.GetPath());
+	sink.LogTraceMessage("Foo::Bar", "traced\n");
+	sink.LogTraceMessage("Foo::operator[]", "indexed\n");
+	sink.LogTraceMessage("main", "global\n");
+	sink.Flush();
+
+	auto msgs = daemon.Receive(3);
+	Check(msgs.size() == 3, "syslog SD: one datagram per trace message");
+	if(msgs.size() != 3)
+		return;
+
+	Check(StartsWith(msgs[0], "<15>1 "), "syslog SD: trace messages are debug priority");
+	Check(EndsWith(msgs[0], " - [logtools@32473 class=\"Foo\" function=\"Foo::Bar\"] traced"),
+		"syslog SD: class and function parameters");
+	Check(EndsWith(msgs[1], " - [logtools@32473 class=\"Foo\" function=\"Foo::operator[\\]\"] indexed"),
+		"syslog SD: ] is escaped in parameter values");
+	Check(EndsWith(msgs[2], " - [logtools@32473 function=\"main\"] global"),
+		"syslog SD: no class parameter for a global function");
+}
+
+/**
+	@brief journald native protocol: one KEY=value per line, with PRIORITY and the trace fields
+ */
+static void TestJournaldEncoding()
+{
+	TestDaemon daemon;
+	SyslogLogSink sink(SyslogLogSink::PROTOCOL_JOURNALD, "journal-test", Severity::DEBUG, daemon.GetPath());
+	for(auto& s : g_severities)
+		sink.Log(s.severity, string(s.text) + "\n");
+	sink.LogTraceMessage("Foo::Bar", "traced\n");
+	sink.Flush();
+
+	auto msgs = daemon.Receive(7);
+	Check(msgs.size() == 7, "journald: one datagram per message");
+	if(msgs.size() != 7)
+		return;
+
+	for(size_t i=0; i<6; i++)
+	{
+		auto& s = g_severities[i];
+		string expected = "PRIORITY=" + to_string(s.priority) + "\nSYSLOG_IDENTIFIER=journal-test\nMESSAGE=" +
+			s.text + "\n";
+		string what = string("journald: fields of \"") + s.text + "\"";
+		Check(msgs[i] == expected, what.c_str());
+	}
+
+	Check(msgs[6] ==
+		"PRIORITY=7\nSYSLOG_IDENTIFIER=journal-test\nCODE_FUNC=Foo::Bar\nLOGTOOLS_CLASS=Foo\nMESSAGE=traced\n",
+		"journald: trace messages carry CODE_FUNC and LOGTOOLS_CLASS");
+}
+
+/**
+	@brief Text is sent a line at a time, joining partial writes and splitting multi-line messages
+ */
+static void TestLines()
+{
+	TestDaemon daemon;
+	SyslogLogSink sink(SyslogLogSink::PROTOCOL_JOURNALD, "journal-test", Severity::DEBUG, daemon.GetPath());
+	sink.Log(Severity::NOTICE, "partial ");
+	sink.Log(Severity::NOTICE, "line\nsecond line\n");
+	sink.Log(Severity::NOTICE, "unfinished");
+
+	//Not flushed: the flush thread sends it once the batch has waited long enough
+	auto msgs = daemon.Receive(2);
+	Check(msgs.size() == 2, "lines: complete lines are sent by the flush thread");
+	if(msgs.size() == 2)
+	{
+		Check(EndsWith(msgs[0], "\nMESSAGE=partial line\n"), "lines: partial writes are joined");
+		Check(EndsWith(msgs[1], "\nMESSAGE=second line\n"), "lines: multi-line messages are split");
+	}
+	Check(daemon.Receive(1, 300).empty(), "lines: an unfinished line is held back");
+}
+
+/**
+	@brief Without a daemon listening, entries are counted as dropped rather than blocking
+ */
+static void TestNoDaemon()
+{
+	string path = "/tmp/logtools-test-syslog-missing." + to_string(getpid()) + ".sock";
+	SyslogLogSink sink(SyslogLogSink::PROTOCOL_SYSLOG, "syslog-test", Severity::DEBUG, path);
+	sink.Log(Severity::NOTICE, "nobody\n");
+	sink.Log(Severity::NOTICE, "listening\n");
+	sink.Flush();
+	Check(sink.GetDroppedCount() == 2, "no daemon: entries are counted as dropped");
+}
+
+int main()
+{
+	TestSyslogEncoding();
+	TestSyslogFacility();
+	TestSyslogStructuredData();
+	TestJournaldEncoding();
+	TestLines();
+	TestNoDaemon();
+
+	if(g_failures)
+	{
+		fprintf(stderr, "%d check(s) failed\n", g_failures);
+		return 1;
+	}
+	printf("All SyslogLogSink tests passed\n");
+	return 0;
+}
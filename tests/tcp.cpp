@@ -0,0 +1,414 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Tests for TCPLogSink against a collector listening on the loopback interface
+	@ingroup	liblog
+
+	Covers the frame layout, spilling to the spool while disconnected and replaying it in order on reconnect, and
+	the bounds on the queue and spool.
+ */
+
+#include "log.h"
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static int g_failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+	if(!ok)
+	{
+		fprintf(stderr, "FAILED: %s\n", what);
+		g_failures ++;
+	}
+}
+
+static uint64_t ReadLE(const char* p, int bytes)
+{
+	uint64_t value = 0;
+	for(int i=0; i<bytes; i++)
+		value |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8*i);
+	return value;
+}
+
+static uint64_t NowNs()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static off_t FileSize(const string& path)
+{
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0)
+		return -1;
+	return st.st_size;
+}
+
+///@brief Waits up to 5 seconds for a condition
+template<class T>
+static bool WaitUntil(T cond)
+{
+	for(int i=0; i<500; i++)
+	{
+		if(cond())
+			return true;
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+	return cond();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stand-in collector
+
+/**
+	@brief One frame as received by TestCollector
+ */
+struct TestFrame
+{
+	uint32_t length;
+	uint64_t timestamp;
+	int severity;
+	int reserved;
+	string function;
+	string text;
+};
+
+/**
+	@brief Accepts connections on a loopback port, one at a time, and decodes the frames sent over them
+ */
+class TestCollector
+{
+public:
+	TestCollector(uint16_t port = 0)
+	: m_listener(socket(AF_INET, SOCK_STREAM, 0))
+	, m_port(0)
+	, m_connections(0)
+	, m_quit(false)
+	{
+		int yes = 1;
+		setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(port);
+		socklen_t len = sizeof(addr);
+		if( (bind(m_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) ||
+			(listen(m_listener, 4) != 0) ||
+			(getsockname(m_listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0) )
+		{
+			perror("TestCollector");
+			exit(1);
+		}
+		m_port = ntohs(addr.sin_port);
+
+		m_thread = thread(&TestCollector::ThreadProc, this);
+	}
+
+	~TestCollector()
+	{
+		m_quit = true;
+		m_thread.join();
+		close(m_listener);
+	}
+
+	uint16_t GetPort()
+	{ return m_port; }
+
+	///@brief Number of connections accepted so far
+	int GetConnections()
+	{ return m_connections; }
+
+	///@brief Waits until at least count frames have arrived, returns false on timeout
+	bool WaitFor(size_t count)
+	{
+		return WaitUntil([&] { return GetFrames().size() >= count; });
+	}
+
+	vector<TestFrame> GetFrames()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_frames;
+	}
+
+	///@brief Returns the text of every frame received so far, concatenated
+	string GetText()
+	{
+		string ret;
+		for(auto& f : GetFrames())
+			ret += f.text;
+		return ret;
+	}
+
+protected:
+
+	bool WaitReadable(int sock)
+	{
+		while(!m_quit)
+		{
+			pollfd pfd = {sock, POLLIN, 0};
+			if(poll(&pfd, 1, 20) > 0)
+				return true;
+		}
+		return false;
+	}
+
+	void ThreadProc()
+	{
+		while(WaitReadable(m_listener))
+		{
+			int sock = accept(m_listener, nullptr, nullptr);
+			if(sock < 0)
+				continue;
+			m_connections ++;
+
+			string data;
+			char buf[4096];
+			while(WaitReadable(sock))
+			{
+				ssize_t n = recv(sock, buf, sizeof(buf), 0);
+				if(n <= 0)
+					break;
+				data.append(buf, n);
+				Decode(data);
+			}
+			close(sock);
+		}
+	}
+
+	///@brief Moves every complete frame from the front of data to m_frames
+	void Decode(string& data)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		size_t off = 0;
+		while(off + 4 <= data.length())
+		{
+			uint32_t length = ReadLE(&data[off], 4);
+			if(off + 4 + length > data.length())
+				break;
+
+			const char* p = &data[off];
+			TestFrame f;
+			f.length = length;
+			f.timestamp = ReadLE(p + 4, 8);
+			f.severity = static_cast<uint8_t>(p[12]);
+			f.reserved = static_cast<uint8_t>(p[13]);
+			size_t flen = ReadLE(p + 14, 2);
+			f.function.assign(p + 16, flen);
+			f.text.assign(p + 16 + flen, length + 4 - 16 - flen);
+			m_frames.push_back(f);
+
+			off += 4 + length;
+		}
+		data.erase(0, off);
+	}
+
+	int m_listener;
+	uint16_t m_port;
+	atomic<int> m_connections;
+	atomic<bool> m_quit;
+	thread m_thread;
+
+	mutex m_mutex;
+	vector<TestFrame> m_frames;
+};
+
+///@brief Returns a loopback port nobody is listening on (for now)
+static uint16_t FreePort()
+{
+	TestCollector probe;
+	return probe.GetPort();
+}
+
+///@brief Text of numbered frames first to last-1, as TestSpool etc log them
+static string Numbered(int first, int last)
+{
+	string ret;
+	for(int i=first; i<last; i++)
+		ret += "frame " + to_string(i) + "\n";
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests
+
+/**
+	@brief Length, timestamp, severity and function header, and how lines are grouped into frames
+ */
+static void TestFrameLayout()
+{
+	TestCollector collector;
+	uint64_t before = NowNs();
+	{
+		TCPLogSink sink("127.0.0.1", collector.GetPort(), "", Severity::DEBUG);
+		sink.Log(Severity::ERROR, "error\n");
+		sink.Log(Severity::NOTICE, "partial ");
+		sink.Log(Severity::NOTICE, "line\n");
+		sink.Log(Severity::VERBOSE, "two\nlines\n");
+		sink.LogTraceMessage("Foo::Bar", "traced\n");
+		Check(collector.WaitFor(4), "frames: all frames arrive");
+	}
+	uint64_t after = NowNs();
+
+	auto frames = collector.GetFrames();
+	Check(frames.size() == 4, "frames: one frame per complete write");
+	if(frames.size() != 4)
+		return;
+
+	static const struct
+	{
+		Severity severity;
+		const char* function;
+		const char* text;
+	} expected[] =
+	{
+		{ Severity::ERROR,		"",			"error\n" },
+		{ Severity::NOTICE,		"",			"partial line\n" },
+		{ Severity::VERBOSE,	"",			"two\nlines\n" },
+		{ Severity::DEBUG,		"Foo::Bar",	"traced\n" }
+	};
+	uint64_t last = 0;
+	for(size_t i=0; i<4; i++)
+	{
+		auto& f = frames[i];
+		auto& e = expected[i];
+		Check(f.length == 12 + strlen(e.function) + strlen(e.text), "frames: length counts everything after it");
+		Check( (f.timestamp >= before) && (f.timestamp <= after), "frames: timestamp is ns since the epoch");
+		Check(f.timestamp >= last, "frames: timestamps are in order");
+		last = f.timestamp;
+		Check(f.severity == static_cast<int>(e.severity), "frames: severity");
+		Check(f.reserved == 0, "frames: reserved byte is zero");
+		Check(f.function == e.function, "frames: function name");
+		Check(f.text == e.text, "frames: text");
+	}
+}
+
+/**
+	@brief Frames logged while the collector is down go to the spool, and are replayed in order ahead of new ones
+ */
+static void TestSpool()
+{
+	string spool = "/tmp/logtools-test-tcp." + to_string(getpid()) + ".spool";
+	unlink(spool.c_str());
+	uint16_t port = FreePort();
+
+	TCPLogSink sink("127.0.0.1", port, spool);
+	for(int i=0; i<50; i++)
+		sink.Log(Severity::NOTICE, "frame " + to_string(i) + "\n");
+
+	Check(WaitUntil([&] { return FileSize(spool) >= static_cast<off_t>(50 * (16 + 8)); }),
+		"spool: frames are spilled while disconnected");
+	Check(!sink.IsConnected(), "spool: not connected while the collector is down");
+
+	TestCollector collector(port);
+	Check(WaitUntil([&] { return sink.IsConnected(); }), "spool: sink reconnects");
+	for(int i=50; i<100; i++)
+		sink.Log(Severity::NOTICE, "frame " + to_string(i) + "\n");
+
+	Check(WaitUntil([&] { return collector.GetText().length() >= Numbered(0, 100).length(); }),
+		"spool: spooled and new frames arrive");
+	Check(collector.GetText() == Numbered(0, 100), "spool: replayed frames come first, all in order");
+	Check(FileSize(spool) == 0, "spool: emptied after replaying");
+	Check(sink.GetDroppedCount() == 0, "spool: nothing dropped");
+	unlink(spool.c_str());
+}
+
+/**
+	@brief The spool is bounded too, and whatever doesn't fit is counted as dropped
+ */
+static void TestSpoolLimit()
+{
+	string spool = "/tmp/logtools-test-tcp-limit." + to_string(getpid()) + ".spool";
+	unlink(spool.c_str());
+	uint16_t port = FreePort();
+
+	TCPLogSink sink("127.0.0.1", port, spool);
+	sink.SetMaxSpoolSize(500);
+	for(int i=0; i<100; i++)
+	{
+		sink.Log(Severity::NOTICE, "frame " + to_string(i) + "\n");
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+
+	//Frames are 24 or 25 bytes here, and spilled in batches
+	Check(WaitUntil([&] { return FileSize(spool) + sink.GetDroppedCount() * 24 >= 100 * 24; }),
+		"spool limit: every frame is either spooled or dropped");
+	Check(FileSize(spool) <= 500, "spool limit: spool stays within its limit");
+	Check(sink.GetDroppedCount() > 0, "spool limit: frames that don't fit are counted as dropped");
+	unlink(spool.c_str());
+}
+
+/**
+	@brief Without a spool, frames wait in the bounded queue while disconnected, and the overflow is dropped
+ */
+static void TestQueueLimit()
+{
+	uint16_t port = FreePort();
+
+	TCPLogSink sink("127.0.0.1", port);
+	sink.SetMaxQueueSize(1000);
+
+	//"frame 10\n" etc make 25 byte frames, so 40 fit
+	for(int i=10; i<100; i++)
+		sink.Log(Severity::NOTICE, "frame " + to_string(i) + "\n");
+	Check(sink.GetDroppedCount() == 50, "queue limit: frames past the limit are counted as dropped");
+
+	TestCollector collector(port);
+	Check(WaitUntil([&] { return collector.GetText().length() >= Numbered(10, 50).length(); }),
+		"queue limit: queued frames are sent on reconnect");
+	Check(collector.GetText() == Numbered(10, 50), "queue limit: the frames that fit arrive in order");
+}
+
+int main()
+{
+	TestFrameLayout();
+	TestSpool();
+	TestSpoolLimit();
+	TestQueueLimit();
+
+	if(g_failures)
+	{
+		fprintf(stderr, "%d check(s) failed\n", g_failures);
+		return 1;
+	}
+	printf("All TCPLogSink tests passed\n");
+	return 0;
+}
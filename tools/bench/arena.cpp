@@ -0,0 +1,176 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Benchmark: LogArena against malloc() for log record storage
+	@ingroup	liblog
+
+	32 producer threads allocate variable-length records (16 to 215 bytes). One in eight is freed again by the
+	producer; the rest are handed to a single consumer thread that frees them, the way a SubscriberLogSink segment is
+	dropped by the reader that last held it. Prints the time per record for malloc()/free() and for the arena.
+ */
+
+#include "log.h"
+#include "LogArena.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+struct Record
+{
+	char* p;
+	uint32_t len;
+};
+
+static double RunBenchmark(bool arena, int producers, int count)
+{
+	mutex queueMutex;
+	vector<Record> queue;
+	atomic<int> done(0);
+
+	auto allocate = [arena](size_t len)
+	{ return static_cast<char*>(arena ? LogArenaAllocate(len) : malloc(len)); };
+	auto release = [arena](char* p, size_t len)
+	{
+		if(arena)
+			LogArenaFree(p, len);
+		else
+			free(p);
+	};
+
+	auto start = chrono::steady_clock::now();
+
+	vector<thread> threads;
+	for(int t=0; t<producers; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			uint32_t seed = t * 7919 + 1;
+			vector<Record> local;
+			local.reserve(256);
+			for(int i=0; i<count; i++)
+			{
+				seed = seed * 1103515245 + 12345;
+				uint32_t len = 16 + (seed >> 16) % 200;
+				char* p = allocate(len);
+				memset(p, 'x', len);
+
+				if( (seed & 7) == 0)
+				{
+					release(p, len);
+					continue;
+				}
+
+				local.push_back(Record{p, len});
+				if(local.size() == local.capacity())
+				{
+					lock_guard<mutex> lock(queueMutex);
+					queue.insert(queue.end(), local.begin(), local.end());
+					local.clear();
+				}
+			}
+
+			lock_guard<mutex> lock(queueMutex);
+			queue.insert(queue.end(), local.begin(), local.end());
+			done ++;
+		});
+	}
+
+	thread consumer([&]
+	{
+		vector<Record> batch;
+		while(true)
+		{
+			bool finished = (done == producers);
+			{
+				lock_guard<mutex> lock(queueMutex);
+				batch.swap(queue);
+			}
+			for(auto& r : batch)
+				release(r.p, r.len);
+			batch.clear();
+
+			if(finished)
+			{
+				lock_guard<mutex> lock(queueMutex);
+				if(queue.empty())
+					break;
+			}
+			this_thread::yield();
+		}
+	});
+
+	for(auto& t : threads)
+		t.join();
+	consumer.join();
+
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+	int producers = 32;
+	int count = 200000;
+	bool hugePages = false;
+
+	for(int i=1; i<argc; i++)
+	{
+		string s(argv[i]);
+		if( (s == "-t") && (i+1 < argc) )
+			producers = atoi(argv[++i]);
+		else if( (s == "-n") && (i+1 < argc) )
+			count = atoi(argv[++i]);
+		else if(s == "--huge")
+			hugePages = true;
+		else
+		{
+			fprintf(stderr, "Usage: logtools-bench-arena [-t threads] [-n records per thread] [--huge]\n");
+			return 1;
+		}
+	}
+	if( (producers <= 0) || (count <= 0) )
+	{
+		fprintf(stderr, "Thread and record counts must be positive\n");
+		return 1;
+	}
+
+	LogArenaSetHugePages(hugePages);
+
+	double total = static_cast<double>(producers) * count;
+	for(bool arena : {false, true})
+	{
+		double dt = RunBenchmark(arena, producers, count);
+		printf("%-8s %d producers: %.3f s, %.1f ns/record, %.1f M records/s\n",
+			arena ? "arena" : "malloc", producers, dt, dt * 1e9 / total, total / dt / 1e6);
+	}
+	return 0;
+}
@@ -0,0 +1,90 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		Benchmark: stream-style LOG() against printf-style LogNotice()
+	@ingroup	liblog
+
+	Logs the same message N times (default 1M) through each front end to a FILELogSink on /dev/null and prints the
+	average cost per message, plus the cost of a LOG(DEBUG) that no sink wants.
+ */
+
+#include "log.h"
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+static int g_evaluated = 0;
+
+static int Expensive()
+{
+	g_evaluated ++;
+	return 42;
+}
+
+int main(int argc, char* argv[])
+{
+	int count = 1000000;
+	if(argc > 1)
+		count = atoi(argv[1]);
+	if(count <= 0)
+	{
+		fprintf(stderr, "Usage: logtools-bench-stream [count]\n");
+		return 1;
+	}
+
+	FILE* fp = fopen("/dev/null", "w");
+	if(!fp)
+	{
+		perror("/dev/null");
+		return 1;
+	}
+	g_log_sinks.emplace_back(new FILELogSink(fp, false, Severity::VERBOSE));
+
+	auto start = chrono::steady_clock::now();
+	for(int i=0; i<count; i++)
+		LogNotice("rate %d Hz %f\n", i, i * 0.5);
+	auto mid = chrono::steady_clock::now();
+	for(int i=0; i<count; i++)
+		LOG(NOTICE) << "rate " << i << " Hz " << i * 0.5;
+	auto end = chrono::steady_clock::now();
+	for(int i=0; i<count; i++)
+		LOG(DEBUG) << "hidden " << Expensive();
+	auto disabled = chrono::steady_clock::now();
+
+	g_log_sinks.clear();
+
+	printf("LogNotice():          %8.1f ns/msg\n", chrono::duration<double, nano>(mid - start).count() / count);
+	printf("LOG(NOTICE):          %8.1f ns/msg\n", chrono::duration<double, nano>(end - mid).count() / count);
+	printf("LOG(DEBUG), disabled: %8.1f ns/msg (%d arguments evaluated)\n",
+		chrono::duration<double, nano>(disabled - end).count() / count, g_evaluated);
+	return 0;
+}
@@ -0,0 +1,254 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		logtools-collect: merges one or more SHMLogSink rings into a single log
+	@ingroup	liblog
+ */
+
+#include "SHMLogRing.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <csignal>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+	@brief In follow mode, records are held back this long so slightly late records from other rings sort correctly
+ */
+static const uint64_t g_holdback = 200000000;
+
+static volatile sig_atomic_t g_quit = 0;
+
+static void OnSignal(int /*sig*/)
+{
+	g_quit = 1;
+}
+
+static void ShowUsage()
+{
+	fprintf(stderr,
+		"Usage: logtools-collect [options] ring [ring...]\n"
+		"\n"
+		"Merges the shared-memory log rings written by SHMLogSink into one stream, ordered by timestamp.\n"
+		"\n"
+		"Options:\n"
+		"    -f, --follow       Keep running and print new records as they arrive\n"
+		"    -o, --output FILE  Write to FILE instead of stdout\n"
+		"    -p, --pid          Prefix each line with the producer's PID\n"
+		"    -t, --time         Prefix each line with the record's timestamp\n");
+}
+
+/**
+	@brief A record waiting to be printed
+ */
+struct PendingRecord
+{
+	SHMLogRecord	rec;
+	uint64_t		order;		//tiebreak so records with the same timestamp keep their arrival order
+
+	bool operator>(const PendingRecord& rhs) const
+	{
+		if(rec.timestamp != rhs.rec.timestamp)
+			return rec.timestamp > rhs.rec.timestamp;
+		return order > rhs.order;
+	}
+};
+
+/**
+	@brief Prints a record, adding the requested prefixes to the start of each line
+ */
+static void PrintRecord(FILE* fp, const SHMLogRecord& rec, bool showPid, bool showTime)
+{
+	if(!showPid && !showTime)
+	{
+		fwrite(rec.text.c_str(), 1, rec.text.length(), fp);
+		return;
+	}
+
+	char prefix[128] = "";
+	size_t plen = 0;
+	if(showTime)
+	{
+		time_t secs = rec.timestamp / 1000000000ULL;
+		struct tm t;
+		localtime_r(&secs, &t);
+		plen += strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &t);
+		plen += snprintf(prefix + plen, sizeof(prefix) - plen, ".%06u ",
+			static_cast<unsigned>( (rec.timestamp % 1000000000ULL) / 1000) );
+	}
+	if(showPid)
+		plen += snprintf(prefix + plen, sizeof(prefix) - plen, "[%u] ", rec.pid);
+
+	size_t start = 0;
+	while(start < rec.text.length())
+	{
+		size_t end = rec.text.find('\n', start);
+		if(end == string::npos)
+			end = rec.text.length();
+		else
+			end ++;
+
+		fwrite(prefix, 1, plen, fp);
+		fwrite(rec.text.c_str() + start, 1, end - start, fp);
+		start = end;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool follow = false;
+	bool showPid = false;
+	bool showTime = false;
+	string outpath;
+	vector<unique_ptr<SHMLogReader>> readers;
+
+	for(int i=1; i<argc; i++)
+	{
+		string s(argv[i]);
+
+		if( (s == "-f") || (s == "--follow") )
+			follow = true;
+		else if( (s == "-p") || (s == "--pid") )
+			showPid = true;
+		else if( (s == "-t") || (s == "--time") )
+			showTime = true;
+		else if( (s == "-o") || (s == "--output") )
+		{
+			if(i+1 >= argc)
+			{
+				fprintf(stderr, "%s requires an argument\n", s.c_str());
+				return 1;
+			}
+			outpath = argv[++i];
+		}
+		else if( (s == "-h") || (s == "--help") )
+		{
+			ShowUsage();
+			return 0;
+		}
+		else if(s[0] == '-')
+		{
+			fprintf(stderr, "Unrecognized argument %s\n", s.c_str());
+			ShowUsage();
+			return 1;
+		}
+		else
+		{
+			readers.emplace_back(new SHMLogReader(s));
+			if(!readers.back()->IsOpen())
+			{
+				fprintf(stderr, "Couldn't open log ring %s\n", s.c_str());
+				return 1;
+			}
+		}
+	}
+
+	if(readers.empty())
+	{
+		ShowUsage();
+		return 1;
+	}
+
+	FILE* fp = stdout;
+	if(!outpath.empty())
+	{
+		fp = fopen(outpath.c_str(), "w");
+		if(!fp)
+		{
+			fprintf(stderr, "Couldn't open %s for writing\n", outpath.c_str());
+			return 1;
+		}
+	}
+
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+
+	priority_queue<PendingRecord, vector<PendingRecord>, greater<PendingRecord>> pending;
+	uint64_t order = 0;
+	while(!g_quit)
+	{
+		//Pull in everything that's ready
+		bool gotAny = false;
+		for(auto& r : readers)
+		{
+			PendingRecord p;
+			while(r->Read(p.rec))
+			{
+				p.order = order ++;
+				pending.push(std::move(p));
+				gotAny = true;
+			}
+		}
+
+		//Print whatever is old enough that nothing earlier can still show up
+		timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		uint64_t cutoff = now.tv_sec * 1000000000ULL + now.tv_nsec;
+		if(follow)
+			cutoff -= g_holdback;
+		else if(gotAny)
+			continue;
+		while(!pending.empty() && (pending.top().rec.timestamp <= cutoff))
+		{
+			PrintRecord(fp, pending.top().rec, showPid, showTime);
+			pending.pop();
+		}
+		fflush(fp);
+
+		if(!follow)
+			break;
+		if(!gotAny)
+			this_thread::sleep_for(chrono::milliseconds(20));
+	}
+
+	//Drain anything still held back
+	while(!pending.empty())
+	{
+		PrintRecord(fp, pending.top().rec, showPid, showTime);
+		pending.pop();
+	}
+
+	for(auto& r : readers)
+	{
+		if(r->GetLostCount())
+			fprintf(stderr, "%s: %lu records lost\n", r->GetName().c_str(), (unsigned long)r->GetLostCount());
+	}
+
+	if(fp != stdout)
+		fclose(fp);
+	return 0;
+}
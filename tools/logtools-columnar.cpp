@@ -0,0 +1,196 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		logtools-columnar: converts text logs to columnar files, and prints columnar files back as text
+	@ingroup	liblog
+ */
+
+#include "LogColumnStore.h"
+#include "LogParser.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static void ShowUsage()
+{
+	fprintf(stderr,
+		"Usage: logtools-columnar [options] input.log output.lcol\n"
+		"       logtools-columnar -d file.lcol\n"
+		"\n"
+		"Converts a logtools text log to the columnar format written by ColumnarLogSink, so existing logs can be\n"
+		"queried the same way. Wrapped lines are joined, and indentation and severity prefixes are removed from the\n"
+		"text. Timestamps are taken from a logtools-collect -t prefix or sharded record fields if there are any,\n"
+		"otherwise they're zero.\n"
+		"\n"
+		"With -d, prints each record of a columnar file in the ShardedFileLogSink record format, which\n"
+		"logtools-grep and logtools-merge understand.\n"
+		"\n"
+		"Options:\n"
+		"    -d, --dump         Print the records of a columnar file\n"
+		"    -i, --indent N     Indent size of the text log (default 4)\n"
+		"    -w, --width N      Width the text log was wrapped at (default 120, 0 to not join lines)\n");
+}
+
+/**
+	@brief Converts a text log to a columnar file
+ */
+static int Convert(const string& in, const string& out, unsigned indent, unsigned width)
+{
+	int fd = open(in.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		fprintf(stderr, "Couldn't open %s\n", in.c_str());
+		return 1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return 1;
+	}
+	size_t size = st.st_size;
+	const char* base = "";
+	if(size)
+	{
+		base = static_cast<const char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+		if(base == MAP_FAILED)
+		{
+			close(fd);
+			fprintf(stderr, "Couldn't map %s\n", in.c_str());
+			return 1;
+		}
+		madvise(const_cast<char*>(base), size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	LogColumnWriter writer(out);
+	if(!writer.IsOpen())
+	{
+		fprintf(stderr, "Couldn't open %s for writing\n", out.c_str());
+		return 1;
+	}
+
+	LogTextParser parser(indent, width);
+	parser.SetInput(string_view(base, size));
+	LogTextParser::Record rec;
+	while(parser.Next(rec))
+		writer.Append(rec.hasTimestamp ? rec.timestamp : 0, rec.severity, rec.function, rec.text);
+
+	if(size)
+		munmap(const_cast<char*>(base), size);
+	return 0;
+}
+
+/**
+	@brief Prints the records of a columnar file
+ */
+static int Dump(const string& path)
+{
+	LogColumnReader reader(path);
+	if(!reader.IsOpen())
+	{
+		fprintf(stderr, "Couldn't open %s, or it isn't a columnar log\n", path.c_str());
+		return 1;
+	}
+
+	uint64_t sequence = 0;
+	LogColumnReader::Segment seg;
+	while(reader.Next(seg))
+	{
+		for(size_t i=0; i<seg.count; i++)
+		{
+			printf("%" PRIu64 "\t%" PRIu64 "\t%d\t", sequence++, seg.timestamps[i], static_cast<int>(seg.severities[i]));
+			auto function = seg.GetFunction(i);
+			if(!function.empty())
+				printf("[%.*s] ", static_cast<int>(function.length()), function.data());
+			fwrite(seg.texts[i].data(), 1, seg.texts[i].length(), stdout);
+			fputc('\n', stdout);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	bool dump = false;
+	unsigned indent = 4;
+	unsigned width = 120;
+	vector<string> args;
+
+	for(int i=1; i<argc; i++)
+	{
+		string s(argv[i]);
+
+		if( (s == "-d") || (s == "--dump") )
+			dump = true;
+		else if( (s == "-i") || (s == "--indent") || (s == "-w") || (s == "--width") )
+		{
+			if(i+1 >= argc)
+			{
+				fprintf(stderr, "%s requires an argument\n", s.c_str());
+				return 1;
+			}
+			unsigned n = atoi(argv[++i]);
+			if( (s == "-i") || (s == "--indent") )
+				indent = n;
+			else
+				width = n;
+		}
+		else if( (s == "-h") || (s == "--help") )
+		{
+			ShowUsage();
+			return 0;
+		}
+		else if(s[0] == '-')
+		{
+			fprintf(stderr, "Unrecognized argument %s\n", s.c_str());
+			ShowUsage();
+			return 1;
+		}
+		else
+			args.push_back(s);
+	}
+
+	if(dump && (args.size() == 1) )
+		return Dump(args[0]);
+	else if(!dump && (args.size() == 2) )
+		return Convert(args[0], args[1], indent, width);
+
+	ShowUsage();
+	return 1;
+}
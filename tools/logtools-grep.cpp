@@ -0,0 +1,771 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		logtools-grep: filters logtools text logs by severity, class, time and pattern
+	@ingroup	liblog
+ */
+
+#include "log.h"
+#include "LogParser.h"
+#include "LogSearch.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <regex.h>
+#include <set>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+
+/**
+	@brief Each thread works on pieces of the file about this big
+ */
+static const size_t g_chunkSize = 8 * 1024 * 1024;
+
+#ifndef __linux__
+/**
+	@brief How often followed files are checked for changes where there's no inotify
+ */
+static const chrono::milliseconds g_followPollInterval(250);
+#endif
+
+static void ShowUsage()
+{
+	fprintf(stderr,
+		"Usage: logtools-grep [options] [pattern] file [file...]\n"
+		"\n"
+		"Prints the lines of logtools text logs that match all of the given filters. Understands the \"ERROR: \",\n"
+		"\"Warning: \" and \"[Class::function]\" conventions of log.cpp, the timestamp prefix written by\n"
+		"logtools-collect -t, and the record fields written by ShardedFileLogSink.\n"
+		"\n"
+		"Lines with no severity marker count as notices. Lines with no timestamp never match a time filter.\n"
+		"\n"
+		"Options:\n"
+		"    -e, --regex PATTERN    Match lines against an extended regular expression\n"
+		"    -F, --fixed STRING     Match lines containing STRING (also used for a bare pattern argument)\n"
+		"    -v, --invert           Print lines that don't match the pattern (other filters still apply)\n"
+		"    -s, --severity LEVEL   Only lines at LEVEL or more severe: fatal, error, warning, notice, verbose, debug\n"
+		"    -c, --class NAME       Only LogTrace() lines from class NAME (may be repeated)\n"
+		"    -a, --after TIME       Only lines at or after TIME\n"
+		"    -b, --before TIME      Only lines before TIME\n"
+		"    -n, --count            Print the number of matching lines instead of the lines\n"
+		"    -f, --follow           After the existing lines, keep printing matching lines as they're appended.\n"
+		"                           Keeps following the file name when the log is rotated by renaming it.\n"
+		"                           Uses inotify on Linux, and checks the files four times a second elsewhere.\n"
+		"    -j, --threads N        Number of worker threads (default: all cores)\n"
+		"\n"
+		"TIME is either seconds since the Unix epoch or \"YYYY-MM-DD HH:MM:SS\" in local time.\n");
+}
+
+/**
+	@brief What a line has to satisfy to be printed
+ */
+struct Filter
+{
+	int			maxSeverity = static_cast<int>(Severity::DEBUG);
+	set<string, less<>>	classes;
+	bool		haveAfter = false;
+	bool		haveBefore = false;
+	uint64_t	after = 0;
+	uint64_t	before = 0;
+	string		fixed;
+	bool		haveRegex = false;
+	regex_t		regex;
+	bool		invert = false;
+};
+
+/**
+	@brief Per-thread scratch state
+ */
+struct Scanner
+{
+	const Filter*	filter;
+
+	//Lines are matched one at a time, so wrapped continuation lines aren't joined
+	LogTextParser	parser{4, 0};
+	LogTextParser::Record rec;
+
+	//NUL terminated copy of the line for regexec()
+	string			line;
+
+	/**
+		@brief Checks one line (without its newline) against the filter
+	 */
+	bool Match(const char* p, const char* end)
+	{
+		auto& f = *filter;
+		parser.ParseLine(string_view(p, end - p), rec);
+
+		if(f.haveAfter || f.haveBefore)
+		{
+			if(!rec.hasTimestamp)
+				return false;
+			if(f.haveAfter && (rec.timestamp < f.after))
+				return false;
+			if(f.haveBefore && (rec.timestamp >= f.before))
+				return false;
+		}
+
+		if(static_cast<int>(rec.severity) > f.maxSeverity)
+			return false;
+		if(!f.classes.empty() && (rec.function.empty() || (f.classes.find(rec.className) == f.classes.end()) ) )
+			return false;
+
+		//Pattern last, it's the most expensive
+		bool hit = true;
+		if(!f.fixed.empty())
+			hit = (LogFindSubstring(p, end, f.fixed) != nullptr);
+		else if(f.haveRegex)
+		{
+			line.assign(p, end);
+			hit = (regexec(&f.regex, line.c_str(), 0, nullptr, 0) == 0);
+		}
+		return hit != f.invert;
+	}
+};
+
+/**
+	@brief Matching lines (or the count) found in one chunk
+ */
+struct ChunkResult
+{
+	string	out;
+	size_t	count = 0;
+	bool	done = false;
+};
+
+/**
+	@brief Scans [begin, end) (which starts at a line start and ends after a newline or at EOF)
+ */
+static void ScanChunk(Scanner& s, const char* begin, const char* end, bool countOnly, ChunkResult& result)
+{
+	auto& f = *s.filter;
+
+	//Fixed string with no inversion: jump from one occurrence to the next instead of visiting every line
+	if(!f.fixed.empty() && !f.invert)
+	{
+		const char* p = begin;
+		while( (p = LogFindSubstring(p, end, f.fixed)) != nullptr)
+		{
+			const char* lineStart = p;
+			while( (lineStart > begin) && (lineStart[-1] != '\n') )
+				lineStart --;
+			const char* lineEnd = LogFindNewline(p, end);
+
+			if(s.Match(lineStart, lineEnd))
+			{
+				result.count ++;
+				if(!countOnly)
+				{
+					result.out.append(lineStart, lineEnd);
+					result.out += '\n';
+				}
+			}
+			p = (lineEnd < end) ? lineEnd + 1 : end;
+		}
+		return;
+	}
+
+	for(const char* p = begin; p < end; )
+	{
+		const char* lineEnd = LogFindNewline(p, end);
+		if(s.Match(p, lineEnd))
+		{
+			result.count ++;
+			if(!countOnly)
+			{
+				result.out.append(p, lineEnd);
+				result.out += '\n';
+			}
+		}
+		p = lineEnd + 1;
+	}
+}
+
+/**
+	@brief Parses a TIME argument into ns since the epoch
+ */
+static bool ParseTime(const string& s, uint64_t& ns)
+{
+	char* endp;
+	unsigned long long secs = strtoull(s.c_str(), &endp, 10);
+	if(!s.empty() && (*endp == '\0') )
+	{
+		ns = secs * 1000000000ULL;
+		return true;
+	}
+
+	struct tm t;
+	memset(&t, 0, sizeof(t));
+	const char* rest = strptime(s.c_str(), "%Y-%m-%d %H:%M:%S", &t);
+	if(!rest || *rest)
+		return false;
+	t.tm_isdst = -1;
+	ns = static_cast<uint64_t>(mktime(&t)) * 1000000000ULL;
+	return true;
+}
+
+/**
+	@brief Writes matching lines, each preceded by the file name prefix (if any)
+ */
+static void WriteLines(FILE* out, const string& lines, const string& prefix)
+{
+	if(prefix.empty())
+	{
+		fwrite(lines.data(), 1, lines.length(), out);
+		return;
+	}
+
+	for(size_t start = 0; start < lines.length(); )
+	{
+		size_t nl = lines.find('\n', start);
+		fputs(prefix.c_str(), out);
+		fwrite(lines.data() + start, 1, nl + 1 - start, out);
+		start = nl + 1;
+	}
+}
+
+/**
+	@brief Finds the last newline in [begin, end), or returns null if there is none
+
+	memrchr() would do, but it's a GNU extension. Only the trailing partial line is scanned, which is short.
+ */
+static const char* FindLastNewline(const char* begin, const char* end)
+{
+	for(const char* p = end; p > begin; p--)
+	{
+		if(p[-1] == '\n')
+			return p - 1;
+	}
+	return nullptr;
+}
+
+/**
+	@brief Filters one file, writing matches in file order
+
+	@param consumed	If not null, a trailing partial line is left alone (for follow mode to pick up once it's
+					complete) and the number of bytes processed is returned here
+
+	@return Number of matching lines, or -1 if the file couldn't be read
+ */
+static long long GrepFile(const string& path, const Filter& filter, unsigned nthreads, bool countOnly, FILE* out,
+	const string& prefix, size_t* consumed = nullptr)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return -1;
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	size_t mapped = st.st_size;
+	if(consumed)
+		*consumed = 0;
+	if(mapped == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	auto base = static_cast<const char*>(mmap(nullptr, mapped, PROT_READ, MAP_PRIVATE, fd, 0));
+	close(fd);
+	if(base == MAP_FAILED)
+		return -1;
+	madvise(const_cast<char*>(base), mapped, MADV_SEQUENTIAL);
+
+	size_t size = mapped;
+	if(consumed)
+	{
+		auto lastNewline = FindLastNewline(base, base + size);
+		size = lastNewline ? (lastNewline - base + 1) : 0;
+		*consumed = size;
+	}
+
+	//Split into chunks at line boundaries
+	vector<const char*> bounds;
+	bounds.push_back(base);
+	const char* end = base + size;
+	while(bounds.back() < end)
+	{
+		const char* p = bounds.back() + min(g_chunkSize, static_cast<size_t>(end - bounds.back()));
+		if(p < end)
+			p = LogFindNewline(p, end) + 1;
+		bounds.push_back(min(p, end));
+	}
+	size_t nchunks = bounds.size() - 1;
+
+	//Workers take chunks in order; results are printed in order as they complete
+	vector<ChunkResult> results(nchunks);
+	atomic<size_t> next(0);
+	mutex m;
+	condition_variable cond;
+	auto worker = [&]()
+	{
+		Scanner s;
+		s.filter = &filter;
+
+		size_t i;
+		while( (i = next++) < nchunks)
+		{
+			ChunkResult r;
+			ScanChunk(s, bounds[i], bounds[i+1], countOnly, r);
+			lock_guard<mutex> lock(m);
+			results[i] = move(r);
+			results[i].done = true;
+			cond.notify_all();
+		}
+	};
+
+	vector<thread> threads;
+	for(unsigned t=0; t<min(static_cast<size_t>(nthreads), nchunks); t++)
+		threads.emplace_back(worker);
+
+	long long total = 0;
+	for(size_t i=0; i<nchunks; i++)
+	{
+		string chunk;
+		{
+			unique_lock<mutex> lock(m);
+			cond.wait(lock, [&] { return results[i].done; });
+			chunk.swap(results[i].out);
+			total += results[i].count;
+		}
+
+		WriteLines(out, chunk, prefix);
+	}
+
+	for(auto& t : threads)
+		t.join();
+	munmap(const_cast<char*>(base), mapped);
+	return total;
+}
+
+/**
+	@brief One open copy of a file being followed
+ */
+struct FollowedSource
+{
+	int		fd = -1;
+	int		wd = -1;
+	dev_t	dev = 0;
+	ino_t	inode = 0;
+	off_t	pos = 0;
+
+	//Start of a line that hasn't been finished yet
+	string	partial;
+};
+
+/**
+	@brief A file name being followed
+
+	When the file is rotated by renaming it, the writer may keep appending to the old file until it reopens the log,
+	so the old copy is kept open and read until the new one is written to.
+ */
+struct FollowedFile
+{
+	string			path;
+	string			prefix;
+	FollowedSource	current;
+	FollowedSource	rotated;
+};
+
+/**
+	@brief Opens whatever file the path refers to now and starts watching it for changes
+ */
+static bool OpenSource(FollowedSource& src, const string& path, int ifd)
+{
+	src.fd = open(path.c_str(), O_RDONLY);
+	if(src.fd < 0)
+		return false;
+
+	struct stat st;
+	if(fstat(src.fd, &st) != 0)
+	{
+		close(src.fd);
+		src.fd = -1;
+		return false;
+	}
+	src.dev = st.st_dev;
+	src.inode = st.st_ino;
+	src.pos = 0;
+	src.partial.clear();
+#ifdef __linux__
+	src.wd = inotify_add_watch(ifd, path.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+#else
+	(void)ifd;
+#endif
+	return true;
+}
+
+static void CloseSource(FollowedSource& src, int ifd)
+{
+#ifdef __linux__
+	if(src.wd >= 0)
+		inotify_rm_watch(ifd, src.wd);
+#else
+	(void)ifd;
+#endif
+	if(src.fd >= 0)
+		close(src.fd);
+	src = FollowedSource();
+}
+
+/**
+	@brief Reads everything appended to a file since the last call and prints the lines that match
+
+	@param final	True if nothing more will be written, so a trailing partial line is treated as complete
+ */
+static void ReadAppended(FollowedSource& src, Scanner& s, FILE* out, const string& prefix, bool final)
+{
+	if(src.fd < 0)
+		return;
+
+	//Truncated in place (e.g. logrotate copytruncate): start again from the top
+	struct stat st;
+	if( (fstat(src.fd, &st) == 0) && (st.st_size < src.pos) )
+	{
+		src.pos = 0;
+		src.partial.clear();
+	}
+
+	char buf[65536];
+	ssize_t len;
+	while( (len = pread(src.fd, buf, sizeof(buf), src.pos)) > 0)
+	{
+		src.pos += len;
+		src.partial.append(buf, len);
+
+		size_t complete = src.partial.rfind('\n');
+		if(complete == string::npos)
+			continue;
+		complete ++;
+
+		ChunkResult r;
+		ScanChunk(s, src.partial.data(), src.partial.data() + complete, false, r);
+		WriteLines(out, r.out, prefix);
+		src.partial.erase(0, complete);
+	}
+
+	if(final && !src.partial.empty())
+	{
+		src.partial += '\n';
+		ChunkResult r;
+		ScanChunk(s, src.partial.data(), src.partial.data() + src.partial.length(), false, r);
+		WriteLines(out, r.out, prefix);
+		src.partial.clear();
+	}
+}
+
+/**
+	@brief Catches up on one followed file, switching to a new file if the log has been rotated
+ */
+static void UpdateFollowed(FollowedFile& f, Scanner& s, FILE* out, int ifd)
+{
+	ReadAppended(f.rotated, s, out, f.prefix, false);
+	ReadAppended(f.current, s, out, f.prefix, false);
+
+	//Has the name been given to a different file?
+	struct stat st;
+	if(stat(f.path.c_str(), &st) != 0)
+		return;
+	if( (f.current.fd >= 0) && (st.st_dev == f.current.dev) && (st.st_ino == f.current.inode) )
+	{
+		//Once the writer has moved on to the new file, the old one is finished
+		if( (f.rotated.fd >= 0) && (st.st_size > 0) )
+		{
+			ReadAppended(f.rotated, s, out, f.prefix, true);
+			CloseSource(f.rotated, ifd);
+		}
+		return;
+	}
+
+	//Rotated: keep draining the old file, read the new one from the beginning
+	if(f.rotated.fd >= 0)
+	{
+		ReadAppended(f.rotated, s, out, f.prefix, true);
+		CloseSource(f.rotated, ifd);
+	}
+	f.rotated = move(f.current);
+	f.current = FollowedSource();
+	if(OpenSource(f.current, f.path, ifd))
+		ReadAppended(f.current, s, out, f.prefix, false);
+}
+
+/**
+	@brief Sleeps until a followed file may have changed
+
+	@param ifd	inotify descriptor to read events from, or -1 where there's no inotify and this just sleeps for
+				g_followPollInterval
+
+	@return False if waiting failed
+ */
+static bool WaitForChange(int ifd)
+{
+#ifdef __linux__
+	//Which file changed doesn't matter, everything is checked on every wakeup
+	alignas(inotify_event) char events[4096];
+	if( (read(ifd, events, sizeof(events)) < 0) && (errno != EINTR) )
+	{
+		perror("read");
+		return false;
+	}
+#else
+	(void)ifd;
+	this_thread::sleep_for(g_followPollInterval);
+#endif
+	return true;
+}
+
+/**
+	@brief Prints matching lines as they're appended to the files, until killed
+
+	On Linux, sleeps in read() on an inotify descriptor between changes, so an idle log costs no CPU time. The
+	directories are watched as well as the files, so a file created under the followed name after a rename is picked
+	up. Elsewhere, the files are checked every g_followPollInterval.
+ */
+static int FollowFiles(vector<FollowedFile>& files, const Filter& filter, FILE* out)
+{
+#ifdef __linux__
+	int ifd = inotify_init1(IN_CLOEXEC);
+	if(ifd < 0)
+	{
+		perror("inotify_init1");
+		return 2;
+	}
+
+	set<string> dirs;
+	for(auto& f : files)
+	{
+		size_t slash = f.path.rfind('/');
+		dirs.insert( (slash == string::npos) ? "." : f.path.substr(0, slash + 1));
+	}
+	for(auto& d : dirs)
+		inotify_add_watch(ifd, d.c_str(), IN_CREATE | IN_MOVED_TO);
+#else
+	int ifd = -1;
+#endif
+
+	//Pick up where the initial pass over each file left off
+	for(auto& f : files)
+	{
+		off_t start = f.current.pos;
+		if(OpenSource(f.current, f.path, ifd))
+			f.current.pos = start;
+	}
+
+	Scanner s;
+	s.filter = &filter;
+	while(true)
+	{
+		for(auto& f : files)
+			UpdateFollowed(f, s, out, ifd);
+		fflush(out);
+
+		if(!WaitForChange(ifd))
+			break;
+	}
+
+	if(ifd >= 0)
+		close(ifd);
+	return 2;
+}
+
+int main(int argc, char* argv[])
+{
+	Filter filter;
+	bool countOnly = false;
+	bool follow = false;
+	unsigned nthreads = max(1u, thread::hardware_concurrency());
+	string regex;
+	vector<string> args;
+
+	for(int i=1; i<argc; i++)
+	{
+		string s(argv[i]);
+
+		//Options taking an argument
+		if( (s == "-e") || (s == "--regex") || (s == "-F") || (s == "--fixed") || (s == "-s") || (s == "--severity") ||
+			(s == "-c") || (s == "--class") || (s == "-a") || (s == "--after") || (s == "-b") || (s == "--before") ||
+			(s == "-j") || (s == "--threads") )
+		{
+			if(i+1 >= argc)
+			{
+				fprintf(stderr, "%s requires an argument\n", s.c_str());
+				return 1;
+			}
+			string arg = argv[++i];
+
+			if( (s == "-e") || (s == "--regex") )
+				regex = arg;
+			else if( (s == "-F") || (s == "--fixed") )
+				filter.fixed = arg;
+			else if( (s == "-c") || (s == "--class") )
+				filter.classes.insert(arg);
+			else if( (s == "-j") || (s == "--threads") )
+				nthreads = max(1, atoi(arg.c_str()));
+			else if( (s == "-s") || (s == "--severity") )
+			{
+				static const char* names[] = {"fatal", "error", "warning", "notice", "verbose", "debug"};
+				auto it = find_if(begin(names), end(names), [&](const char* n) { return arg == n; });
+				if(it == end(names))
+				{
+					fprintf(stderr, "Unrecognized severity %s\n", arg.c_str());
+					return 1;
+				}
+				filter.maxSeverity = static_cast<int>(Severity::FATAL) + (it - begin(names));
+			}
+			else
+			{
+				bool isAfter = (s == "-a") || (s == "--after");
+				uint64_t ns;
+				if(!ParseTime(arg, ns))
+				{
+					fprintf(stderr, "Couldn't parse time %s\n", arg.c_str());
+					return 1;
+				}
+				if(isAfter)
+				{
+					filter.haveAfter = true;
+					filter.after = ns;
+				}
+				else
+				{
+					filter.haveBefore = true;
+					filter.before = ns;
+				}
+			}
+		}
+		else if( (s == "-v") || (s == "--invert") )
+			filter.invert = true;
+		else if( (s == "-n") || (s == "--count") )
+			countOnly = true;
+		else if( (s == "-f") || (s == "--follow") )
+			follow = true;
+		else if( (s == "-h") || (s == "--help") )
+		{
+			ShowUsage();
+			return 0;
+		}
+		else if( (s[0] == '-') && (s.length() > 1) )
+		{
+			fprintf(stderr, "Unrecognized argument %s\n", s.c_str());
+			ShowUsage();
+			return 1;
+		}
+		else
+			args.push_back(s);
+	}
+
+	//With no other filters, the first argument is the pattern, as with grep
+	bool haveFilters = !regex.empty() || !filter.fixed.empty() || (filter.maxSeverity < static_cast<int>(Severity::DEBUG))
+		|| !filter.classes.empty() || filter.haveAfter || filter.haveBefore;
+	if(!haveFilters && (args.size() >= 2) )
+	{
+		filter.fixed = args[0];
+		args.erase(args.begin());
+	}
+	if(args.empty())
+	{
+		ShowUsage();
+		return 1;
+	}
+	if(follow && countOnly)
+	{
+		fprintf(stderr, "--follow and --count can't be used together\n");
+		return 1;
+	}
+
+	if(!regex.empty())
+	{
+		if(regcomp(&filter.regex, regex.c_str(), REG_EXTENDED | REG_NOSUB) != 0)
+		{
+			fprintf(stderr, "Invalid regular expression %s\n", regex.c_str());
+			return 1;
+		}
+		filter.haveRegex = true;
+	}
+
+	int ret = 1;
+	vector<FollowedFile> followed;
+	for(auto& path : args)
+	{
+		string prefix = (args.size() > 1) ? path + ":" : "";
+		size_t consumed = 0;
+		long long n = GrepFile(path, filter, nthreads, countOnly, stdout, countOnly ? "" : prefix,
+			follow ? &consumed : nullptr);
+		if(n < 0)
+		{
+			fprintf(stderr, "Couldn't read %s\n", path.c_str());
+			return 2;
+		}
+		if(countOnly)
+			printf("%s%lld\n", prefix.c_str(), n);
+		if(n > 0)
+			ret = 0;
+
+		if(follow)
+		{
+			FollowedFile f;
+			f.path = path;
+			f.prefix = prefix;
+			f.current.pos = consumed;
+			followed.push_back(move(f));
+		}
+	}
+
+	if(follow)
+	{
+		fflush(stdout);
+		ret = FollowFiles(followed, filter, stdout);
+	}
+
+	if(filter.haveRegex)
+		regfree(&filter.regex);
+	return ret;
+}
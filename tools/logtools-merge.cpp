@@ -0,0 +1,238 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* logtools                                                                                                             *
+*                                                                                                                      *
+* Copyright (c) 2016-2024 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief		logtools-merge: merges the shard files written by ShardedFileLogSink into a single log
+	@ingroup	liblog
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <queue>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static void ShowUsage()
+{
+	fprintf(stderr,
+		"Usage: logtools-merge [options] shard [shard...]\n"
+		"\n"
+		"Merges the shard files written by ShardedFileLogSink into one log, ordered by sequence number.\n"
+		"Files are read a line at a time, so memory use doesn't depend on their size.\n"
+		"\n"
+		"The order follows sequence numbers alone. Timestamps are taken separately from them, so with several\n"
+		"threads logging at once, a merged line can have a slightly earlier timestamp than the line before it.\n"
+		"\n"
+		"Options:\n"
+		"    -b, --by-time      Order by timestamp instead (for shards written by different processes)\n"
+		"    -o, --output FILE  Write to FILE instead of stdout\n"
+		"    -r, --raw          Keep the record fields, so the output can itself be merged again\n"
+		"    -s, --shard        Prefix each line with the name of the shard it came from\n"
+		"    -t, --time         Prefix each line with the record's timestamp\n");
+}
+
+/**
+	@brief One shard file, positioned at its next record
+ */
+struct ShardReader
+{
+	string		name;
+	FILE*		fp;
+
+	//Current record
+	uint64_t	sequence;
+	uint64_t	timestamp;
+	string		line;		//the whole record line, including the fields
+	size_t		textOffset;	//start of the text within line
+
+	char*		buf = nullptr;
+	size_t		bufsize = 0;
+
+	/**
+		@brief Reads the next well-formed record, returning false at end of file
+	 */
+	bool Next()
+	{
+		ssize_t len;
+		while( (len = getline(&buf, &bufsize, fp)) > 0)
+		{
+			int sev;
+			int offset = 0;
+			if(sscanf(buf, "%" SCNu64 "\t%" SCNu64 "\t%d\t%n", &sequence, &timestamp, &sev, &offset) < 3 || !offset)
+				continue;
+
+			line.assign(buf, len);
+			if(line[line.length() - 1] != '\n')
+				line += '\n';
+			textOffset = offset;
+			return true;
+		}
+		return false;
+	}
+};
+
+/**
+	@brief Heap ordering: smallest key first, ties broken by shard order for a stable result
+ */
+struct ShardCompare
+{
+	bool byTime;
+
+	bool operator()(const ShardReader* a, const ShardReader* b) const
+	{
+		uint64_t ka = byTime ? a->timestamp : a->sequence;
+		uint64_t kb = byTime ? b->timestamp : b->sequence;
+		if(ka != kb)
+			return ka > kb;
+		if(a->sequence != b->sequence)
+			return a->sequence > b->sequence;
+		return a > b;
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	bool byTime = false;
+	bool raw = false;
+	bool showShard = false;
+	bool showTime = false;
+	string outpath;
+	vector<ShardReader> shards;
+
+	for(int i=1; i<argc; i++)
+	{
+		string s(argv[i]);
+
+		if( (s == "-b") || (s == "--by-time") )
+			byTime = true;
+		else if( (s == "-r") || (s == "--raw") )
+			raw = true;
+		else if( (s == "-s") || (s == "--shard") )
+			showShard = true;
+		else if( (s == "-t") || (s == "--time") )
+			showTime = true;
+		else if( (s == "-o") || (s == "--output") )
+		{
+			if(i+1 >= argc)
+			{
+				fprintf(stderr, "%s requires an argument\n", s.c_str());
+				return 1;
+			}
+			outpath = argv[++i];
+		}
+		else if( (s == "-h") || (s == "--help") )
+		{
+			ShowUsage();
+			return 0;
+		}
+		else if(s[0] == '-')
+		{
+			fprintf(stderr, "Unrecognized argument %s\n", s.c_str());
+			ShowUsage();
+			return 1;
+		}
+		else
+		{
+			ShardReader r;
+			r.name = s;
+			r.fp = fopen(s.c_str(), "r");
+			if(!r.fp)
+			{
+				fprintf(stderr, "Couldn't open shard %s\n", s.c_str());
+				return 1;
+			}
+			shards.push_back(r);
+		}
+	}
+
+	if(shards.empty())
+	{
+		ShowUsage();
+		return 1;
+	}
+
+	FILE* fp = stdout;
+	if(!outpath.empty())
+	{
+		fp = fopen(outpath.c_str(), "w");
+		if(!fp)
+		{
+			fprintf(stderr, "Couldn't open %s for writing\n", outpath.c_str());
+			return 1;
+		}
+	}
+
+	//Streaming k-way merge: the heap holds each shard's next record
+	priority_queue<ShardReader*, vector<ShardReader*>, ShardCompare> heap(ShardCompare{byTime});
+	for(auto& r : shards)
+	{
+		if(r.Next())
+			heap.push(&r);
+	}
+
+	while(!heap.empty())
+	{
+		auto r = heap.top();
+		heap.pop();
+
+		if(showShard)
+			fprintf(fp, "%s: ", r->name.c_str());
+		if(showTime)
+		{
+			char prefix[64];
+			time_t secs = r->timestamp / 1000000000ULL;
+			struct tm t;
+			localtime_r(&secs, &t);
+			size_t plen = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &t);
+			snprintf(prefix + plen, sizeof(prefix) - plen, ".%06u ",
+				static_cast<unsigned>( (r->timestamp % 1000000000ULL) / 1000) );
+			fputs(prefix, fp);
+		}
+		size_t start = raw ? 0 : r->textOffset;
+		fwrite(r->line.c_str() + start, 1, r->line.length() - start, fp);
+
+		if(r->Next())
+			heap.push(r);
+	}
+
+	for(auto& r : shards)
+	{
+		fclose(r.fp);
+		free(r.buf);
+	}
+	if(fp != stdout)
+		fclose(fp);
+	return 0;
+}